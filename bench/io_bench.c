@@ -0,0 +1,174 @@
+/* io_bench.c - blocking vs io_uring storage backends on small and big files */
+#define _GNU_SOURCE /* struct statx */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../sio.h"
+
+#define SMALL_FILES 4096
+#define SMALL_BYTES (4 * 1024)
+#define BIG_MB 128
+#define BIG_BLOCK (1024 * 1024)
+#define ROUNDS 3
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    const char *dir;
+    size_t files;
+    size_t big_mb;
+    char (*paths)[256];
+    unsigned char *data;   // SMALL_BYTES per small file, or BIG_BLOCK per in-flight block
+    sio_op_t *ops;
+    int *fds;
+} bench_t;
+
+/* Run ops in SIO_DEPTH-sized batches, as the server's workers do */
+static int run_batches(sio_t *io, sio_op_t *ops, size_t n) {
+    for (size_t i = 0; i < n; i += SIO_DEPTH) {
+        size_t k = n - i < SIO_DEPTH ? n - i : SIO_DEPTH;
+        if (sio_run(io, ops + i, k) != 0) return -1;
+        for (size_t j = i; j < i + k; ++j) {
+            if (ops[j].res < 0) return -1;
+        }
+    }
+    return 0;
+}
+
+static int small_open(bench_t *b, sio_t *io, int flags) {
+    for (size_t i = 0; i < b->files; ++i) {
+        b->ops[i] = (sio_op_t){ .op = SIO_OPEN, .path = b->paths[i], .flags = flags, .mode = 0600 };
+    }
+    if (run_batches(io, b->ops, b->files) != 0) return -1;
+    for (size_t i = 0; i < b->files; ++i) b->fds[i] = (int)b->ops[i].res;
+    return 0;
+}
+
+static int small_rw(bench_t *b, sio_t *io, sio_opcode_t op) {
+    for (size_t i = 0; i < b->files; ++i) {
+        b->ops[i] = (sio_op_t){ .op = op, .fd = b->fds[i], .buf = b->data + i * SMALL_BYTES, .len = SMALL_BYTES };
+    }
+    if (run_batches(io, b->ops, b->files) != 0) return -1;
+    for (size_t i = 0; i < b->files; ++i) {
+        b->ops[i] = (sio_op_t){ .op = SIO_CLOSE, .fd = b->fds[i] };
+    }
+    return run_batches(io, b->ops, b->files);
+}
+
+static int small_path_op(bench_t *b, sio_t *io, sio_opcode_t op, struct statx *st) {
+    for (size_t i = 0; i < b->files; ++i) {
+        b->ops[i] = (sio_op_t){ .op = op, .path = b->paths[i], .buf = st };
+    }
+    return run_batches(io, b->ops, b->files);
+}
+
+/* Create, stat, read back and unlink many small files; files/s per phase */
+static int bench_small(bench_t *b, sio_t *io) {
+    double best[4] = { 1e9, 1e9, 1e9, 1e9 };
+    struct statx st;
+    for (int round = 0; round < ROUNDS; ++round) {
+        double t0 = now_sec();
+        if (small_open(b, io, O_WRONLY | O_CREAT | O_TRUNC) != 0 || small_rw(b, io, SIO_WRITE) != 0) return -1;
+        double t1 = now_sec();
+        if (small_path_op(b, io, SIO_STATX, &st) != 0) return -1;
+        double t2 = now_sec();
+        if (small_open(b, io, O_RDONLY) != 0 || small_rw(b, io, SIO_READ) != 0) return -1;
+        double t3 = now_sec();
+        if (small_path_op(b, io, SIO_UNLINK, NULL) != 0) return -1;
+        double t4 = now_sec();
+        double t[4] = { t1 - t0, t2 - t1, t3 - t2, t4 - t3 };
+        for (int i = 0; i < 4; ++i) if (t[i] < best[i]) best[i] = t[i];
+    }
+    printf("%-10s %-6s %12.0f %12.0f %12.0f %12.0f\n", io->be->name, "small", b->files / best[0],
+           b->files / best[1], b->files / best[2], b->files / best[3]);
+    return 0;
+}
+
+/* One big file in BIG_BLOCK pieces, SIO_DEPTH of them in flight; MB/s */
+static int bench_big(bench_t *b, sio_t *io) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/big", b->dir);
+    size_t blocks = b->big_mb * 1024 * 1024 / BIG_BLOCK;
+    double best_w = 1e9, best_r = 1e9;
+    for (int round = 0; round < ROUNDS; ++round) {
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) return -1;
+        double t0 = now_sec();
+        for (size_t i = 0; i < blocks; ++i) {
+            b->ops[i] = (sio_op_t){ .op = SIO_WRITE, .fd = fd, .buf = b->data + (i % SIO_DEPTH) * BIG_BLOCK,
+                                    .len = BIG_BLOCK, .off = (off_t)(i * BIG_BLOCK) };
+        }
+        int r = run_batches(io, b->ops, blocks);
+        if (r == 0) r = fdatasync(fd);
+        double t1 = now_sec();
+        /* read from the device, not the page cache the writes just filled */
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        double t2 = now_sec();
+        for (size_t i = 0; r == 0 && i < blocks; ++i) {
+            b->ops[i] = (sio_op_t){ .op = SIO_READ, .fd = fd, .buf = b->data + (i % SIO_DEPTH) * BIG_BLOCK,
+                                    .len = BIG_BLOCK, .off = (off_t)(i * BIG_BLOCK) };
+        }
+        if (r == 0) r = run_batches(io, b->ops, blocks);
+        double t3 = now_sec();
+        close(fd);
+        unlink(path);
+        if (r != 0) return -1;
+        if (t1 - t0 < best_w) best_w = t1 - t0;
+        if (t3 - t2 < best_r) best_r = t3 - t2;
+    }
+    printf("%-10s %-6s %12.1f %12s %12.1f %12s\n", io->be->name, "big", b->big_mb / best_w, "-",
+           b->big_mb / best_r, "-");
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bench_t b = { argc > 1 ? argv[1] : "/tmp", argc > 2 ? strtoul(argv[2], NULL, 10) : SMALL_FILES,
+                  argc > 3 ? strtoul(argv[3], NULL, 10) : BIG_MB, NULL, NULL, NULL, NULL };
+    if (b.files == 0 || b.big_mb == 0) {
+        fprintf(stderr, "usage: %s [dir] [small files] [big MB]\n", argv[0]);
+        return 1;
+    }
+    size_t blocks = b.big_mb * 1024 * 1024 / BIG_BLOCK;
+    size_t nops = b.files > blocks ? b.files : blocks;
+    size_t data = b.files * SMALL_BYTES > SIO_DEPTH * BIG_BLOCK ? b.files * SMALL_BYTES : SIO_DEPTH * BIG_BLOCK;
+    b.paths = malloc(b.files * sizeof(*b.paths));
+    b.data = malloc(data);
+    b.ops = malloc(nops * sizeof(sio_op_t));
+    b.fds = malloc(b.files * sizeof(int));
+    if (!b.paths || !b.data || !b.ops || !b.fds) return 1;
+    for (size_t i = 0; i < data; ++i) b.data[i] = (unsigned char)(i * 131 + (i >> 12));
+    for (size_t i = 0; i < b.files; ++i) snprintf(b.paths[i], sizeof(b.paths[i]), "%s/io_bench.%zu", b.dir, i);
+
+    printf("%zu x %d KB small files, %zu MB big file in %s, %d in flight\n", b.files, SMALL_BYTES / 1024,
+           b.big_mb, b.dir, SIO_DEPTH);
+    printf("%-10s %-6s %12s %12s %12s %12s\n", "backend", "files", "create/s", "stat/s", "read/s", "unlink/s");
+    printf("%-10s %-6s %12s %12s %12s %12s\n", "", "", "write MB/s", "", "read MB/s", "");
+    const sio_backend_t *backends[] = { &sio_blocking, &sio_uring };
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); ++i) {
+        sio_t io;
+        if (sio_open(&io, backends[i], SIO_DEPTH) != 0) {
+            printf("%-10s unavailable\n", backends[i]->name);
+            continue;
+        }
+        if (bench_small(&b, &io) != 0 || bench_big(&b, &io) != 0) {
+            perror(backends[i]->name);
+            sio_close(&io);
+            return 1;
+        }
+        sio_close(&io);
+    }
+    free(b.paths);
+    free(b.data);
+    free(b.ops);
+    free(b.fds);
+    return 0;
+}
@@ -0,0 +1,578 @@
+/* load_bench.c - closed-loop load generator: N connections running a LIST/UPLOAD/DOWNLOAD/DELETE mix */
+#define _GNU_SOURCE /* mkdtemp, realpath, nftw, MSG_MORE */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <ftw.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "../metrics.h"
+
+#define MAX_SIZES 8
+#define RD_BUF (256 * 1024)
+#define STAMP_EVERY 4096       /* well under the chunk store's smallest chunk */
+#define USER_BUDGET (8 * 1024 * 1024) /* stays under the server's 10 MB quota */
+#define SPAWN_WAIT_MS 5000
+
+typedef enum { OP_LIST, OP_UPLOAD, OP_DOWNLOAD, OP_DELETE, OPS } op_t;
+static const char *op_names[OPS] = { "LIST", "UPLOAD", "DOWNLOAD", "DELETE" };
+
+typedef struct {
+    size_t size;
+    unsigned weight;
+} size_class_t;
+
+static struct {
+    const char *host;
+    int port;
+    int conns, users, files;
+    double secs;
+    unsigned mix[OPS];
+    size_class_t sizes[MAX_SIZES];
+    int nsizes;
+    size_t budget;         // bytes one user may hold
+    const char *spawn;     // server binary to start in a scratch directory
+    char **server_args;
+} cfg = { "127.0.0.1", 9000, 8, 0, 32, 10.0, { 10, 25, 55, 10 },
+          { { 4 * 1024, 60 }, { 64 * 1024, 30 }, { 1024 * 1024, 10 } }, 3, USER_BUDGET, NULL, NULL };
+
+/* Buffered reader for reply lines and the bodies that follow them */
+typedef struct {
+    int fd;
+    size_t pos, len;
+    char buf[RD_BUF];
+} reader_t;
+
+/* One connection and the files it owns; only its thread touches it */
+typedef struct {
+    int id;
+    pthread_t thread;
+    int fd;
+    int broken;
+    int reported;          // a failed op has been printed
+    uint64_t rng, nonce, stamp;
+    unsigned long long seq;
+    size_t budget, used, nstored;
+    size_t *size;          // per file slot
+    unsigned char *stored;
+    unsigned char *data;   // upload source, as big as the largest size class
+    uint64_t bytes[OPS];   // payload moved by successful ops
+    uint64_t end;          // when its last op finished
+    reader_t rd;
+} bench_conn_t;
+
+static pthread_barrier_t start_line;
+static atomic_int stop;
+
+static uint64_t rnd(bench_conn_t *c) {
+    uint64_t x = c->rng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return c->rng = x;
+}
+
+static int send_all(int fd, const void *buf, size_t len, int more) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int rd_fill(reader_t *r) {
+    if (r->pos == r->len) r->pos = r->len = 0;
+    ssize_t n;
+    do {
+        n = recv(r->fd, r->buf + r->len, sizeof(r->buf) - r->len, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return -1;
+    r->len += (size_t)n;
+    return 0;
+}
+
+/* Next reply line without its newline */
+static int rd_line(reader_t *r, char *line, size_t cap) {
+    for (;;) {
+        char *nl = memchr(r->buf + r->pos, '\n', r->len - r->pos);
+        if (nl) {
+            size_t n = (size_t)(nl - (r->buf + r->pos));
+            if (n >= cap) n = cap - 1;
+            memcpy(line, r->buf + r->pos, n);
+            line[n] = '\0';
+            r->pos = (size_t)(nl - r->buf) + 1;
+            return 0;
+        }
+        if (r->pos > 0) {
+            memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+            r->len -= r->pos;
+            r->pos = 0;
+        }
+        if (r->len == sizeof(r->buf) || rd_fill(r) != 0) return -1;
+    }
+}
+
+/* Read and drop n body bytes */
+static int rd_skip(reader_t *r, size_t n) {
+    while (n > 0) {
+        if (r->pos == r->len && rd_fill(r) != 0) return -1;
+        size_t take = r->len - r->pos < n ? r->len - r->pos : n;
+        r->pos += take;
+        n -= take;
+    }
+    return 0;
+}
+
+/*
+ * Send "#<tag> <cmd>" and an optional body, then read the reply header.
+ * The reply is returned without its tag. -1 if the connection broke.
+ */
+static int request(bench_conn_t *c, const char *cmd, const void *body, size_t len, char *reply, size_t cap) {
+    char line[600];
+    int h = snprintf(line, sizeof(line), "#%llu %s\n", ++c->seq, cmd);
+    if (send_all(c->fd, line, (size_t)h, len > 0) != 0 || (len && send_all(c->fd, body, len, 0) != 0)) return -1;
+    if (rd_line(&c->rd, line, sizeof(line)) != 0) return -1;
+    char tag[32];
+    int tl = snprintf(tag, sizeof(tag), "#%llu ", c->seq);
+    if (strncmp(line, tag, (size_t)tl) != 0) return -1;
+    snprintf(reply, cap, "%s", line + tl);
+    return 0;
+}
+
+static int bench_connect(bench_conn_t *c, int quiet) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)cfg.port);
+    if (inet_pton(AF_INET, cfg.host, &addr.sin_addr) != 1) return -1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        if (!quiet) perror("connect");
+        close(fd);
+        return -1;
+    }
+    c->fd = c->rd.fd = fd;
+    c->rd.pos = c->rd.len = 0;
+    return 0;
+}
+
+/* Two banner lines, then the answer to HELLO */
+static int bench_login(bench_conn_t *c) {
+    char line[256], hello[64];
+    int h = snprintf(hello, sizeof(hello), "HELLO bench%d\n", c->id % cfg.users);
+    if (rd_line(&c->rd, line, sizeof(line)) != 0 || rd_line(&c->rd, line, sizeof(line)) != 0 ||
+        send_all(c->fd, hello, (size_t)h, 0) != 0 || rd_line(&c->rd, line, sizeof(line)) != 0) return -1;
+    return strncmp(line, "AUTH OK", 7) == 0 ? 0 : -1;
+}
+
+static size_t pick_size(bench_conn_t *c) {
+    unsigned total = 0;
+    for (int i = 0; i < cfg.nsizes; ++i) total += cfg.sizes[i].weight;
+    unsigned r = (unsigned)(rnd(c) % total);
+    for (int i = 0; i < cfg.nsizes; ++i) {
+        if (r < cfg.sizes[i].weight) return cfg.sizes[i].size;
+        r -= cfg.sizes[i].weight;
+    }
+    return cfg.sizes[0].size;
+}
+
+static int pick_op(bench_conn_t *c) {
+    unsigned total = 0;
+    for (int i = 0; i < OPS; ++i) total += cfg.mix[i];
+    unsigned r = (unsigned)(rnd(c) % total);
+    for (int i = 0; i < OPS; ++i) {
+        if (r < cfg.mix[i]) return i;
+        r -= cfg.mix[i];
+    }
+    return OP_LIST;
+}
+
+/* A file slot this connection has uploaded, or -1 */
+static int pick_stored(bench_conn_t *c) {
+    if (c->nstored == 0) return -1;
+    size_t i = (size_t)(rnd(c) % (uint64_t)cfg.files);
+    while (!c->stored[i]) i = (i + 1) % (size_t)cfg.files;
+    return (int)i;
+}
+
+/* Make this upload's content unique so the chunk store cannot dedup it away */
+static void stamp(bench_conn_t *c, size_t size) {
+    uint64_t mark[2] = { c->nonce, ++c->stamp };
+    for (size_t off = 0; off + sizeof(mark) <= size; off += STAMP_EVERY) {
+        memcpy(c->data + off, mark, sizeof(mark));
+    }
+}
+
+static void set_stored(bench_conn_t *c, int f, int stored, size_t size) {
+    if (c->stored[f]) {
+        c->used -= c->size[f];
+        c->nstored--;
+    }
+    c->stored[f] = (unsigned char)stored;
+    c->size[f] = stored ? size : 0;
+    if (stored) {
+        c->used += size;
+        c->nstored++;
+    }
+}
+
+/*
+ * Run one operation, adjusted to what this connection holds: downloads and
+ * deletes need a stored file, and an upload that would go over the user's
+ * budget becomes a delete. Returns -1 if the connection broke.
+ */
+static int do_op(bench_conn_t *c, int op, int measure) {
+    char cmd[300], reply[300];
+    int f = -1, ok = 0;
+    size_t size = 0, n = 0;
+    if ((op == OP_DOWNLOAD || op == OP_DELETE) && (f = pick_stored(c)) < 0) op = OP_UPLOAD;
+    if (op == OP_UPLOAD) {
+        f = (int)(rnd(c) % (uint64_t)cfg.files);
+        size = pick_size(c);
+        if (c->used - (c->stored[f] ? c->size[f] : 0) + size > c->budget) {
+            op = OP_DELETE;
+            f = pick_stored(c);
+        }
+    }
+
+    uint64_t t0 = mx_now();
+    switch (op) {
+    case OP_LIST:
+        if (request(c, "LIST", NULL, 0, reply, sizeof(reply)) != 0) return -1;
+        if (sscanf(reply, "LIST OK %zu", &n) == 1) {
+            if (rd_skip(&c->rd, n) != 0) return -1;
+            ok = 1;
+        }
+        break;
+    case OP_UPLOAD:
+        stamp(c, size);
+        snprintf(cmd, sizeof(cmd), "UPLOAD c%d_f%d %zu", c->id, f, size);
+        if (request(c, cmd, c->data, size, reply, sizeof(reply)) != 0) return -1;
+        ok = strcmp(reply, "UPLOAD OK") == 0;
+        if (ok) set_stored(c, f, 1, size);
+        n = size;
+        break;
+    case OP_DOWNLOAD:
+        snprintf(cmd, sizeof(cmd), "DOWNLOAD c%d_f%d", c->id, f);
+        if (request(c, cmd, NULL, 0, reply, sizeof(reply)) != 0) return -1;
+        if (sscanf(reply, "DOWNLOAD %zu", &n) == 1) {
+            if (rd_skip(&c->rd, n) != 0) return -1;
+            ok = n == c->size[f];
+        }
+        break;
+    default:
+        snprintf(cmd, sizeof(cmd), "DELETE c%d_f%d", c->id, f);
+        if (request(c, cmd, NULL, 0, reply, sizeof(reply)) != 0) return -1;
+        ok = strcmp(reply, "DELETE OK") == 0;
+        if (ok) set_stored(c, f, 0, 0);
+        break;
+    }
+    c->end = mx_now();
+    if (measure) {
+        mx_task(op, ok, 0, c->end - t0);
+        if (ok) c->bytes[op] += n;
+        else if (!c->reported++) fprintf(stderr, "conn %d: %s -> %s\n", c->id, op_names[op], reply);
+    }
+    return 0;
+}
+
+/* Clear out slots left by an earlier run, then upload half of them so downloads have targets */
+static int preload(bench_conn_t *c) {
+    char cmd[300], reply[300];
+    for (int f = 0; f < cfg.files; ++f) {
+        snprintf(cmd, sizeof(cmd), "DELETE c%d_f%d", c->id, f);
+        if (request(c, cmd, NULL, 0, reply, sizeof(reply)) != 0) return -1;
+    }
+    for (int f = 0; f < cfg.files / 2; ++f) {
+        size_t size = pick_size(c);
+        if (c->used + size > c->budget) break;
+        stamp(c, size);
+        snprintf(cmd, sizeof(cmd), "UPLOAD c%d_f%d %zu", c->id, f, size);
+        if (request(c, cmd, c->data, size, reply, sizeof(reply)) != 0) return -1;
+        if (strcmp(reply, "UPLOAD OK") != 0) {
+            fprintf(stderr, "conn %d: preload UPLOAD -> %s\n", c->id, reply);
+            return -1;
+        }
+        set_stored(c, f, 1, size);
+    }
+    return 0;
+}
+
+static void *conn_fn(void *arg) {
+    bench_conn_t *c = arg;
+    if (bench_connect(c, 0) != 0 || bench_login(c) != 0 || preload(c) != 0) c->broken = 1;
+    pthread_barrier_wait(&start_line);
+    while (!c->broken && !atomic_load_explicit(&stop, memory_order_relaxed)) {
+        if (do_op(c, pick_op(c), 1) != 0) c->broken = 1;
+    }
+    if (c->fd >= 0) close(c->fd);
+    return NULL;
+}
+
+static int parse_size(const char *s, size_t *out) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end == s) return -1;
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    }
+    if (*end != '\0' && *end != ':') return -1;
+    *out = (size_t)v;
+    return 0;
+}
+
+/* "list=10,upload=25,download=55,delete=10"; ops left out get weight 0 */
+static int parse_mix(char *s) {
+    unsigned mix[OPS] = { 0 }, total = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(s, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        int op = -1;
+        for (int i = 0; i < OPS; ++i) {
+            if (strcasecmp(tok, op_names[i]) == 0) op = i;
+        }
+        if (op < 0) return -1;
+        mix[op] = (unsigned)atoi(eq + 1);
+        total += mix[op];
+    }
+    if (total == 0) return -1;
+    memcpy(cfg.mix, mix, sizeof(mix));
+    return 0;
+}
+
+/* "4k:60,64k:30,1m:10": size and weight per class */
+static int parse_sizes(char *s) {
+    int n = 0;
+    char *save = NULL;
+    for (char *tok = strtok_r(s, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *colon = strchr(tok, ':');
+        if (n == MAX_SIZES || parse_size(tok, &cfg.sizes[n].size) != 0) return -1;
+        cfg.sizes[n].weight = colon ? (unsigned)atoi(colon + 1) : 1;
+        if (cfg.sizes[n].weight == 0) return -1;
+        n++;
+    }
+    if (n == 0) return -1;
+    cfg.nsizes = n;
+    return 0;
+}
+
+static int rm_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)st;
+    (void)type;
+    (void)ftw;
+    return remove(path);
+}
+
+/* Start the server in a scratch directory and wait until it accepts */
+static pid_t spawn_server(char *dir) {
+    char bin[4096], port[16];
+    if (!realpath(cfg.spawn, bin)) {
+        perror(cfg.spawn);
+        return -1;
+    }
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return -1;
+    }
+    snprintf(port, sizeof(port), "%d", cfg.port);
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        size_t n = 0;
+        while (cfg.server_args && cfg.server_args[n]) n++;
+        char **argv = calloc(n + 3, sizeof(char *));
+        int devnull = open("/dev/null", O_WRONLY);
+        if (!argv || chdir(dir) != 0) _exit(127);
+        if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        argv[0] = bin;
+        argv[1] = port;
+        for (size_t i = 0; i < n; ++i) argv[2 + i] = cfg.server_args[i];
+        execv(bin, argv);
+        _exit(127);
+    }
+    for (int waited = 0; waited < SPAWN_WAIT_MS; waited += 50) {
+        bench_conn_t probe;
+        if (bench_connect(&probe, 1) == 0) {
+            close(probe.fd);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid) break;
+        struct timespec ts = { 0, 50 * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    fprintf(stderr, "%s did not start on port %d\n", cfg.spawn, cfg.port);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    nftw(dir, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return -1;
+}
+
+/* Print the table; returns the number of failed ops */
+static uint64_t report(bench_conn_t *conns, double secs) {
+    mx_snapshot_t *s = malloc(sizeof(mx_snapshot_t));
+    if (!s) return 0;
+    mx_snapshot(s);
+    printf("%-9s %9s %10s %9s %9s %9s %9s %9s %7s\n", "op", "ops", "ops/s", "MB/s", "p50_us", "p99_us",
+           "p999_us", "max_us", "errors");
+    uint64_t all_ops = 0, all_bytes = 0, all_err = 0;
+    for (int op = 0; op < OPS; ++op) {
+        uint64_t bytes = 0;
+        for (int i = 0; i < cfg.conns; ++i) bytes += conns[i].bytes[op];
+        uint64_t ok = s->ops[op].ok, err = s->ops[op].failed;
+        const mx_hist_snap_t *h = &s->ops[op].service;
+        if (ok + err == 0) continue;
+        printf("%-9s %9llu %10.0f %9.1f %9.1f %9.1f %9.1f %9.1f %7llu\n", op_names[op],
+               (unsigned long long)(ok + err), (ok + err) / secs, bytes / secs / (1024 * 1024),
+               mx_quantile(h, 0.5) / 1e3, mx_quantile(h, 0.99) / 1e3, mx_quantile(h, 0.999) / 1e3,
+               h->max / 1e3, (unsigned long long)err);
+        all_ops += ok + err;
+        all_bytes += bytes;
+        all_err += err;
+    }
+    printf("%-9s %9llu %10.0f %9.1f %9s %9s %9s %9s %7llu\n", "all", (unsigned long long)all_ops,
+           all_ops / secs, all_bytes / secs / (1024 * 1024), "", "", "", "", (unsigned long long)all_err);
+    free(s);
+    return all_err;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s [-H host] [-p port] [-c conns] [-u users] [-d secs] [-f files]\n"
+            "          [-m list=10,upload=25,download=55,delete=10] [-s 4k:60,64k:30,1m:10]\n"
+            "          [-q bytes per user] [-S ./server [-- server args]]\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:c:u:d:f:m:s:q:S:")) != -1) {
+        switch (opt) {
+        case 'H': cfg.host = optarg; break;
+        case 'p': cfg.port = atoi(optarg); break;
+        case 'c': cfg.conns = atoi(optarg); break;
+        case 'u': cfg.users = atoi(optarg); break;
+        case 'd': cfg.secs = atof(optarg); break;
+        case 'f': cfg.files = atoi(optarg); break;
+        case 'm': if (parse_mix(optarg) != 0) { usage(argv[0]); return 1; } break;
+        case 's': if (parse_sizes(optarg) != 0) { usage(argv[0]); return 1; } break;
+        case 'q': if (parse_size(optarg, &cfg.budget) != 0) { usage(argv[0]); return 1; } break;
+        case 'S': cfg.spawn = optarg; break;
+        default: usage(argv[0]); return 1;
+        }
+    }
+    cfg.server_args = argv + optind;
+    if (cfg.users <= 0 || cfg.users > cfg.conns) cfg.users = cfg.conns;
+    if (cfg.conns <= 0 || cfg.files <= 0 || cfg.secs <= 0 || cfg.port <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    /* connections that share a user share its budget */
+    size_t per_user = (size_t)((cfg.conns + cfg.users - 1) / cfg.users);
+    size_t budget = cfg.budget / per_user, biggest = 0;
+    for (int i = 0; i < cfg.nsizes; ++i) {
+        if (cfg.sizes[i].size > biggest) biggest = cfg.sizes[i].size;
+    }
+    if (biggest > budget) {
+        fprintf(stderr, "a %zu byte file does not fit in the %zu bytes each connection may store\n", biggest,
+                budget);
+        return 1;
+    }
+
+    char dir[] = "/tmp/load_bench.XXXXXX";
+    pid_t server = -1;
+    if (cfg.spawn && (server = spawn_server(dir)) < 0) return 1;
+
+    bench_conn_t *conns = calloc((size_t)cfg.conns, sizeof(bench_conn_t));
+    if (!conns) return 1;
+    uint64_t seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    pthread_barrier_init(&start_line, NULL, (unsigned)cfg.conns + 1);
+    int started = 0, rc = 0;
+    for (int i = 0; i < cfg.conns; ++i) {
+        bench_conn_t *c = &conns[i];
+        c->id = i;
+        c->fd = -1;
+        c->budget = budget;
+        c->rng = (seed + (uint64_t)i * 0x9e3779b97f4a7c15ull) | 1;
+        c->nonce = rnd(c);
+        c->size = calloc((size_t)cfg.files, sizeof(size_t));
+        c->stored = calloc((size_t)cfg.files, 1);
+        c->data = malloc(biggest ? biggest : 1);
+        if (!c->size || !c->stored || !c->data) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        for (size_t j = 0; j < biggest; ++j) c->data[j] = (unsigned char)rnd(c);
+    }
+    for (; started < cfg.conns; ++started) {
+        if (pthread_create(&conns[started].thread, NULL, conn_fn, &conns[started]) != 0) break;
+    }
+    if (started < cfg.conns) {
+        /* threads already waiting on the barrier would hang; there is no recovering from this */
+        perror("pthread_create");
+        return 1;
+    }
+
+    printf("%d connections, %d users, %d files each, %.1f s; mix", cfg.conns, cfg.users, cfg.files, cfg.secs);
+    for (int op = 0; op < OPS; ++op) printf(" %s=%u", op_names[op], cfg.mix[op]);
+    printf("; sizes");
+    for (int i = 0; i < cfg.nsizes; ++i) printf(" %zu:%u", cfg.sizes[i].size, cfg.sizes[i].weight);
+    printf("\n");
+    fflush(stdout);
+
+    pthread_barrier_wait(&start_line);
+    uint64_t t0 = mx_now();
+    struct timespec ts = { (time_t)cfg.secs, (long)((cfg.secs - (double)(time_t)cfg.secs) * 1e9) };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+    atomic_store(&stop, 1);
+    uint64_t t1 = t0;
+    int broken = 0;
+    for (int i = 0; i < cfg.conns; ++i) {
+        pthread_join(conns[i].thread, NULL);
+        if (conns[i].end > t1) t1 = conns[i].end;
+        broken += conns[i].broken;
+    }
+    if (report(conns, (double)(t1 - t0) / 1e9) > 0) rc = 1;
+    if (broken) {
+        fprintf(stderr, "%d of %d connections failed\n", broken, cfg.conns);
+        rc = 1;
+    }
+
+    if (server > 0) {
+        kill(server, SIGINT);
+        waitpid(server, NULL, 0);
+        nftw(dir, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    for (int i = 0; i < cfg.conns; ++i) {
+        free(conns[i].size);
+        free(conns[i].stored);
+        free(conns[i].data);
+    }
+    free(conns);
+    pthread_barrier_destroy(&start_line);
+    mx_destroy();
+    return rc;
+}
@@ -0,0 +1,188 @@
+/* lz_bench.c - throughput and ratio of the wire codec on a mixed corpus */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lz.h"
+
+#define CLASS_BYTES (8 * 1024 * 1024)
+#define ROUNDS 3
+
+typedef struct {
+    const char *name;
+    unsigned char *data;
+    size_t len;
+} corpus_t;
+
+static uint64_t rng = 88172645463325252ull;
+
+static uint64_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+static const char *words[] = {
+    "the", "file", "server", "upload", "chunk", "client", "of", "and", "to", "a",
+    "storage", "request", "is", "in", "quota", "user", "with", "download", "for", "data",
+    "session", "reply", "worker", "queue", "that", "on", "each", "manifest", "block", "compress"
+};
+
+/* Prose-like text from a small vocabulary */
+static void gen_text(corpus_t *c) {
+    size_t n = 0;
+    while (n + 16 < c->len) {
+        const char *w = words[next_rand() % (sizeof(words) / sizeof(words[0]))];
+        size_t l = strlen(w);
+        memcpy(c->data + n, w, l);
+        n += l;
+        uint64_t r = next_rand() % 16;
+        c->data[n++] = r == 0 ? '\n' : r == 1 ? ',' : ' ';
+    }
+    memset(c->data + n, ' ', c->len - n);
+}
+
+/* Server log lines: fixed layout, varying numbers */
+static void gen_logs(corpus_t *c) {
+    size_t n = 0;
+    char line[160];
+    while (n < c->len) {
+        uint64_t r = next_rand();
+        int l = snprintf(line, sizeof(line),
+                         "2026-10-16T12:%02u:%02u.%03uZ %s worker-%u user=u%03u op=%s bytes=%u latency_us=%u\n",
+                         (unsigned)(r % 60), (unsigned)(r >> 8) % 60, (unsigned)(r >> 16) % 1000,
+                         r & 0x100000 ? "INFO" : "WARN", (unsigned)(r >> 24) % 4,
+                         (unsigned)(r >> 28) % 200, words[(r >> 40) % 30],
+                         (unsigned)(r >> 32) % 100000, (unsigned)(r >> 48) % 5000);
+        size_t take = (size_t)l < c->len - n ? (size_t)l : c->len - n;
+        memcpy(c->data + n, line, take);
+        n += take;
+    }
+}
+
+/* Binary records: small integers, flags and padding, like database pages */
+static void gen_records(corpus_t *c) {
+    uint32_t id = 1000;
+    for (size_t n = 0; n + 32 <= c->len; n += 32) {
+        uint64_t r = next_rand();
+        uint32_t rec[8] = { id++, (uint32_t)(r % 100), 0, 1, (uint32_t)(r >> 32) & 0xff, 0, 0, 0xffffffffu };
+        memcpy(c->data + n, rec, sizeof(rec));
+    }
+}
+
+/* Already-compressed media, archives: nothing to gain */
+static void gen_random(corpus_t *c) {
+    for (size_t n = 0; n < c->len; n += 8) {
+        uint64_t r = next_rand();
+        memcpy(c->data + n, &r, c->len - n < 8 ? c->len - n : 8);
+    }
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int load_file(corpus_t *c, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    rewind(f);
+    c->name = path;
+    c->len = len > 0 ? (size_t)len : 0;
+    c->data = malloc(c->len ? c->len : 1);
+    int ok = c->data && fread(c->data, 1, c->len, f) == c->len;
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+/* Frame the corpus block by block as a session would, then decode it back */
+static int run(const corpus_t *c, unsigned char *wire, unsigned char *out) {
+    double best_c = 1e9, best_d = 1e9;
+    size_t wire_len = 0, frames = 0, stored = 0;
+    for (int round = 0; round < ROUNDS; ++round) {
+        double t0 = now_sec();
+        wire_len = frames = stored = 0;
+        for (size_t off = 0; off < c->len; off += LZ_BLOCK_MAX) {
+            size_t n = c->len - off < LZ_BLOCK_MAX ? c->len - off : LZ_BLOCK_MAX;
+            size_t f = lz_frame(c->data + off, n, wire + wire_len);
+            stored += f - LZ_FRAME_HDR == n;
+            frames++;
+            wire_len += f;
+        }
+        double t1 = now_sec();
+        size_t pos = 0, raw_pos = 0;
+        while (pos < wire_len) {
+            size_t raw, w;
+            if (lz_frame_parse(wire + pos, &raw, &w) != 0 ||
+                lz_unframe(wire + pos + LZ_FRAME_HDR, w, out + raw_pos, raw) != 0) return -1;
+            pos += LZ_FRAME_HDR + w;
+            raw_pos += raw;
+        }
+        double t2 = now_sec();
+        if (raw_pos != c->len || memcmp(out, c->data, c->len) != 0) return -1;
+        if (t1 - t0 < best_c) best_c = t1 - t0;
+        if (t2 - t1 < best_d) best_d = t2 - t1;
+    }
+    printf("%-12s %10zu %10zu %7.2fx %8.1f%% %10.1f %10.1f\n", c->name, c->len, wire_len,
+           wire_len ? (double)c->len / wire_len : 0.0, frames ? 100.0 * stored / frames : 0.0,
+           c->len / best_c / 1e6, c->len / best_d / 1e6);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? argc - 1 : 4;
+    corpus_t corpus[n + 1];
+    size_t total = 0;
+    if (argc > 1) {
+        for (int i = 0; i < n; ++i) {
+            if (load_file(&corpus[i], argv[i + 1]) != 0) {
+                perror(argv[i + 1]);
+                return 1;
+            }
+        }
+    } else {
+        void (*gen[])(corpus_t *) = { gen_text, gen_logs, gen_records, gen_random };
+        const char *names[] = { "text", "logs", "records", "random" };
+        for (int i = 0; i < n; ++i) {
+            corpus[i].name = names[i];
+            corpus[i].len = CLASS_BYTES;
+            corpus[i].data = malloc(CLASS_BYTES);
+            if (!corpus[i].data) return 1;
+            gen[i](&corpus[i]);
+        }
+    }
+    for (int i = 0; i < n; ++i) total += corpus[i].len;
+
+    /* everything back to back, as a session moving all of it would see */
+    corpus_t *mixed = &corpus[n];
+    mixed->name = "mixed";
+    mixed->len = total;
+    mixed->data = malloc(total ? total : 1);
+    size_t frames_max = total / LZ_BLOCK_MAX + 1;
+    unsigned char *wire = malloc(total + frames_max * LZ_FRAME_HDR);
+    unsigned char *out = malloc(total ? total : 1);
+    if (!mixed->data || !wire || !out) return 1;
+    for (size_t i = 0, off = 0; i < (size_t)n; off += corpus[i].len, ++i) {
+        memcpy(mixed->data + off, corpus[i].data, corpus[i].len);
+    }
+
+    printf("%-12s %10s %10s %8s %9s %10s %10s\n", "corpus", "bytes", "wire", "ratio",
+           "stored", "comp MB/s", "dec MB/s");
+    for (int i = 0; i <= n; ++i) {
+        if (run(&corpus[i], wire, out) != 0) {
+            fprintf(stderr, "%s: round trip mismatch\n", corpus[i].name);
+            return 1;
+        }
+    }
+    for (int i = 0; i <= n; ++i) free(corpus[i].data);
+    free(wire);
+    free(out);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/* queue_bench.c - push/pop throughput of the lock-free ring vs the old mutex ring */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "../mpmc.h"
+
+#define QUEUE_CAP 128
+#define DEFAULT_OPS 2000000
+
+/* The previous task_queue_t design: one mutex and two condvars around a ring */
+typedef struct {
+    void **items;
+    int capacity, front, rear, size;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+} locked_queue_t;
+
+static void lq_init(locked_queue_t *q, int cap) {
+    q->items = calloc(cap, sizeof(void *));
+    q->capacity = cap;
+    q->front = q->rear = q->size = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void lq_destroy(locked_queue_t *q) {
+    free(q->items);
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+static void lq_push(locked_queue_t *q, void *v) {
+    pthread_mutex_lock(&q->lock);
+    while (q->size == q->capacity) pthread_cond_wait(&q->not_full, &q->lock);
+    q->items[q->rear] = v;
+    q->rear = (q->rear + 1) % q->capacity;
+    q->size++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static void *lq_pop(locked_queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->size == 0) pthread_cond_wait(&q->not_empty, &q->lock);
+    void *v = q->items[q->front];
+    q->front = (q->front + 1) % q->capacity;
+    q->size--;
+    pthread_cond_signal(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+    return v;
+}
+
+typedef struct {
+    int lockfree;
+    mpmc_t ring;
+    locked_queue_t locked;
+} bench_queue_t;
+
+typedef struct {
+    bench_queue_t *q;
+    long ops;
+    int producer;
+    int single;   /* one thread doing push+pop pairs */
+} bench_arg_t;
+
+static void bq_push(bench_queue_t *q, void *v) {
+    if (q->lockfree) mpmc_push(&q->ring, v);
+    else lq_push(&q->locked, v);
+}
+
+static void *bq_pop(bench_queue_t *q) {
+    void *v = NULL;
+    if (q->lockfree) mpmc_pop(&q->ring, &v);
+    else v = lq_pop(&q->locked);
+    return v;
+}
+
+static void *bench_thread(void *arg) {
+    bench_arg_t *a = arg;
+    for (long i = 0; i < a->ops; ++i) {
+        if (a->single) {
+            bq_push(a->q, (void *)(intptr_t)(i + 1));
+            bq_pop(a->q);
+        } else if (a->producer) {
+            bq_push(a->q, (void *)(intptr_t)(i + 1));
+        } else {
+            bq_pop(a->q);
+        }
+    }
+    return NULL;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns million ops (push+pop pairs) per second */
+static double run(int lockfree, int threads, long ops) {
+    bench_queue_t q;
+    q.lockfree = lockfree;
+    if (lockfree) mpmc_init(&q.ring, QUEUE_CAP);
+    else lq_init(&q.locked, QUEUE_CAP);
+
+    pthread_t tids[threads];
+    bench_arg_t args[threads];
+    int pairs = threads / 2;
+    double t0 = now_sec();
+    for (int i = 0; i < threads; ++i) {
+        args[i].q = &q;
+        args[i].single = threads == 1;
+        args[i].producer = i < pairs;
+        args[i].ops = threads == 1 ? ops : ops / pairs;
+        pthread_create(&tids[i], NULL, bench_thread, &args[i]);
+    }
+    for (int i = 0; i < threads; ++i) pthread_join(tids[i], NULL);
+    double dt = now_sec() - t0;
+
+    if (lockfree) mpmc_destroy(&q.ring);
+    else lq_destroy(&q.locked);
+    long done = threads == 1 ? ops : (ops / pairs) * pairs;
+    return done / dt / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+    long ops = argc >= 2 ? atol(argv[1]) : DEFAULT_OPS;
+    const int counts[] = { 1, 4, 16, 64 };
+    printf("%-8s %14s %14s %8s\n", "threads", "mutex Mops/s", "mpmc Mops/s", "speedup");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); ++i) {
+        double locked = run(0, counts[i], ops);
+        double lockfree = run(1, counts[i], ops);
+        printf("%-8d %14.2f %14.2f %7.2fx\n", counts[i], locked, lockfree, lockfree / locked);
+    }
+    return 0;
+}
@@ -0,0 +1,681 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chunkstore.h"
+#include "sio.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define CS_MAGIC "DBXCS1 "
+#define CS_MAGIC_LEN 7
+#define CS_LINE_MAX (2 * SHA256_LEN + 12)    /* "<hex> <len>\n" */
+#define CS_HEAD_MAX (CS_MAGIC_LEN + 3 * 21 + 2 * SHA256_LEN + 2) /* "<size> <n> <sha256> <version>\n" */
+#define CS_READ_BUF (4 * CS_MAX_CHUNK)
+#define CS_BATCH (CS_READ_BUF / CS_MIN_CHUNK + 1) /* most chunks one read window can hold */
+#define CS_CUT_MASK 0xffff000000000000ull   /* 16 bits -> ~64 KB past the minimum */
+
+static _Atomic unsigned long cs_tmp_seq; /* names of blobs being written */
+
+/* Gear hash table; fixed so cut points (and thus dedup) are stable across restarts */
+static uint64_t cs_gear[256];
+
+static void cs_gear_init(void) {
+    uint64_t x = 0x9e3779b97f4a7c15ull;
+    for (int i = 0; i < 256; ++i) {
+        /* splitmix64 */
+        uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        cs_gear[i] = z ^ (z >> 31);
+    }
+}
+
+static void cs_hex(const unsigned char *hash, char out[2 * SHA256_LEN + 1]) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < SHA256_LEN; ++i) {
+        out[2 * i] = digits[hash[i] >> 4];
+        out[2 * i + 1] = digits[hash[i] & 15];
+    }
+    out[2 * SHA256_LEN] = '\0';
+}
+
+static int cs_unhex(const char *s, unsigned char *hash) {
+    for (int i = 0; i < 2 * SHA256_LEN; ++i) {
+        int v;
+        if (s[i] >= '0' && s[i] <= '9') v = s[i] - '0';
+        else if (s[i] >= 'a' && s[i] <= 'f') v = s[i] - 'a' + 10;
+        else return -1;
+        if (i & 1) hash[i / 2] |= (unsigned char)v;
+        else hash[i / 2] = (unsigned char)(v << 4);
+    }
+    return 0;
+}
+
+static void cs_blob_path(const chunk_store_t *s, const unsigned char *hash, char *out, size_t len) {
+    char hex[2 * SHA256_LEN + 1];
+    cs_hex(hash, hex);
+    snprintf(out, len, "%s/%.2s/%s", s->dir, hex, hex);
+}
+
+static cs_bucket_t *cs_bucket(chunk_store_t *s, const unsigned char *hash) {
+    uint32_t h = (uint32_t)hash[0] << 24 | (uint32_t)hash[1] << 16 | (uint32_t)hash[2] << 8 | hash[3];
+    return &s->buckets[h % CS_BUCKETS];
+}
+
+static cs_entry_t *cs_find(cs_bucket_t *b, const unsigned char *hash) {
+    for (cs_entry_t *e = b->head; e; e = e->next) {
+        if (memcmp(e->hash, hash, SHA256_LEN) == 0) return e;
+    }
+    return NULL;
+}
+
+static cs_entry_t *cs_insert(cs_bucket_t *b, const unsigned char *hash) {
+    cs_entry_t *e = calloc(1, sizeof(cs_entry_t));
+    if (!e) return NULL;
+    memcpy(e->hash, hash, SHA256_LEN);
+    e->next = b->head;
+    b->head = e;
+    return e;
+}
+
+static int cs_write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * Add a reference to each of n chunks, writing blobs for the ones not
+ * stored yet. Their temp files are opened, written and closed as three
+ * batches outside any lock, then renamed into place under the bucket lock
+ * so racing writers of the same chunk agree. All or nothing.
+ */
+static int cs_add_batch(chunk_store_t *s, const cs_ref_t *refs, const unsigned char *const *data,
+                        size_t n) {
+    size_t miss[CS_BATCH], m = 0;
+    int added[CS_BATCH];
+    for (size_t i = 0; i < n; ++i) {
+        cs_bucket_t *b = cs_bucket(s, refs[i].hash);
+        pthread_mutex_lock(&b->lock);
+        cs_entry_t *e = cs_find(b, refs[i].hash);
+        if (e) e->refs++;
+        pthread_mutex_unlock(&b->lock);
+        added[i] = e != NULL;
+        if (!e) miss[m++] = i;
+    }
+    if (m == 0) return 0;
+
+    char tmp[CS_BATCH][512];
+    int fds[CS_BATCH];
+    sio_op_t ops[CS_BATCH];
+    sio_t *io = sio_thread();
+    unsigned long id = atomic_fetch_add(&cs_tmp_seq, m);
+    for (size_t k = 0; k < m; ++k) {
+        snprintf(tmp[k], sizeof(tmp[k]), "%s/tmp/b%lu", s->dir, id + k);
+        ops[k] = (sio_op_t){ .op = SIO_OPEN, .path = tmp[k], .flags = O_WRONLY | O_CREAT | O_EXCL, .mode = 0600 };
+    }
+    int r = sio_run(io, ops, m);
+    for (size_t k = 0; k < m; ++k) {
+        fds[k] = r == 0 ? (int)ops[k].res : -1;
+        if (fds[k] < 0) r = -1;
+    }
+    if (r == 0) {
+        for (size_t k = 0; k < m; ++k) {
+            const cs_ref_t *ref = &refs[miss[k]];
+            ops[k] = (sio_op_t){ .op = SIO_WRITE, .fd = fds[k], .buf = (void *)data[miss[k]], .len = ref->len };
+        }
+        r = sio_run(io, ops, m);
+        for (size_t k = 0; r == 0 && k < m; ++k) {
+            if (ops[k].res != (long)refs[miss[k]].len) r = -1;
+        }
+    }
+    size_t nfds = 0;
+    for (size_t k = 0; k < m; ++k) {
+        if (fds[k] >= 0) ops[nfds++] = (sio_op_t){ .op = SIO_CLOSE, .fd = fds[k] };
+    }
+    sio_run(io, ops, nfds);
+
+    for (size_t k = 0; k < m; ++k) {
+        if (r != 0) {
+            if (fds[k] >= 0) unlink(tmp[k]);
+            continue;
+        }
+        const cs_ref_t *ref = &refs[miss[k]];
+        char path[512];
+        cs_blob_path(s, ref->hash, path, sizeof(path));
+        cs_bucket_t *b = cs_bucket(s, ref->hash);
+        pthread_mutex_lock(&b->lock);
+        cs_entry_t *e = cs_find(b, ref->hash);
+        if (e) {
+            e->refs++;
+            unlink(tmp[k]);
+        } else if (rename(tmp[k], path) != 0 || !(e = cs_insert(b, ref->hash))) {
+            unlink(tmp[k]);
+            r = -1;
+        } else {
+            e->refs = 1;
+        }
+        pthread_mutex_unlock(&b->lock);
+        added[miss[k]] = e != NULL;
+    }
+    if (r != 0) {
+        for (size_t i = 0; i < n; ++i) {
+            if (added[i]) cs_unpin(s, &refs[i], 1);
+        }
+    }
+    return r;
+}
+
+int cs_pin(chunk_store_t *s, const cs_ref_t *refs, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        cs_bucket_t *b = cs_bucket(s, refs[i].hash);
+        pthread_mutex_lock(&b->lock);
+        cs_entry_t *e = cs_find(b, refs[i].hash);
+        if (e) e->refs++;
+        pthread_mutex_unlock(&b->lock);
+        if (!e) {
+            cs_unpin(s, refs, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void cs_unpin(chunk_store_t *s, const cs_ref_t *refs, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        cs_bucket_t *b = cs_bucket(s, refs[i].hash);
+        pthread_mutex_lock(&b->lock);
+        cs_entry_t **pp = &b->head;
+        while (*pp && memcmp((*pp)->hash, refs[i].hash, SHA256_LEN) != 0) pp = &(*pp)->next;
+        cs_entry_t *e = *pp;
+        if (e && --e->refs == 0) {
+            /* unlink under the lock so a concurrent cs_add cannot lose its rename */
+            char path[512];
+            cs_blob_path(s, e->hash, path, sizeof(path));
+            unlink(path);
+            *pp = e->next;
+            free(e);
+        }
+        pthread_mutex_unlock(&b->lock);
+    }
+}
+
+/* Length of the next chunk at p; needs CS_MAX_CHUNK bytes unless at EOF */
+static size_t cs_cut(const unsigned char *p, size_t avail) {
+    if (avail <= CS_MIN_CHUNK) return avail;
+    size_t limit = avail < CS_MAX_CHUNK ? avail : CS_MAX_CHUNK;
+    uint64_t h = 0;
+    for (size_t i = CS_MIN_CHUNK; i < limit; ++i) {
+        h = (h << 1) + cs_gear[p[i]];
+        if (!(h & CS_CUT_MASK)) return i + 1;
+    }
+    return limit;
+}
+
+static int cs_push_ref(void **buf, size_t *cap, size_t n, const cs_ref_t *ref) {
+    if ((n + 1) * sizeof(cs_ref_t) > *cap) {
+        size_t nc = *cap ? *cap * 2 : 64 * sizeof(cs_ref_t);
+        void *nb = realloc(*buf, nc);
+        if (!nb) return -1;
+        *buf = nb;
+        *cap = nc;
+    }
+    ((cs_ref_t *)*buf)[n] = *ref;
+    return 0;
+}
+
+int cs_write_manifest(int fd, const cs_file_t *f, unsigned long version) {
+    size_t cap = CS_HEAD_MAX + f->n * CS_LINE_MAX;
+    char *out = malloc(cap);
+    if (!out) return -1;
+    char sum[2 * SHA256_LEN + 1];
+    cs_hex(f->digest, sum);
+    size_t len = (size_t)snprintf(out, cap, CS_MAGIC "%zu %zu %s %lu\n", f->size, f->n, sum, version);
+    const cs_ref_t *refs = f->refs;
+    for (size_t i = 0; i < f->n; ++i) {
+        char hex[2 * SHA256_LEN + 1];
+        cs_hex(refs[i].hash, hex);
+        len += (size_t)snprintf(out + len, cap - len, "%s %u\n", hex, (unsigned)refs[i].len);
+    }
+    int r = cs_write_all(fd, out, len);
+    free(out);
+    return r;
+}
+
+int cs_chunk_file(chunk_store_t *s, int src_fd, cs_file_t *f) {
+    memset(f, 0, sizeof(*f));
+    unsigned char *buf = malloc(CS_READ_BUF);
+    if (!buf) return -1;
+    sha256_t whole;
+    sha256_init(&whole);
+    size_t have = 0, pos = 0;
+    int eof = 0, r = 0;
+    for (;;) {
+        /* keep a full CS_MAX_CHUNK window so cut points do not depend on read sizes */
+        if (!eof && have - pos < CS_MAX_CHUNK) {
+            memmove(buf, buf + pos, have - pos);
+            have -= pos;
+            pos = 0;
+            while (!eof && have < CS_READ_BUF) {
+                ssize_t got = read(src_fd, buf + have, CS_READ_BUF - have);
+                if (got < 0 && errno == EINTR) continue;
+                if (got < 0) { r = -1; break; }
+                if (got == 0) eof = 1;
+                have += (size_t)got;
+            }
+            if (r != 0) break;
+        }
+        if (pos == have) break;
+        /* cut every chunk the window holds, then store them as one batch */
+        const unsigned char *data[CS_BATCH];
+        size_t first = f->n, k = 0;
+        while (pos < have && (eof || have - pos >= CS_MAX_CHUNK)) {
+            cs_ref_t ref;
+            size_t len = cs_cut(buf + pos, have - pos);
+            sha256(buf + pos, len, ref.hash);
+            sha256_update(&whole, buf + pos, len);
+            ref.len = (uint32_t)len;
+            if (cs_push_ref(&f->refs, &f->cap, first + k, &ref) != 0) { r = -1; break; }
+            data[k++] = buf + pos;
+            pos += len;
+            f->size += len;
+        }
+        if (r == 0 && cs_add_batch(s, (const cs_ref_t *)f->refs + first, data, k) != 0) r = -1;
+        if (r != 0) break;
+        f->n += k;
+    }
+    free(buf);
+    sha256_final(&whole, f->digest);
+    if (r != 0) cs_file_free(s, f, 1);
+    return r;
+}
+
+void cs_file_free(chunk_store_t *s, cs_file_t *f, int unpin) {
+    if (unpin) cs_unpin(s, f->refs, f->n);
+    free(f->refs);
+    f->refs = NULL;
+    f->n = f->cap = 0;
+}
+
+int cs_load(int fd, void **buf, size_t *cap, size_t *n, size_t *size) {
+    char magic[CS_MAGIC_LEN];
+    if (pread(fd, magic, CS_MAGIC_LEN, 0) != CS_MAGIC_LEN || memcmp(magic, CS_MAGIC, CS_MAGIC_LEN) != 0) {
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) return -1;
+    char *text = malloc((size_t)st.st_size + 1);
+    if (!text) return -1;
+    size_t got = 0;
+    while (got < (size_t)st.st_size) {
+        ssize_t r = pread(fd, text + got, (size_t)st.st_size - got, (off_t)got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        got += (size_t)r;
+    }
+    text[got] = '\0';
+
+    size_t total, count, sum = 0;
+    int off = 0;
+    *n = 0;
+    if (sscanf(text + CS_MAGIC_LEN, "%zu %zu%n", &total, &count, &off) != 2 || off == 0 ||
+        count > got / (2 * SHA256_LEN)) {
+        free(text);
+        return -1;
+    }
+    const char *p = text + CS_MAGIC_LEN + off;
+    /* skip the whole-file digest and version; older manifests have neither */
+    if (*p == ' ' && (size_t)(text + got - p) > 1 + 2 * SHA256_LEN) p += 1 + 2 * SHA256_LEN;
+    if (*p == ' ') {
+        char *end;
+        strtoul(p + 1, &end, 10);
+        p = end;
+    }
+    if (*p++ != '\n') {
+        free(text);
+        return -1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        cs_ref_t ref;
+        char *end;
+        if ((size_t)(text + got - p) < 2 * SHA256_LEN + 2 || cs_unhex(p, ref.hash) != 0 ||
+            p[2 * SHA256_LEN] != ' ') break;
+        unsigned long len = strtoul(p + 2 * SHA256_LEN + 1, &end, 10);
+        if (*end != '\n' || len == 0 || len > CS_MAX_CHUNK) break;
+        ref.len = (uint32_t)len;
+        if (cs_push_ref(buf, cap, i, &ref) != 0) break;
+        sum += len;
+        *n = i + 1;
+        p = end + 1;
+    }
+    free(text);
+    if (*n != count || sum != total) return -1;
+    *size = total;
+    return 0;
+}
+
+int cs_drop_file(chunk_store_t *s, const char *path) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    /* only the caller whose unlink succeeds releases the chunks, so two sweeps cannot both do it */
+    int r = unlink(path);
+    if (fd >= 0) {
+        void *refs = NULL;
+        size_t cap = 0, n = 0, size;
+        if (r == 0 && cs_load(fd, &refs, &cap, &n, &size) == 0) cs_unpin(s, refs, n);
+        free(refs);
+        close(fd);
+    }
+    return r;
+}
+
+int cs_open(chunk_store_t *s, const cs_ref_t *ref) {
+    char path[512];
+    cs_blob_path(s, ref->hash, path, sizeof(path));
+    return open(path, O_RDONLY);
+}
+
+int cs_reader_open(chunk_store_t *s, cs_reader_t *r, const char *path) {
+    memset(r, 0, sizeof(*r));
+    r->s = s;
+    r->blob = -1;
+    r->fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (r->fd < 0) return -1;
+    struct stat st;
+    if (fstat(r->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(r->fd);
+        return -1;
+    }
+    int m = cs_load(r->fd, &r->refs, &r->refs_cap, &r->n, &r->size);
+    if (m == 1) {
+        r->size = (size_t)st.st_size;
+        return 0;
+    }
+    close(r->fd);
+    r->fd = -1;
+    if (m == 0 && (r->ends = malloc((r->n ? r->n : 1) * sizeof(size_t))) != NULL &&
+        cs_pin(s, r->refs, r->n) == 0) {
+        const cs_ref_t *refs = r->refs;
+        size_t end = 0;
+        for (size_t i = 0; i < r->n; ++i) r->ends[i] = end += refs[i].len;
+        return 0;
+    }
+    free(r->ends);
+    free(r->refs);
+    return -1;
+}
+
+/*
+ * Read [pos, pos + len) of a manifest's content starting in chunk lo, which
+ * spans several chunks: each round opens up to CS_BATCH blobs, reads them
+ * and closes them as three batches. Returns the bytes read.
+ */
+static ssize_t cs_reader_batch(cs_reader_t *r, char *buf, size_t len, size_t pos, size_t lo) {
+    const cs_ref_t *refs = r->refs;
+    char paths[CS_BATCH][512];
+    sio_op_t ops[CS_BATCH];
+    size_t want[CS_BATCH];
+    int fds[CS_BATCH];
+    sio_t *io = sio_thread();
+    size_t done = 0;
+    while (done < len && lo < r->n) {
+        size_t k = 0, plan = done;
+        for (; k < CS_BATCH && lo + k < r->n && plan < len; ++k) {
+            size_t start = r->ends[lo + k] - refs[lo + k].len, at = pos + plan;
+            want[k] = r->ends[lo + k] - at < len - plan ? r->ends[lo + k] - at : len - plan;
+            plan += want[k];
+            cs_blob_path(r->s, refs[lo + k].hash, paths[k], sizeof(paths[k]));
+            ops[k] = (sio_op_t){ .op = SIO_OPEN, .path = paths[k], .flags = O_RDONLY, .off = (off_t)(at - start) };
+        }
+        int ok = sio_run(io, ops, k) == 0;
+        for (size_t i = 0; i < k; ++i) {
+            fds[i] = ok ? (int)ops[i].res : -1;
+            if (fds[i] < 0) ok = 0;
+        }
+        if (ok) {
+            size_t at = done;
+            for (size_t i = 0; i < k; ++i) {
+                ops[i] = (sio_op_t){ .op = SIO_READ, .fd = fds[i], .buf = buf + at, .len = want[i], .off = ops[i].off };
+                at += want[i];
+            }
+            ok = sio_run(io, ops, k) == 0;
+            for (size_t i = 0; ok && i < k; ++i) {
+                if (ops[i].res != (long)want[i]) ok = 0;
+            }
+        }
+        size_t nfds = 0;
+        for (size_t i = 0; i < k; ++i) {
+            if (fds[i] >= 0) ops[nfds++] = (sio_op_t){ .op = SIO_CLOSE, .fd = fds[i] };
+        }
+        sio_run(io, ops, nfds);
+        if (!ok) return -1;
+        done = plan;
+        lo += k;
+    }
+    return (ssize_t)done;
+}
+
+ssize_t cs_reader_pread(cs_reader_t *r, void *buf, size_t len, size_t off) {
+    size_t done = 0;
+    while (done < len && off + done < r->size) {
+        size_t pos = off + done;
+        ssize_t n;
+        if (r->fd >= 0) {
+            n = pread(r->fd, (char *)buf + done, len - done, (off_t)pos);
+        } else {
+            /* first chunk ending past pos */
+            size_t lo = 0, hi = r->n - 1;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (r->ends[mid] > pos) hi = mid; else lo = mid + 1;
+            }
+            size_t left = r->size - pos < len - done ? r->size - pos : len - done;
+            if (r->ends[lo] - pos < left && (r->blob < 0 || r->blob_idx != lo)) {
+                /* spans several chunks: fetch them all at once */
+                n = cs_reader_batch(r, (char *)buf + done, left, pos, lo);
+                if (n <= 0) return -1;
+                done += (size_t)n;
+                continue;
+            }
+            if (r->blob < 0 || r->blob_idx != lo) {
+                if (r->blob >= 0) close(r->blob);
+                r->blob = cs_open(r->s, (const cs_ref_t *)r->refs + lo);
+                r->blob_idx = lo;
+                if (r->blob < 0) return -1;
+            }
+            size_t start = r->ends[lo] - ((const cs_ref_t *)r->refs)[lo].len;
+            size_t want = r->ends[lo] - pos < len - done ? r->ends[lo] - pos : len - done;
+            n = pread(r->blob, (char *)buf + done, want, (off_t)(pos - start));
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+void cs_reader_close(cs_reader_t *r) {
+    if (r->fd >= 0) close(r->fd);
+    if (r->blob >= 0) close(r->blob);
+    if (r->refs && r->ends) cs_unpin(r->s, r->refs, r->n);
+    free(r->refs);
+    free(r->ends);
+    r->fd = r->blob = -1;
+    r->refs = NULL;
+    r->ends = NULL;
+}
+
+/* Stat path and read the start of it, NUL-terminated; returns the bytes
+ * read, or -1 if path is not a regular file */
+static ssize_t cs_read_head(const char *path, char head[CS_HEAD_MAX + 1], struct stat *st) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW);
+    if (fd < 0) return -1;
+    ssize_t n = -1;
+    if (fstat(fd, st) == 0 && S_ISREG(st->st_mode)) {
+        n = pread(fd, head, CS_HEAD_MAX, 0);
+        if (n < 0) n = 0;
+        head[n] = '\0';
+    }
+    close(fd);
+    return n;
+}
+
+/* Parse a manifest header: size and count, then the text after them */
+static const char *cs_parse_head(const char *head, ssize_t n, size_t *size) {
+    if (n <= CS_MAGIC_LEN || memcmp(head, CS_MAGIC, CS_MAGIC_LEN) != 0) return NULL;
+    size_t total, count;
+    int off = 0;
+    if (sscanf(head + CS_MAGIC_LEN, "%zu %zu%n", &total, &count, &off) < 1) return NULL;
+    *size = total;
+    return off ? head + CS_MAGIC_LEN + off : NULL;
+}
+
+int cs_file_info(const char *path, size_t *size, unsigned char digest[SHA256_LEN], time_t *mtime) {
+    char head[CS_HEAD_MAX + 1];
+    struct stat st;
+    ssize_t n = cs_read_head(path, head, &st);
+    if (n < 0) return -1;
+    *size = (size_t)st.st_size;
+    if (mtime) *mtime = st.st_mtime;
+    const char *sum = cs_parse_head(head, n, size);
+    if (!sum || *sum != ' ') return 1;
+    unsigned char tmp[SHA256_LEN];
+    if (cs_unhex(sum + 1, digest ? digest : tmp) != 0) return 1;
+    return 0;
+}
+
+int cs_file_version(const char *path, unsigned long *out) {
+    char head[CS_HEAD_MAX + 1];
+    struct stat st;
+    size_t size;
+    ssize_t n = cs_read_head(path, head, &st);
+    if (n < 0) return -1;
+    *out = 1;
+    const char *p = cs_parse_head(head, n, &size);
+    if (p && *p == ' ' && strlen(p) > 2 + 2 * SHA256_LEN && p[1 + 2 * SHA256_LEN] == ' ') {
+        unsigned long v = strtoul(p + 2 + 2 * SHA256_LEN, NULL, 10);
+        if (v) *out = v;
+    }
+    return 0;
+}
+
+int cs_file_size(const char *path, size_t *out) {
+    return cs_file_info(path, out, NULL, NULL) < 0 ? -1 : 0;
+}
+
+/* Count the references held by the manifests in one directory */
+static void cs_scan_dir(chunk_store_t *s, const char *dir, void **refs, size_t *cap) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *f;
+    while ((f = readdir(d)) != NULL) {
+        char fpath[1024];
+        snprintf(fpath, sizeof(fpath), "%s/%s", dir, f->d_name);
+        int fd = open(fpath, O_RDONLY | O_NOFOLLOW);
+        if (fd < 0) continue;
+        struct stat st;
+        size_t n = 0, size;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            cs_load(fd, refs, cap, &n, &size) == 0) {
+            const cs_ref_t *r = *refs;
+            for (size_t i = 0; i < n; ++i) {
+                cs_bucket_t *b = cs_bucket(s, r[i].hash);
+                cs_entry_t *e = cs_find(b, r[i].hash);
+                if (!e) e = cs_insert(b, r[i].hash);
+                if (e) e->refs++;
+            }
+        }
+        close(fd);
+    }
+    closedir(d);
+}
+
+/* ... under users_root: every user's files and the versions kept of them */
+static void cs_scan_users(chunk_store_t *s, const char *users_root) {
+    DIR *d = opendir(users_root);
+    if (!d) return;
+    void *refs = NULL;
+    size_t cap = 0;
+    struct dirent *u;
+    while ((u = readdir(d)) != NULL) {
+        if (u->d_name[0] == '.') continue; /* ., .., the blob directory */
+        char upath[512];
+        snprintf(upath, sizeof(upath), "%s/%s", users_root, u->d_name);
+        cs_scan_dir(s, upath, &refs, &cap);
+        snprintf(upath, sizeof(upath), "%s/%s/" CS_VERSIONS_DIR, users_root, u->d_name);
+        cs_scan_dir(s, upath, &refs, &cap);
+    }
+    free(refs);
+    closedir(d);
+}
+
+/* Delete blobs no manifest refers to (left over from crashes) and stale temp files */
+static void cs_sweep(chunk_store_t *s) {
+    char path[512];
+    for (int i = 0; i <= 256; ++i) {
+        if (i < 256) snprintf(path, sizeof(path), "%s/%02x", s->dir, i);
+        else snprintf(path, sizeof(path), "%s/tmp", s->dir);
+        DIR *d = opendir(path);
+        if (!d) continue;
+        struct dirent *f;
+        while ((f = readdir(d)) != NULL) {
+            if (f->d_name[0] == '.') continue;
+            unsigned char hash[SHA256_LEN];
+            if (i < 256 && strlen(f->d_name) == 2 * SHA256_LEN && cs_unhex(f->d_name, hash) == 0 &&
+                cs_find(cs_bucket(s, hash), hash)) continue;
+            char fpath[1024];
+            snprintf(fpath, sizeof(fpath), "%s/%s", path, f->d_name);
+            unlink(fpath);
+        }
+        closedir(d);
+    }
+}
+
+int cs_init(chunk_store_t *s, const char *dir, const char *users_root) {
+    s->dir = strdup(dir);
+    if (!s->dir) return -1;
+    for (int i = 0; i < CS_BUCKETS; ++i) {
+        if (pthread_mutex_init(&s->buckets[i].lock, NULL) != 0) return -1;
+        s->buckets[i].head = NULL;
+    }
+    cs_gear_init();
+
+    char path[512];
+    mkdir(users_root, 0755);
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return -1;
+    snprintf(path, sizeof(path), "%s/tmp", dir);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+    for (int i = 0; i < 256; ++i) {
+        snprintf(path, sizeof(path), "%s/%02x", dir, i);
+        if (mkdir(path, 0755) != 0 && errno != EEXIST) return -1;
+    }
+    cs_scan_users(s, users_root);
+    cs_sweep(s);
+    return 0;
+}
+
+void cs_destroy(chunk_store_t *s) {
+    if (!s) return;
+    for (int i = 0; i < CS_BUCKETS; ++i) {
+        cs_entry_t *e = s->buckets[i].head;
+        while (e) {
+            cs_entry_t *nx = e->next;
+            free(e);
+            e = nx;
+        }
+        pthread_mutex_destroy(&s->buckets[i].lock);
+    }
+    free(s->dir);
+}
@@ -0,0 +1,101 @@
+#ifndef CHUNKSTORE_H
+#define CHUNKSTORE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "sha256.h"
+
+#define CS_MIN_CHUNK (16 * 1024)   // no cut point before this many bytes
+#define CS_MAX_CHUNK (256 * 1024)  // forced cut; content cuts average ~64 KB
+#define CS_BUCKETS 1024
+#define CS_VERSIONS_DIR ".versions" // per user: replaced manifests still being retained
+
+/* One chunk of a file, in order */
+typedef struct {
+    unsigned char hash[SHA256_LEN];
+    uint32_t len;
+} cs_ref_t;
+
+typedef struct cs_entry {
+    unsigned char hash[SHA256_LEN];
+    size_t refs;      // manifest entries + in-progress downloads using the blob
+    struct cs_entry *next;
+} cs_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    cs_entry_t *head;
+} cs_bucket_t;
+
+/*
+ * Content-addressed chunk store shared by all users. Uploads are cut into
+ * content-defined chunks; each distinct chunk is kept once as
+ * <dir>/<hh>/<sha256> and user files become manifests listing their chunks.
+ * Reference counts live in memory and are rebuilt from the manifests at
+ * startup, which also sweeps blobs nothing refers to.
+ */
+typedef struct {
+    char *dir;        // blob directory
+    cs_bucket_t buckets[CS_BUCKETS];
+} chunk_store_t;
+
+/* A file cut into chunks, each referenced once, before its manifest is written */
+typedef struct {
+    void *refs;       // cs_ref_t list
+    size_t cap, n;
+    size_t size;
+    unsigned char digest[SHA256_LEN];
+} cs_file_t;
+
+/* Random access to a stored file, manifest or plain; chunks stay pinned while open */
+typedef struct {
+    chunk_store_t *s;
+    int fd;           // plain file, -1 for a manifest
+    void *refs;       // cs_ref_t list of a manifest
+    size_t refs_cap, n;
+    size_t *ends;     // end offset of each chunk
+    size_t size;
+    size_t blob_idx;  // chunk behind blob
+    int blob;
+} cs_reader_t;
+
+/* users_root holds one directory of manifests per user */
+int cs_init(chunk_store_t *s, const char *dir, const char *users_root);
+void cs_destroy(chunk_store_t *s);
+
+/* Chunk everything readable from src_fd into the store, recording the
+ * file's chunks, length and SHA-256 in f */
+int cs_chunk_file(chunk_store_t *s, int src_fd, cs_file_t *f);
+/* Write the manifest of f, stamped with its version number */
+int cs_write_manifest(int fd, const cs_file_t *f, unsigned long version);
+/* Free f; unpin if no manifest was published to hold its chunks */
+void cs_file_free(chunk_store_t *s, cs_file_t *f, int unpin);
+/* Read the manifest behind fd into a growable buffer of cs_ref_t (*buf,
+ * *cap in bytes). Returns 0, 1 if fd is a plain file, -1 on error. */
+int cs_load(int fd, void **buf, size_t *cap, size_t *n, size_t *size);
+/* Take an extra reference on each chunk; fails if any is gone */
+int cs_pin(chunk_store_t *s, const cs_ref_t *refs, size_t n);
+/* Drop references; blobs nobody uses any more are deleted */
+void cs_unpin(chunk_store_t *s, const cs_ref_t *refs, size_t n);
+/* Unlink a retired manifest (or plain file) and release its chunks */
+int cs_drop_file(chunk_store_t *s, const char *path);
+/* Open one chunk for reading */
+int cs_open(chunk_store_t *s, const cs_ref_t *ref);
+
+int cs_reader_open(chunk_store_t *s, cs_reader_t *r, const char *path);
+/* Like pread(); short only at end of file */
+ssize_t cs_reader_pread(cs_reader_t *r, void *buf, size_t len, size_t off);
+void cs_reader_close(cs_reader_t *r);
+
+/* Size of the content behind path, whether manifest or plain file */
+int cs_file_size(const char *path, size_t *out);
+/* Same plus the content's SHA-256 (digest may be NULL) and the mtime of
+ * path. Returns 0, 1 if no digest is recorded (plain file, older
+ * manifest), -1 if path is not a regular file. */
+int cs_file_info(const char *path, size_t *size, unsigned char digest[SHA256_LEN], time_t *mtime);
+/* Version the manifest at path was published as; 1 if none is recorded */
+int cs_file_version(const char *path, unsigned long *out);
+
+#endif // CHUNKSTORE_H
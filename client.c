@@ -1,21 +1,56 @@
 /* client.c - Simple Dropbox Client (Phase 1) */
+#define _GNU_SOURCE /* splice(), F_SETPIPE_SZ */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/select.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#include "delta.h"
+#include "lz.h"
+#include "sha256.h"
 
 #define BUF_SIZE 1024
+#define DELTA_MIN_FILE (64 * 1024) /* smaller files are simply sent whole */
+#define RESUMABLE_MIN (1024 * 1024) /* larger uploads go in parts that survive reconnects */
+#define PART_SIZE (4 * 1024 * 1024)
+#define MULTIPART_PART_MIN (256 * 1024) /* parallel parts are cut no smaller than this */
+#define PARALLEL_MAX 16
+#define IO_CHUNK (64 * 1024)
+#define RECV_CHUNK (256 * 1024)      /* download copy buffer when splice is not used */
+#define SENDFILE_CHUNK (1024 * 1024) /* cap per sendfile() call */
+#define SPLICE_PIPE (1024 * 1024)    /* pipe size asked for when splicing downloads */
+#define SYNC_MANIFEST ".dbxsync"
+#define SYNC_WINDOW 32 /* pipelined sync requests per connection, under the server's limit */
+#define RETRY_MAX 5
+#define BUSY_RETRY_MAX 50 /* SERVER BUSY replies in a row before a transfer gives up */
+
+static const char *server_ip;
+static int server_port;
+static const char *username;
+static int want_lz = 1;   /* ask for COMPRESS lz at login */
+static int parallel = 4;  /* connections a large upload is spread over */
+/* per thread, as multipart uploads send from several connections at once */
+static _Thread_local int lz; /* the server agreed: bodies travel in LZ frames */
+static _Thread_local unsigned char frame_buf[LZ_FRAME_HDR + LZ_BLOCK_MAX];
 
 static ssize_t send_all(int fd, const void *buf, size_t len) {
     const char *p = buf;
     size_t sent = 0;
     while (sent < len) {
-        ssize_t n = send(fd, p + sent, len - sent, 0);
+        ssize_t n = send(fd, p + sent, len - sent, MSG_NOSIGNAL);
         if (n <= 0) {
             if (errno == EINTR) continue;
             return -1;
@@ -40,56 +75,1076 @@ static ssize_t recv_all(int fd, void *buf, size_t len) {
     return (ssize_t)recvd;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc < 4) {
-        fprintf(stderr, "Usage: %s <server_ip> <port> <username>\n", argv[0]);
-        return 1;
+/* Read one reply line (without the newline); returns its length or -1 */
+static int recv_line(int fd, char *buf, size_t cap) {
+    size_t len = 0;
+    for (;;) {
+        char ch;
+        ssize_t n = recv(fd, &ch, 1, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        if (ch == '\n') break;
+        if (len + 1 < cap) buf[len++] = ch;
+    }
+    buf[len] = '\0';
+    return (int)len;
+}
+
+/* If line is "SERVER BUSY <ms>", wait as the server asked and return 1 */
+static int server_busy(const char *line) {
+    unsigned ms;
+    if (sscanf(line, "SERVER BUSY %u", &ms) != 1) return 0;
+    usleep((ms ? ms : 100) * 1000u);
+    return 1;
+}
+
+/* Request body on its way out; with compression on it is cut into LZ frames */
+static _Thread_local struct {
+    int sock;
+    size_t len;
+    unsigned char buf[LZ_BLOCK_MAX];
+} body;
+
+static void body_begin(int sock) {
+    body.sock = sock;
+    body.len = 0;
+}
+
+/* Send the buffered bytes as a frame; called once more after the last write */
+static int body_end(void) {
+    if (!body.len) return 0;
+    size_t f = lz_frame(body.buf, body.len, frame_buf);
+    body.len = 0;
+    return send_all(body.sock, frame_buf, f) < 0 ? -1 : 0;
+}
+
+static int body_write(const void *data, size_t len) {
+    if (!lz) return send_all(body.sock, data, len) < 0 ? -1 : 0;
+    const unsigned char *p = data;
+    while (len > 0) {
+        size_t take = LZ_BLOCK_MAX - body.len < len ? LZ_BLOCK_MAX - body.len : len;
+        memcpy(body.buf + body.len, p, take);
+        body.len += take;
+        p += take;
+        len -= take;
+        if (body.len == LZ_BLOCK_MAX && body_end() != 0) return -1;
     }
+    return 0;
+}
+
+/* Receive one frame of a compressed body into buf; returns its raw length or -1 */
+static ssize_t recv_frame(int sock, void *buf, size_t max) {
+    size_t raw, wire;
+    if (recv_all(sock, frame_buf, LZ_FRAME_HDR) != LZ_FRAME_HDR ||
+        lz_frame_parse(frame_buf, &raw, &wire) != 0 || raw > max ||
+        recv_all(sock, frame_buf, wire) != (ssize_t)wire ||
+        lz_unframe(frame_buf, wire, buf, raw) != 0) return -1;
+    return (ssize_t)raw;
+}
+
+/* Literal run (a = offset, b = length) or copy of old blocks (a = first, b = count) */
+typedef struct {
+    char op;
+    size_t a, b;
+} delta_op_t;
+
+static int push_op(delta_op_t **ops, size_t *n, size_t *cap, char op, size_t a, size_t b) {
+    if (*n == *cap) {
+        size_t nc = *cap ? *cap * 2 : 64;
+        delta_op_t *no = realloc(*ops, nc * sizeof(delta_op_t));
+        if (!no) return -1;
+        *ops = no;
+        *cap = nc;
+    }
+    (*ops)[(*n)++] = (delta_op_t){ op, a, b };
+    return 0;
+}
 
-    const char *server_ip = argv[1];
-    int port = atoi(argv[2]);
-    const char *username = argv[3];
+/*
+ * Match the local file against the server's block signatures with a
+ * rolling checksum, rsync-style, and collect the resulting ops.
+ */
+static int delta_compute(const unsigned char *data, size_t len, size_t block,
+                         const unsigned char *sigs, size_t count,
+                         delta_op_t **ops, size_t *nops) {
+    size_t nb = 16;
+    while (nb < count * 2) nb *= 2;
+    int *head = malloc(nb * sizeof(int));
+    int *next = malloc((count ? count : 1) * sizeof(int));
+    size_t cap = 0;
+    int r = 0;
+    *ops = NULL;
+    *nops = 0;
+    if (!head || !next) { free(head); free(next); return -1; }
+    for (size_t i = 0; i < nb; ++i) head[i] = -1;
+    for (size_t j = count; j-- > 0;) {
+        size_t h = (delta_get32(sigs + j * DELTA_SIG_LEN) * 2654435761u) & (nb - 1);
+        next[j] = head[h];
+        head[h] = (int)j;
+    }
 
+    size_t i = 0, lit = 0;
+    uint32_t weak = len >= block ? delta_weak(data, block) : 0;
+    while (r == 0 && i + block <= len) {
+        int match = -1;
+        int have_strong = 0;
+        unsigned char strong[SHA256_LEN];
+        for (int j = head[(weak * 2654435761u) & (nb - 1)]; j >= 0; j = next[j]) {
+            const unsigned char *sig = sigs + (size_t)j * DELTA_SIG_LEN;
+            if (delta_get32(sig) != weak) continue;
+            if (!have_strong) { sha256(data + i, block, strong); have_strong = 1; }
+            if (memcmp(strong, sig + 4, DELTA_STRONG_LEN) == 0) { match = j; break; }
+        }
+        if (match >= 0) {
+            if (i > lit) r = push_op(ops, nops, &cap, DELTA_OP_LITERAL, lit, i - lit);
+            delta_op_t *prev = *nops ? &(*ops)[*nops - 1] : NULL;
+            if (prev && prev->op == DELTA_OP_COPY && prev->a + prev->b == (size_t)match) prev->b++;
+            else if (r == 0) r = push_op(ops, nops, &cap, DELTA_OP_COPY, (size_t)match, 1);
+            i += block;
+            lit = i;
+            if (i + block <= len) weak = delta_weak(data + i, block);
+        } else if (i + block < len) {
+            weak = delta_roll(weak, data[i], data[i + block], block);
+            i++;
+        } else {
+            break;
+        }
+    }
+    if (r == 0 && lit < len) r = push_op(ops, nops, &cap, DELTA_OP_LITERAL, lit, len - lit);
+    free(head);
+    free(next);
+    return r;
+}
+
+/*
+ * Upload a file the server already has a version of by sending only what
+ * changed. Returns 0 once the server has answered, -1 if the caller should
+ * fall back to a plain UPLOAD (no old version, or nothing to gain).
+ */
+static int delta_upload(int sock, const char *fname, int fd, size_t len) {
+    char line[600];
+    snprintf(line, sizeof(line), "SIGNATURES %s\n", fname);
+    if (send_all(sock, line, strlen(line)) < 0 || recv_line(sock, line, sizeof(line)) < 0) return -1;
+    long sig_len;
+    if (sscanf(line, "SIGNATURES %ld", &sig_len) != 1 || sig_len < 4) return -1;
+    unsigned char *sigs = malloc((size_t)sig_len);
+    if (!sigs) return -1;
+    if (recv_all(sock, sigs, (size_t)sig_len) != sig_len) { free(sigs); return -1; }
+    size_t block = delta_get32(sigs);
+    size_t count = ((size_t)sig_len - 4) / DELTA_SIG_LEN;
+
+    unsigned char *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) { free(sigs); return -1; }
+    delta_op_t *ops = NULL;
+    size_t nops = 0, dlen = DELTA_HDR_LEN;
+    int r = -1;
+    if (block >= DELTA_BLOCK_MIN && block <= DELTA_BLOCK_MAX &&
+        delta_compute(data, len, block, sigs + 4, count, &ops, &nops) == 0) {
+        for (size_t i = 0; i < nops; ++i) {
+            dlen += ops[i].op == DELTA_OP_COPY ? 9 : 5 + ops[i].b;
+        }
+        r = dlen < len ? 0 : -1;
+    }
+    free(sigs);
+    if (r == 0) {
+        unsigned char hdr[DELTA_HDR_LEN];
+        delta_put32(hdr, (uint32_t)block);
+        sha256(data, len, hdr + 4);
+        snprintf(line, sizeof(line), "DELTA %s %zu %zu\n", fname, len, dlen);
+        body_begin(sock);
+        r = send_all(sock, line, strlen(line)) < 0 || body_write(hdr, sizeof(hdr)) < 0 ? -1 : 0;
+        for (size_t i = 0; r == 0 && i < nops; ++i) {
+            unsigned char op[9] = { (unsigned char)ops[i].op };
+            if (ops[i].op == DELTA_OP_COPY) {
+                delta_put32(op + 1, (uint32_t)ops[i].a);
+                delta_put32(op + 5, (uint32_t)ops[i].b);
+                if (body_write(op, 9) < 0) r = -1;
+            } else {
+                delta_put32(op + 1, (uint32_t)ops[i].b);
+                if (body_write(op, 5) < 0 || body_write(data + ops[i].a, ops[i].b) < 0) r = -1;
+            }
+        }
+        if (r == 0 && body_end() != 0) r = -1;
+        if (r == 0 && recv_line(sock, line, sizeof(line)) >= 0 && strcmp(line, "UPLOAD OK") == 0) {
+            printf("UPLOAD OK (delta: sent %zu of %zu bytes)\n", dlen, len);
+        } else {
+            r = -1;
+        }
+    }
+    munmap(data, len);
+    free(ops);
+    return r;
+}
+
+/* Connect and log in; the greeting is printed when verbose. Returns the socket or -1 */
+static int server_connect(int verbose) {
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
         perror("socket");
-        return 1;
+        return -1;
     }
 
     struct sockaddr_in serv_addr;
     memset(&serv_addr, 0, sizeof(serv_addr));
     serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(port);
+    serv_addr.sin_port = htons(server_port);
     if (inet_pton(AF_INET, server_ip, &serv_addr.sin_addr) <= 0) {
         perror("inet_pton");
         close(sock);
-        return 1;
+        return -1;
     }
 
     if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("connect");
+        if (verbose) perror("connect");
         close(sock);
-        return 1;
+        return -1;
     }
 
-    printf("Connected to server %s:%d\n", server_ip, port);
-
-    char buf[BUF_SIZE];
-    ssize_t n = recv(sock, buf, sizeof(buf) - 1, 0);
-    if (n > 0) {
-        buf[n] = '\0';
-        printf("%s", buf);
-    }
+    if (verbose) printf("Connected to server %s:%d\n", server_ip, server_port);
 
+    /* two banner lines, then the answer to HELLO */
+    char line[BUF_SIZE];
     char hello_msg[256];
     snprintf(hello_msg, sizeof(hello_msg), "HELLO %s\n", username);
-    send_all(sock, hello_msg, strlen(hello_msg));
+    for (int i = 0; i < 3; ++i) {
+        if (i == 2) send_all(sock, hello_msg, strlen(hello_msg));
+        if (recv_line(sock, line, sizeof(line)) < 0) {
+            close(sock);
+            return -1;
+        }
+        if (verbose) printf("%s\n", line);
+    }
+    if (strncmp(line, "AUTH OK", 7) != 0) {
+        close(sock);
+        return -1;
+    }
+    /* servers without compression answer "Unknown command" and we send plain bodies */
+    lz = 0;
+    if (want_lz) {
+        if (send_all(sock, "COMPRESS lz\n", 12) < 0 || recv_line(sock, line, sizeof(line)) < 0) {
+            close(sock);
+            return -1;
+        }
+        lz = strcmp(line, "COMPRESS OK lz") == 0;
+        if (verbose) printf("%s\n", line);
+    }
+    return sock;
+}
 
-    n = recv(sock, buf, sizeof(buf) - 1, 0);
-    if (n > 0) {
-        buf[n] = '\0';
-        printf("%s", buf);
+/* Replace a broken connection, backing off between attempts */
+static int reconnect(int *sock) {
+    close(*sock);
+    *sock = -1;
+    printf("Connection lost, reconnecting...\n");
+    for (int attempt = 0; attempt < RETRY_MAX; ++attempt) {
+        sleep(1u << (attempt < 3 ? attempt : 3));
+        int s = server_connect(0);
+        if (s >= 0) {
+            *sock = s;
+            return 0;
+        }
     }
+    return -1;
+}
+
+/*
+ * Send len bytes of fd starting at off as a request body. Raw bodies go
+ * with sendfile, straight from the page cache; compressed ones are read in
+ * IO_CHUNK pieces and framed. Memory use does not grow with the file.
+ */
+static int send_file_range(int sock, int fd, size_t off, size_t len) {
+    if (!lz) {
+        off_t pos = (off_t)off;
+        while (len > 0) {
+            ssize_t n = sendfile(sock, fd, &pos, len < SENDFILE_CHUNK ? len : SENDFILE_CHUNK);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) break; /* not a regular file: copy the rest */
+            if (n <= 0) return -1;
+            len -= (size_t)n;
+        }
+        off = (size_t)pos;
+    }
+    char buf[IO_CHUNK];
+    body_begin(sock);
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len < sizeof(buf) ? len : sizeof(buf), (off_t)off);
+        if (n <= 0) return -1;
+        if (body_write(buf, (size_t)n) < 0) return -1;
+        off += (size_t)n;
+        len -= (size_t)n;
+    }
+    return body_end();
+}
+
+/* One multipart upload, shared by its sender threads */
+typedef struct {
+    const char *token;
+    int fd;
+    size_t len, part, count;
+    atomic_size_t next;   /* next part to claim */
+    atomic_int outcome;   /* 0 while sending, 1 once UPLOAD OK came back, -1 failed */
+    char error[600];      /* a whole reply line (senders read 600); written by the one thread that set outcome to -1 */
+} multipart_t;
+
+static void multipart_fail(multipart_t *m, const char *msg) {
+    int running = 0;
+    if (atomic_compare_exchange_strong(&m->outcome, &running, -1)) snprintf(m->error, sizeof(m->error), "%s", msg);
+    atomic_store(&m->next, m->count); /* the others stop after their current part */
+}
+
+/*
+ * Sender thread: claim parts until none are left and send each over this
+ * thread's own connection, straight from the file. A part whose connection
+ * drops is sent again in full after reconnecting; the server only counts
+ * parts that arrived whole.
+ */
+static void *multipart_sender(void *arg) {
+    multipart_t *m = arg;
+    char line[600];
+    int sock = server_connect(0);
+    size_t i;
+    while ((i = atomic_fetch_add(&m->next, 1)) < m->count) {
+        size_t off = i * m->part, plen = m->len - off < m->part ? m->len - off : m->part;
+        for (int failures = 0, busy = 0;;) {
+            int h = snprintf(line, sizeof(line), "UPLOAD-PART %s %zu %zu\n", m->token, off, plen);
+            if (sock >= 0 && send_all(sock, line, (size_t)h) >= 0 && send_file_range(sock, m->fd, off, plen) == 0 &&
+                recv_line(sock, line, sizeof(line)) >= 0) {
+                int running = 0;
+                /* the part is held but not counted: send it again */
+                if (busy < BUSY_RETRY_MAX && server_busy(line)) {
+                    busy++;
+                    continue;
+                }
+                if (strcmp(line, "UPLOAD OK") == 0) atomic_compare_exchange_strong(&m->outcome, &running, 1);
+                else if (strncmp(line, "PART OK", 7) != 0) multipart_fail(m, line);
+                break;
+            }
+            if (++failures > RETRY_MAX || reconnect(&sock) != 0) {
+                multipart_fail(m, "UPLOAD FAILED: connection lost");
+                break;
+            }
+        }
+    }
+    if (sock >= 0) close(sock);
+    return NULL;
+}
+
+/* Send the parts of a multipart upload over up to `parallel` connections */
+static void multipart_upload(const char *token, int fd, size_t len, size_t part) {
+    multipart_t m = { .token = token, .fd = fd, .len = len, .part = part };
+    m.count = len ? (len + part - 1) / part : 1;
+    atomic_init(&m.next, 0);
+    atomic_init(&m.outcome, 0);
+    pthread_t threads[PARALLEL_MAX];
+    int n = (size_t)parallel < m.count ? parallel : (int)m.count, started = 0;
+    while (started < n && pthread_create(&threads[started], NULL, multipart_sender, &m) == 0) started++;
+    if (started == 0) multipart_sender(&m);
+    for (int i = 0; i < started; ++i) pthread_join(threads[i], NULL);
+
+    int outcome = atomic_load(&m.outcome);
+    if (outcome > 0) printf("UPLOAD OK (%zu parts over %d connections)\n", m.count, started ? started : 1);
+    else if (outcome < 0) printf("%s\n", m.error);
+    else printf("UPLOAD FAILED\n");
+}
+
+/*
+ * Upload in parts under a server-issued token. With --parallel above 1 the
+ * server is asked for a multipart upload, whose parts go out concurrently.
+ * Otherwise parts go one after another; if the connection drops, reconnect,
+ * ask how many bytes the server kept and carry on from there. Returns -1
+ * only if the server does not support resumable uploads.
+ */
+static int resumable_upload(int *sock, const char *fname, int fd, size_t len) {
+    char line[600], token[64];
+    size_t part = 0;
+    if (parallel > 1) {
+        /* about two parts per connection, so a slow one does not hold up the end */
+        part = (len / ((size_t)parallel * 2) + IO_CHUNK - 1) / IO_CHUNK * IO_CHUNK;
+        if (part < MULTIPART_PART_MIN) part = MULTIPART_PART_MIN;
+        if (part > PART_SIZE) part = PART_SIZE;
+        snprintf(line, sizeof(line), "UPLOAD-INIT %s %zu %zu\n", fname, len, part);
+    } else {
+        snprintf(line, sizeof(line), "UPLOAD-INIT %s %zu\n", fname, len);
+    }
+    if (send_all(*sock, line, strlen(line)) < 0 || recv_line(*sock, line, sizeof(line)) < 0) {
+        printf("UPLOAD FAILED: connection lost\n");
+        return 0;
+    }
+    if (strncmp(line, "Unknown", 7) == 0) return -1;
+    /* a server without multipart support hands out a plain token */
+    size_t granted = 0;
+    if (sscanf(line, "UPLOAD-TOKEN %63s %zu", token, &granted) < 1) {
+        printf("%s\n", line);
+        return 0;
+    }
+    if (granted) {
+        multipart_upload(token, fd, len, granted);
+        return 0;
+    }
+
+    size_t off = 0;
+    int failures = 0;
+    while (failures <= RETRY_MAX) {
+        size_t part = len - off < PART_SIZE ? len - off : PART_SIZE;
+        int h = snprintf(line, sizeof(line), "UPLOAD-PART %s %zu %zu\n", token, off, part);
+        if (send_all(*sock, line, (size_t)h) >= 0 && send_file_range(*sock, fd, off, part) == 0 &&
+            recv_line(*sock, line, sizeof(line)) >= 0) {
+            if (strcmp(line, "UPLOAD OK") == 0) {
+                printf("UPLOAD OK\n");
+                return 0;
+            }
+            if (sscanf(line, "PART OK %zu", &off) == 1) {
+                failures = 0;
+                continue;
+            }
+            /* the server still holds the dropped session's part, or we are out of step */
+            if (server_busy(line)) {
+                /* the part is stored but was not checked in: ask where to go on from */
+            } else if (strcmp(line, "UPLOAD FAILED: PART IN PROGRESS") != 0 &&
+                       strcmp(line, "UPLOAD FAILED: BAD OFFSET") != 0) {
+                printf("%s\n", line);
+                return 0;
+            } else {
+                sleep(1);
+            }
+        } else if (reconnect(sock) != 0) {
+            break;
+        }
+        failures++;
+        /* resume from whatever the server kept */
+        h = snprintf(line, sizeof(line), "UPLOAD-STATUS %s\n", token);
+        if (send_all(*sock, line, (size_t)h) >= 0 && recv_line(*sock, line, sizeof(line)) >= 0 &&
+            sscanf(line, "UPLOAD-OFFSET %zu", &off) != 1) {
+            printf("%s\n", line);
+            return 0;
+        }
+    }
+    printf("UPLOAD FAILED: connection lost\n");
+    return 0;
+}
+
+/*
+ * Move up to want raw body bytes from the socket into fd at off through a
+ * pipe, so they never pass through user space. Returns the bytes moved, 0
+ * if the connection closed, -1 on a socket error (errno set), -2 if the
+ * file could not be written.
+ */
+static ssize_t splice_body(int sock, int pipefd[2], int fd, size_t off, size_t want) {
+    ssize_t n = splice(sock, NULL, pipefd[1], NULL, want, SPLICE_F_MOVE);
+    if (n <= 0) return n;
+    loff_t pos = (loff_t)off;
+    for (size_t left = (size_t)n; left > 0;) {
+        ssize_t w = splice(pipefd[0], NULL, fd, &pos, left, SPLICE_F_MOVE);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -2;
+        left -= (size_t)w;
+    }
+    return n;
+}
+
+/*
+ * Fetch a file into target with ranged reads, picking up where it stopped
+ * after a reconnect. Data goes to <target>.part until the whole file is
+ * there. Raw bodies are spliced from the socket into the file; compressed
+ * ones are decoded a frame at a time, so memory stays flat for any size.
+ */
+static void download_file(int *sock, const char *name, const char *target) {
+    char line[600], part[600];
+    snprintf(part, sizeof(part), "%s.part", target);
+    int fd = open(part, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror("open");
+        return;
+    }
+    int pipefd[2] = { -1, -1 };
+    size_t pipe_cap = 0;
+    if (pipe(pipefd) == 0) {
+        fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE); /* best effort; the default is 64 KB */
+        int cap = fcntl(pipefd[1], F_GETPIPE_SZ);
+        pipe_cap = cap > 0 ? (size_t)cap : 0;
+    }
+    static char buf[RECV_CHUNK];
+    size_t off = 0, total = 0;
+    int known = 0, failures = 0, busy = 0, done = 0, werr = 0;
+    while (!done && !werr && failures <= RETRY_MAX) {
+        size_t len, tot;
+        int ok = 0;
+        int h = snprintf(line, sizeof(line), "DOWNLOAD %s %zu\n", name, off);
+        if (send_all(*sock, line, (size_t)h) >= 0 && recv_line(*sock, line, sizeof(line)) >= 0) {
+            if (busy < BUSY_RETRY_MAX && server_busy(line)) {
+                busy++;
+                continue;
+            }
+            busy = 0;
+            if (sscanf(line, "DOWNLOAD %zu %zu", &len, &tot) != 2) {
+                printf("%s\n", line);
+                break;
+            }
+            /* the file changed since we started: begin again */
+            int restart = known && tot != total;
+            total = tot;
+            known = 1;
+            ok = 1;
+            while (ok && len > 0) {
+                ssize_t n;
+                if (pipe_cap && !lz && !restart) {
+                    n = splice_body(*sock, pipefd, fd, off, len < pipe_cap ? len : pipe_cap);
+                    if (n == -1 && errno == EINVAL) {
+                        pipe_cap = 0; /* cannot splice from this socket: copy instead */
+                        continue;
+                    }
+                } else {
+                    size_t want = len < sizeof(buf) ? len : sizeof(buf);
+                    n = lz ? recv_frame(*sock, buf, want) : recv(*sock, buf, want, 0);
+                    if (n > 0 && !restart && pwrite(fd, buf, (size_t)n, (off_t)off) != n) n = -2;
+                }
+                if (n == -2) { werr = 1; ok = 0; break; }
+                if (n < 0 && errno == EINTR && !lz) continue;
+                if (n <= 0) { ok = 0; break; }
+                if (!restart) off += (size_t)n;
+                len -= (size_t)n;
+            }
+            if (restart) {
+                off = 0;
+                if (ftruncate(fd, 0) != 0) ok = 0;
+            }
+            done = ok && off == total;
+        }
+        if (ok || werr) {
+            failures = 0;
+        } else if (++failures > RETRY_MAX || reconnect(sock) != 0) {
+            printf("DOWNLOAD FAILED: connection lost\n");
+            break;
+        }
+    }
+    if (pipefd[0] >= 0) {
+        close(pipefd[0]);
+        close(pipefd[1]);
+    }
+    close(fd);
+    if (werr) {
+        /* the rest of the body is still on the wire: this session is out of step */
+        perror("write");
+        close(*sock);
+        *sock = -1;
+        unlink(part);
+    } else if (done && rename(part, target) == 0) {
+        printf("DOWNLOAD OK %s (%zu bytes)\n", target, total);
+    } else {
+        unlink(part);
+    }
+}
+
+/*
+ * Directory sync (--sync <dir>). The manifest SYNC_MANIFEST in the directory
+ * records every file as of the last sync: its size, mtime and checksum here
+ * and the checksum the server listed. Comparing the directory, one server
+ * listing and the manifest tells which side changed each file, so a file is
+ * only hashed again if its size or mtime moved, and only changed files
+ * travel. The transfers are pipelined as tagged requests.
+ */
+
+/* A file as seen in the directory, on the server or in the manifest */
+typedef struct {
+    char *name;
+    size_t size;
+    long long mtime;                 /* here: ns; on the server: seconds */
+    char sha[2 * SHA256_LEN + 1];    /* hex, "-" if the server has none */
+    char rsha[2 * SHA256_LEN + 1];   /* manifest: what the server listed last time */
+} sync_file_t;
+
+typedef struct {
+    sync_file_t *v;
+    size_t n, cap;
+} sync_list_t;
+
+typedef enum { SYNC_UPLOAD, SYNC_DOWNLOAD, SYNC_DELETE_REMOTE, SYNC_DELETE_LOCAL } sync_kind_t;
+
+typedef struct {
+    sync_kind_t kind;
+    const sync_file_t *local, *remote, *known; /* any may be NULL */
+    int ok;
+    sync_file_t result;     /* the manifest entry once done (name borrowed) */
+} sync_op_t;
+
+/* Ops shared by the connections that carry them; the tag of a request is its op index */
+typedef struct {
+    sync_op_t *ops;
+    size_t n;
+    atomic_size_t next;
+} sync_run_t;
+
+typedef struct {
+    sync_run_t *run;
+    int sock;
+    int lz;                 /* negotiated on this connection */
+    sem_t window;           /* requests the sender may have outstanding */
+    atomic_int dead;        /* receiver gave up: the sender stops */
+    pthread_t sender, receiver;
+} sync_conn_t;
+
+static sync_file_t *sync_add(sync_list_t *l, const char *name) {
+    if (l->n == l->cap) {
+        size_t nc = l->cap ? l->cap * 2 : 256;
+        sync_file_t *nv = realloc(l->v, nc * sizeof(sync_file_t));
+        if (!nv) return NULL;
+        l->v = nv;
+        l->cap = nc;
+    }
+    sync_file_t *f = &l->v[l->n];
+    memset(f, 0, sizeof(*f));
+    if (!(f->name = strdup(name))) return NULL;
+    strcpy(f->sha, "-");
+    strcpy(f->rsha, "-");
+    l->n++;
+    return f;
+}
+
+static void sync_free(sync_list_t *l) {
+    for (size_t i = 0; i < l->n; ++i) free(l->v[i].name);
+    free(l->v);
+    memset(l, 0, sizeof(*l));
+}
+
+static int sync_cmp(const void *a, const void *b) {
+    return strcmp(((const sync_file_t *)a)->name, ((const sync_file_t *)b)->name);
+}
+
+static void sync_sort(sync_list_t *l) {
+    qsort(l->v, l->n, sizeof(sync_file_t), sync_cmp);
+}
+
+static const sync_file_t *sync_find(const sync_list_t *l, const char *name) {
+    sync_file_t key = { .name = (char *)name };
+    return l->n ? bsearch(&key, l->v, l->n, sizeof(sync_file_t), sync_cmp) : NULL;
+}
+
+/* Names the protocol can carry; dot names are ours (manifest, downloads in progress) */
+static int sync_name_ok(const char *name) {
+    if (name[0] == '.' || strlen(name) >= 512) return 0;
+    for (const char *p = name; *p; ++p) {
+        if ((unsigned char)*p <= ' ' || *p == '/') return 0;
+    }
+    return 1;
+}
+
+static void sync_hex(const unsigned char *d, char out[2 * SHA256_LEN + 1]) {
+    for (int i = 0; i < SHA256_LEN; ++i) snprintf(out + 2 * i, 3, "%02x", d[i]);
+}
+
+static int sync_hash_file(const char *name, char out[2 * SHA256_LEN + 1]) {
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return -1;
+    sha256_t h;
+    sha256_init(&h);
+    char buf[IO_CHUNK];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) sha256_update(&h, buf, (size_t)n);
+    close(fd);
+    if (n < 0) return -1;
+    unsigned char d[SHA256_LEN];
+    sha256_final(&h, d);
+    sync_hex(d, out);
+    return 0;
+}
+
+/* Manifest: "DBXSYNC1 <user>" then "<name> <size> <mtime ns> <sha> <server sha>" per file */
+static void sync_manifest_load(sync_list_t *m) {
+    FILE *f = fopen(SYNC_MANIFEST, "r");
+    if (!f) return;
+    char user[256] = "", name[512], sha[2 * SHA256_LEN + 1], rsha[2 * SHA256_LEN + 1];
+    size_t size;
+    long long mtime;
+    /* a manifest written for another user describes another set of server files */
+    if (fscanf(f, "DBXSYNC1 %255s", user) == 1 && strcmp(user, username) == 0) {
+        while (fscanf(f, "%511s %zu %lld %64s %64s", name, &size, &mtime, sha, rsha) == 5) {
+            sync_file_t *e = sync_add(m, name);
+            if (!e) break;
+            e->size = size;
+            e->mtime = mtime;
+            strcpy(e->sha, sha);
+            strcpy(e->rsha, rsha);
+        }
+    }
+    fclose(f);
+    sync_sort(m);
+}
+
+static int sync_manifest_save(const sync_list_t *m) {
+    FILE *f = fopen(SYNC_MANIFEST ".tmp", "w");
+    if (!f) return -1;
+    fprintf(f, "DBXSYNC1 %s\n", username);
+    for (size_t i = 0; i < m->n; ++i) {
+        const sync_file_t *e = &m->v[i];
+        fprintf(f, "%s %zu %lld %s %s\n", e->name, e->size, e->mtime, e->sha, e->rsha);
+    }
+    if (fclose(f) != 0) return -1;
+    return rename(SYNC_MANIFEST ".tmp", SYNC_MANIFEST);
+}
+
+/* Files in the current directory; unchanged size and mtime reuse the manifest's checksum */
+static int sync_scan_local(sync_list_t *l, const sync_list_t *known, size_t *hashed) {
+    DIR *d = opendir(".");
+    if (!d) return -1;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != NULL) {
+        struct stat st;
+        if (!sync_name_ok(ent->d_name) || stat(ent->d_name, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        long long mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        const sync_file_t *k = sync_find(known, ent->d_name);
+        sync_file_t *e = sync_add(l, ent->d_name);
+        if (!e) break;
+        e->size = (size_t)st.st_size;
+        e->mtime = mtime;
+        if (k && k->size == e->size && k->mtime == mtime) {
+            strcpy(e->sha, k->sha);
+        } else if (sync_hash_file(ent->d_name, e->sha) == 0) {
+            (*hashed)++;
+        } else {
+            free(e->name);
+            l->n--;
+        }
+    }
+    closedir(d);
+    sync_sort(l);
+    return 0;
+}
+
+/* The whole server listing, a page at a time */
+static int sync_list_remote(int sock, sync_list_t *l) {
+    char cursor[600] = "-", line[600];
+    for (;;) {
+        int h = snprintf(line, sizeof(line), "#0 LIST - %s 10000\n", cursor);
+        size_t len;
+        if (send_all(sock, line, (size_t)h) < 0 || recv_line(sock, line, sizeof(line)) < 0) return -1;
+        if (sscanf(line, "#0 LIST OK %zu", &len) != 1) {
+            printf("%s\n", line);
+            return -1;
+        }
+        char *body = malloc(len + 1);
+        if (!body || recv_all(sock, body, len) != (ssize_t)len) {
+            free(body);
+            return -1;
+        }
+        body[len] = '\0';
+        char sent[sizeof(cursor)];
+        strcpy(sent, cursor);
+        strcpy(cursor, "-");
+        char *save = NULL;
+        for (char *p = strtok_r(body, "\n", &save); p; p = strtok_r(NULL, "\n", &save)) {
+            char name[512], sha[2 * SHA256_LEN + 1], extra;
+            size_t size;
+            long long mtime;
+            /* the cursor line has exactly two fields */
+            if (sscanf(p, "/NEXT %511s %c", name, &extra) == 1) {
+                snprintf(cursor, sizeof(cursor), "%s", name);
+            } else if (sscanf(p, "%511s %zu %lld %64s", name, &size, &mtime, sha) == 4 && sync_name_ok(name)) {
+                sync_file_t *e = sync_add(l, name);
+                if (!e) break;
+                e->size = size;
+                e->mtime = mtime;
+                strcpy(e->sha, sha);
+            }
+        }
+        free(body);
+        if (strcmp(cursor, "-") == 0) break;
+        /* names come in order: a cursor that does not move on would ask for the same page forever */
+        if (strcmp(sent, "-") != 0 && strcmp(cursor, sent) <= 0) {
+            printf("SYNC FAILED: LIST cursor %s does not follow %s\n", cursor, sent);
+            return -1;
+        }
+    }
+    sync_sort(l);
+    return 0;
+}
+
+/*
+ * What to do with one name, from its state here, on the server and at the
+ * last sync. A side changed if its checksum differs from the manifest's;
+ * when both sides changed, the newer mtime wins. Returns -1 for nothing.
+ */
+static int sync_decide(const sync_file_t *l, const sync_file_t *s, const sync_file_t *k) {
+    int here = l && (!k || strcmp(l->sha, k->sha) != 0);
+    int there = s && (!k || strcmp(s->sha, k->rsha) != 0);
+    if (l && s) {
+        if (strcmp(l->sha, s->sha) == 0) return -1;
+        if (here && there) return l->mtime / 1000000000LL >= s->mtime ? SYNC_UPLOAD : SYNC_DOWNLOAD;
+        if (here) return SYNC_UPLOAD;
+        return there ? SYNC_DOWNLOAD : -1;
+    }
+    if (l) return k && !here ? SYNC_DELETE_LOCAL : SYNC_UPLOAD;
+    if (s) return k && !there ? SYNC_DELETE_REMOTE : SYNC_DOWNLOAD;
+    return -1;
+}
+
+/* Send the requests of claimed ops; replies are matched by the receiver */
+static void *sync_sender(void *arg) {
+    sync_conn_t *sc = arg;
+    sync_run_t *run = sc->run;
+    lz = sc->lz;
+    char line[600];
+    size_t i;
+    while ((i = atomic_fetch_add(&run->next, 1)) < run->n) {
+        sync_op_t *op = &run->ops[i];
+        sem_wait(&sc->window);
+        if (atomic_load(&sc->dead)) break;
+        int h, r;
+        if (op->kind == SYNC_UPLOAD) {
+            int fd = open(op->local->name, O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0) {
+                if (fd >= 0) close(fd);
+                printf("UPLOAD %s FAILED: %s\n", op->local->name, strerror(errno));
+                sem_post(&sc->window);
+                continue;
+            }
+            /* the file may have grown since it was hashed: send what is there now, keep the old mtime */
+            op->result = *op->local;
+            op->result.size = (size_t)st.st_size;
+            h = snprintf(line, sizeof(line), "#%zu UPLOAD %s %zu\n", i, op->local->name, op->result.size);
+            r = send_all(sc->sock, line, (size_t)h) < 0 || send_file_range(sc->sock, fd, 0, op->result.size) != 0;
+            close(fd);
+        } else {
+            const char *name = op->remote->name;
+            h = snprintf(line, sizeof(line), "#%zu %s %s\n", i, op->kind == SYNC_DOWNLOAD ? "DOWNLOAD" : "DELETE", name);
+            r = send_all(sc->sock, line, (size_t)h) < 0;
+        }
+        if (r) break;
+    }
+    /* the server closes once every reply is out, which ends the receiver */
+    send_all(sc->sock, "BYE\n", 4);
+    return NULL;
+}
+
+/* Receive a download body into .<name>.sync, then move it into place */
+static int sync_receive_file(int sock, sync_op_t *op, size_t len) {
+    char tmp[600], buf[IO_CHUNK];
+    snprintf(tmp, sizeof(tmp), ".%s.sync", op->remote->name);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd >= 0;
+    sha256_t h;
+    sha256_init(&h);
+    while (len > 0) {
+        size_t want = len < sizeof(buf) ? len : sizeof(buf);
+        ssize_t n = lz ? recv_frame(sock, buf, want) : recv(sock, buf, want, 0);
+        if (n < 0 && !lz && errno == EINTR) continue;
+        if (n <= 0) {
+            if (fd >= 0) close(fd);
+            unlink(tmp);
+            return -1;
+        }
+        /* keep reading on a write error, the stream must stay in step */
+        if (ok && write(fd, buf, (size_t)n) != n) ok = 0;
+        sha256_update(&h, buf, (size_t)n);
+        len -= (size_t)n;
+    }
+    struct stat st;
+    if (fd >= 0 && close(fd) != 0) ok = 0;
+    if (ok && rename(tmp, op->remote->name) == 0 && stat(op->remote->name, &st) == 0) {
+        unsigned char d[SHA256_LEN];
+        sha256_final(&h, d);
+        op->result.name = op->remote->name;
+        op->result.size = (size_t)st.st_size;
+        op->result.mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        sync_hex(d, op->result.sha);
+        strcpy(op->result.rsha, op->remote->sha);
+        op->ok = 1;
+    } else {
+        printf("DOWNLOAD %s FAILED: %s\n", op->remote->name, strerror(errno));
+        unlink(tmp);
+    }
+    return 0;
+}
+
+static void *sync_receiver(void *arg) {
+    sync_conn_t *sc = arg;
+    sync_run_t *run = sc->run;
+    lz = sc->lz;
+    char line[600];
+    while (recv_line(sc->sock, line, sizeof(line)) >= 0) {
+        size_t i, len;
+        int at = 0;
+        if (sscanf(line, "#%zu %n", &i, &at) != 1 || at == 0 || i >= run->n) break;
+        sync_op_t *op = &run->ops[i];
+        const char *reply = line + at;
+        if (op->kind == SYNC_DOWNLOAD && sscanf(reply, "DOWNLOAD %zu", &len) == 1) {
+            if (sync_receive_file(sc->sock, op, len) != 0) break;
+        } else if (op->kind == SYNC_UPLOAD && strcmp(reply, "UPLOAD OK") == 0) {
+            strcpy(op->result.rsha, op->result.sha);
+            op->ok = 1;
+        } else if (op->kind == SYNC_DELETE_REMOTE && strcmp(reply, "DELETE OK") == 0) {
+            op->ok = 1;
+        } else {
+            printf("%s: %s\n", op->local ? op->local->name : op->remote->name, reply);
+        }
+        sem_post(&sc->window);
+    }
+    atomic_store(&sc->dead, 1);
+    sem_post(&sc->window);
+    return NULL;
+}
+
+/* Carry the network ops over up to `parallel` connections, the first being sock */
+static void sync_transfer(int sock, sync_run_t *run) {
+    sync_conn_t conns[PARALLEL_MAX];
+    size_t want = (run->n + SYNC_WINDOW - 1) / SYNC_WINDOW;
+    int n = want < (size_t)parallel ? (int)want : parallel, started = 0;
+    int main_lz = lz;
+    for (int i = 0; i < n; ++i) {
+        sync_conn_t *sc = &conns[started];
+        sc->run = run;
+        sc->sock = i == 0 ? sock : server_connect(0);
+        sc->lz = lz;
+        atomic_init(&sc->dead, 0);
+        if (sc->sock < 0) continue;
+        sem_init(&sc->window, 0, SYNC_WINDOW);
+        if (pthread_create(&sc->receiver, NULL, sync_receiver, sc) != 0) {
+            sem_destroy(&sc->window);
+            if (i) close(sc->sock);
+            continue;
+        }
+        if (pthread_create(&sc->sender, NULL, sync_sender, sc) != 0) {
+            /* nothing will be sent: the receiver ends when the session does */
+            shutdown(sc->sock, SHUT_RDWR);
+            pthread_join(sc->receiver, NULL);
+            sem_destroy(&sc->window);
+            if (i) close(sc->sock);
+            continue;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(conns[i].sender, NULL);
+        pthread_join(conns[i].receiver, NULL);
+        sem_destroy(&conns[i].window);
+        if (conns[i].sock != sock) close(conns[i].sock);
+    }
+    lz = main_lz;
+}
+
+/* One sync pass of dir against the server; returns 0 if every change went through */
+static int sync_dir(const char *dir) {
+    struct timeval t0, t1;
+    gettimeofday(&t0, NULL);
+    if (chdir(dir) != 0) {
+        perror(dir);
+        return -1;
+    }
+    int sock = server_connect(0);
+    if (sock < 0) {
+        fprintf(stderr, "Cannot reach %s:%d\n", server_ip, server_port);
+        return -1;
+    }
+    sync_list_t known = { 0 }, local = { 0 }, remote = { 0 }, next = { 0 };
+    sync_op_t *ops = NULL;
+    size_t hashed = 0, nops = 0, counts[4] = { 0 }, failed = 0, same = 0;
+    int r = -1;
+    sync_manifest_load(&known);
+    if (sync_scan_local(&local, &known, &hashed) != 0 || sync_list_remote(sock, &remote) != 0) goto out;
+
+    /* walk the three sorted lists together, name by name */
+    ops = calloc(local.n + remote.n + 1, sizeof(sync_op_t));
+    if (!ops) goto out;
+    size_t a = 0, b = 0;
+    while (a < local.n || b < remote.n) {
+        int c = a == local.n ? 1 : b == remote.n ? -1 : strcmp(local.v[a].name, remote.v[b].name);
+        const sync_file_t *l = c <= 0 ? &local.v[a++] : NULL, *s = c >= 0 ? &remote.v[b++] : NULL;
+        const sync_file_t *k = sync_find(&known, l ? l->name : s->name);
+        int kind = sync_decide(l, s, k);
+        if (kind < 0) {
+            /* in step: record it as it stands */
+            if (l && s) {
+                sync_file_t *e = sync_add(&next, l->name);
+                if (!e) goto out;
+                e->size = l->size;
+                e->mtime = l->mtime;
+                strcpy(e->sha, l->sha);
+                strcpy(e->rsha, s->sha);
+            }
+            same++;
+            continue;
+        }
+        ops[nops++] = (sync_op_t){ .kind = (sync_kind_t)kind, .local = l, .remote = s, .known = k };
+    }
+    /* names gone on both sides need nothing; local deletes need no server */
+    sync_run_t run = { .ops = ops, .n = 0 };
+    for (size_t i = 0; i < nops; ++i) {
+        sync_op_t *op = &ops[i];
+        if (op->kind == SYNC_DELETE_LOCAL) {
+            op->ok = unlink(op->local->name) == 0 || errno == ENOENT;
+            if (!op->ok) printf("DELETE %s FAILED: %s\n", op->local->name, strerror(errno));
+        }
+    }
+    /* network ops first in ops[], so tags index them directly */
+    for (size_t i = 0; i < nops; ++i) {
+        if (ops[i].kind == SYNC_DELETE_LOCAL) continue;
+        sync_op_t tmp = ops[run.n];
+        ops[run.n++] = ops[i];
+        ops[i] = tmp;
+    }
+    atomic_init(&run.next, 0);
+    if (run.n) sync_transfer(sock, &run);
+    else send_all(sock, "BYE\n", 4);
+    close(sock);
+    sock = -1;
+
+    /* a failed op keeps its old manifest entry, so the next pass tries again */
+    for (size_t i = 0; i < nops; ++i) {
+        sync_op_t *op = &ops[i];
+        counts[op->kind] += op->ok;
+        failed += !op->ok;
+        const sync_file_t *keep = op->ok ? (op->kind == SYNC_UPLOAD || op->kind == SYNC_DOWNLOAD ? &op->result : NULL)
+                                         : op->known;
+        if (!keep) continue;
+        sync_file_t *e = sync_add(&next, op->local ? op->local->name : op->remote->name);
+        if (!e) goto out;
+        char *name = e->name;
+        *e = *keep;
+        e->name = name;
+    }
+    sync_sort(&next);
+    if (sync_manifest_save(&next) != 0) {
+        perror(SYNC_MANIFEST);
+        goto out;
+    }
+    gettimeofday(&t1, NULL);
+    printf("SYNC %s: %zu uploaded, %zu downloaded, %zu deleted on server, %zu deleted here, %zu unchanged, "
+           "%zu failed (%zu hashed, %.3f s)\n",
+           dir, counts[SYNC_UPLOAD], counts[SYNC_DOWNLOAD], counts[SYNC_DELETE_REMOTE], counts[SYNC_DELETE_LOCAL],
+           same, failed, hashed, (double)(t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6);
+    r = failed ? -1 : 0;
+out:
+    if (sock >= 0) close(sock);
+    free(ops);
+    sync_free(&known);
+    sync_free(&local);
+    sync_free(&remote);
+    sync_free(&next);
+    return r;
+}
+
+int main(int argc, char *argv[]) {
+    int bad = argc < 4;
+    const char *sync = NULL;
+    for (int i = 4; !bad && i < argc; ++i) {
+        if (strcmp(argv[i], "--no-compress") == 0) want_lz = 0;
+        else if (strcmp(argv[i], "--parallel") == 0 && i + 1 < argc) parallel = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc) sync = argv[++i];
+        else bad = 1;
+    }
+    if (bad || parallel < 1 || parallel > PARALLEL_MAX) {
+        fprintf(stderr, "Usage: %s <server_ip> <port> <username> [--no-compress] [--parallel <1-%d>] [--sync <dir>]\n",
+                argv[0], PARALLEL_MAX);
+        return 1;
+    }
+
+    server_ip = argv[1];
+    server_port = atoi(argv[2]);
+    username = argv[3];
+    if (sync) return sync_dir(sync) == 0 ? 0 : 1;
+
+    int sock = server_connect(1);
+    if (sock < 0) return 1;
 
     printf("Type commands (UPLOAD, DOWNLOAD, DELETE, LIST, BYE)\n");
 
@@ -116,42 +1171,55 @@ int main(int argc, char *argv[]) {
             if (!fgets(cmd, sizeof(cmd), stdin)) break;
 
             if (strncmp(cmd, "UPLOAD ", 7) == 0) {
-                char fname[512];
-                if (sscanf(cmd + 7, "%511s", fname) != 1) {
-                    printf("Syntax: UPLOAD <filename>\n");
+                char fname[512], rname[512];
+                int nf = sscanf(cmd + 7, "%511s %511s", fname, rname);
+                if (nf < 1) {
+                    printf("Syntax: UPLOAD <local file> [<remote name>]\n");
                     continue;
                 }
-                FILE *f = fopen(fname, "rb");
-                if (!f) {
-                    perror("fopen");
+                if (nf < 2) strcpy(rname, fname);
+                int fd = open(fname, O_RDONLY);
+                struct stat st;
+                if (fd < 0 || fstat(fd, &st) != 0) {
+                    perror("open");
+                    if (fd >= 0) close(fd);
                     continue;
                 }
-                fseek(f, 0, SEEK_END);
-                long len = ftell(f);
-                rewind(f);
-                void *data = malloc(len);
-                if (!data) {
-                    fclose(f);
-                    printf("No memory\n");
+                size_t len = (size_t)st.st_size;
+                /* the server may already hold an older version: send only the changes */
+                if (len >= DELTA_MIN_FILE && delta_upload(sock, rname, fd, len) == 0) {
+                    close(fd);
                     continue;
                 }
-                fread(data, 1, len, f);
-                fclose(f);
-
+                if (len >= RESUMABLE_MIN && resumable_upload(&sock, rname, fd, len) == 0) {
+                    close(fd);
+                    if (sock < 0) break;
+                    continue;
+                }
+                /* streamed from the file as it is sent, never held whole in memory */
                 char header[600];
-                int h = snprintf(header, sizeof(header), "UPLOAD %s %ld\n", fname, len);
-                send_all(sock, header, (size_t)h);
-                send_all(sock, data, (size_t)len);
-                free(data);
+                int h = snprintf(header, sizeof(header), "UPLOAD %s %zu\n", rname, len);
+                if (send_all(sock, header, (size_t)h) < 0 || send_file_range(sock, fd, 0, len) < 0) {
+                    printf("UPLOAD FAILED: connection lost\n");
+                }
+                close(fd);
             } 
             else if (strncmp(cmd, "DOWNLOAD ", 9) == 0) {
-                send_all(sock, cmd, strlen(cmd));
+                char fname[512], target[512];
+                int nf = sscanf(cmd + 9, "%511s %511s", fname, target);
+                if (nf < 1) {
+                    printf("Syntax: DOWNLOAD <remote name> [<local file>]\n");
+                    continue;
+                }
+                download_file(&sock, fname, nf < 2 ? fname : target);
+                if (sock < 0) break;
             } 
             else if (strncmp(cmd, "DELETE ", 7) == 0) {
                 send_all(sock, cmd, strlen(cmd));
             } 
             else if (strncmp(cmd, "LIST", 4) == 0) {
-                send_all(sock, "LIST\n", 5);
+                /* optional prefix, cursor and page size go through as typed */
+                send_all(sock, cmd, strlen(cmd));
             } 
             else if (strncmp(cmd, "BYE", 3) == 0) {
                 send_all(sock, "BYE\n", 4);
@@ -165,21 +1233,15 @@ int main(int argc, char *argv[]) {
         /* Check if message from server */
         if (FD_ISSET(sock, &readfds)) {
             char buf[1024];
-            ssize_t r = recv(sock, buf, sizeof(buf) - 1, 0);
+            ssize_t r = recv(sock, buf, sizeof(buf), 0);
             if (r <= 0) {
                 printf("Server closed connection.\n");
                 break;
             }
-            buf[r] = '\0';
-
-            /* Print safely without truncation warning */
-            char tmp[1025];
-            size_t len = strlen(buf);
-            if (len > sizeof(tmp) - 2) len = sizeof(tmp) - 2;
-            memcpy(tmp, buf, len);
-            tmp[len] = '\n';
-            tmp[len + 1] = '\0';
-            printf("%s", tmp);
+            /* replies may carry file bytes, NULs included: print them as they are */
+            fwrite(buf, 1, (size_t)r, stdout);
+            putchar('\n');
+            fflush(stdout);
         }
     }
 
@@ -1,47 +1,34 @@
 // client_queue.c
 #include "client_queue.h"
-#include <stdlib.h>
+#include <stdint.h>
 
+/* fds travel through the ring as pointer-sized integers */
 int cq_init(client_queue_t *q,int c){
-    q->items=malloc(sizeof(int)*c);
-    q->capacity=c;q->front=q->rear=q->size=0;q->closed=0;
-    pthread_mutex_init(&q->lock,NULL);
-    pthread_cond_init(&q->not_empty,NULL);
-    pthread_cond_init(&q->not_full,NULL);
-    return 0;
+    if(c<=0)return -1;
+    return mpmc_init(&q->ring,(size_t)c);
 }
 void cq_destroy(client_queue_t *q){
-    free(q->items);
-    pthread_mutex_destroy(&q->lock);
-    pthread_cond_destroy(&q->not_empty);
-    pthread_cond_destroy(&q->not_full);
+    mpmc_destroy(&q->ring);
 }
 int cq_push(client_queue_t *q,int s){
-    pthread_mutex_lock(&q->lock);
-    while(q->size==q->capacity&&!q->closed)
-        pthread_cond_wait(&q->not_full,&q->lock);
-    if(q->closed){pthread_mutex_unlock(&q->lock);return -1;}
-    q->items[q->rear]=s;
-    q->rear=(q->rear+1)%q->capacity;q->size++;
-    pthread_cond_signal(&q->not_empty);
-    pthread_mutex_unlock(&q->lock);
-    return 0;
+    return mpmc_push(&q->ring,(void*)(intptr_t)s);
 }
 int cq_pop(client_queue_t *q,int *s){
-    pthread_mutex_lock(&q->lock);
-    while(q->size==0&&!q->closed)
-        pthread_cond_wait(&q->not_empty,&q->lock);
-    if(q->size==0&&q->closed){pthread_mutex_unlock(&q->lock);return -1;}
-    *s=q->items[q->front];
-    q->front=(q->front+1)%q->capacity;q->size--;
-    pthread_cond_signal(&q->not_full);
-    pthread_mutex_unlock(&q->lock);
+    void *v;
+    if(mpmc_pop(&q->ring,&v)!=0)return -1;
+    *s=(int)(intptr_t)v;
     return 0;
 }
+/* non-blocking pop: -1 when the queue is currently empty */
+int cq_try_pop(client_queue_t *q,int *s){
+    void *v;
+    if(mpmc_try_pop(&q->ring,&v)!=0)return -1;
+    *s=(int)(intptr_t)v;
+    return 0;
+}
+size_t cq_size(client_queue_t *q){
+    return mpmc_size(&q->ring);
+}
 void cq_close(client_queue_t *q){
-    pthread_mutex_lock(&q->lock);
-    q->closed=1;
-    pthread_cond_broadcast(&q->not_empty);
-    pthread_cond_broadcast(&q->not_full);
-    pthread_mutex_unlock(&q->lock);
+    mpmc_close(&q->ring);
 }
@@ -0,0 +1,66 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * rsync-style delta uploads, shared by server and client.
+ *
+ * "SIGNATURES <name>" answers "SIGNATURES <bytes>" followed by the block
+ * size (u32) and, for every block of the stored file, its weak rolling
+ * checksum (u32) and the first DELTA_STRONG_LEN bytes of its SHA-256.
+ *
+ * "DELTA <name> <size> <bytes>" then uploads the new version as:
+ *   u32 block size, 32-byte SHA-256 of the new file, then ops
+ *   'L' u32 len <len bytes>            literal data
+ *   'C' u32 first u32 count            copy blocks [first, first+count) of the old file
+ * and is answered like UPLOAD. The server rebuilds the file from the
+ * version it holds now and refuses the result if the digest differs.
+ * Integers are big-endian.
+ */
+#define DELTA_BLOCK_MIN 2048
+#define DELTA_BLOCK_MAX (64 * 1024)
+#define DELTA_STRONG_LEN 16
+#define DELTA_SIG_LEN (4 + DELTA_STRONG_LEN)
+#define DELTA_HDR_LEN (4 + 32)
+#define DELTA_OP_LITERAL 'L'
+#define DELTA_OP_COPY 'C'
+
+static inline void delta_put32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static inline uint32_t delta_get32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* About sqrt(size), like rsync, so signatures and per-block overhead stay balanced */
+static inline size_t delta_block_size(size_t size) {
+    size_t b = DELTA_BLOCK_MIN;
+    while (b < DELTA_BLOCK_MAX && b * b < size) b *= 2;
+    return b;
+}
+
+/* Weak checksum: a = sum of bytes, b = sum of running a, both mod 2^16 */
+static inline uint32_t delta_weak(const unsigned char *p, size_t len) {
+    uint32_t a = 0, b = 0;
+    for (size_t i = 0; i < len; ++i) {
+        a += p[i];
+        b += a;
+    }
+    return (a & 0xffff) | (b << 16);
+}
+
+/* Slide a window of len bytes by one: drop `out`, append `in` */
+static inline uint32_t delta_roll(uint32_t weak, unsigned char out, unsigned char in, size_t len) {
+    uint32_t a = weak & 0xffff, b = weak >> 16;
+    a = (a - out + in) & 0xffff;
+    b = (b - (uint32_t)len * out + a) & 0xffff;
+    return a | (b << 16);
+}
+
+#endif // DELTA_H
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+#include "dirindex.h"
+#include "chunkstore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+
+/* FNV-1a */
+static unsigned di_hash(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+/* Entry for <root>/<user>/<name> as it is on disk now. Returns 1, 0 if
+ * it is not a regular file, -1 if out of memory. */
+static int di_read(const dir_index_t *x, const char *user, const char *name, di_file_t **out) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s/%s", x->root, user, name);
+    size_t len = strlen(name);
+    di_file_t *f = malloc(sizeof(di_file_t) + len + 1);
+    if (!f) return -1;
+    int r = cs_file_info(path, &f->size, f->digest, &f->mtime);
+    if (r < 0) {
+        free(f);
+        return 0;
+    }
+    f->has_digest = r == 0;
+    memcpy(f->name, name, len + 1);
+    *out = f;
+    return 1;
+}
+
+static int di_cmp(const void *a, const void *b) {
+    return strcmp((*(di_file_t *const *)a)->name, (*(di_file_t *const *)b)->name);
+}
+
+/* Index of the first file named >= key, or > key if after is set */
+static size_t di_search(const di_user_t *u, const char *key, int after) {
+    size_t lo = 0, hi = u->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(u->files[mid]->name, key);
+        if (c < 0 || (after && c == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int di_reserve(di_user_t *u, size_t n) {
+    if (n <= u->cap) return 0;
+    size_t cap = u->cap ? u->cap * 2 : 64;
+    while (cap < n) cap *= 2;
+    di_file_t **nf = realloc(u->files, cap * sizeof(*nf));
+    if (!nf) return -1;
+    u->files = nf;
+    u->cap = cap;
+    return 0;
+}
+
+/* One-time scan of <root>/<user>; subdirectories (upload staging) are skipped */
+static int di_scan(const dir_index_t *x, di_user_t *u) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", x->root, u->user);
+    DIR *d = opendir(path);
+    if (!d) return 0; /* nothing uploaded yet */
+    struct dirent *entry;
+    int r = 0;
+    while (r == 0 && (entry = readdir(d)) != NULL) {
+        di_file_t *f;
+        int got = di_read(x, u->user, entry->d_name, &f);
+        if (got == 0) continue;
+        if (got < 0 || di_reserve(u, u->n + 1) != 0) {
+            if (got > 0) free(f);
+            r = -1;
+            break;
+        }
+        u->files[u->n++] = f;
+    }
+    closedir(d);
+    if (u->n) qsort(u->files, u->n, sizeof(*u->files), di_cmp);
+    return r;
+}
+
+static void di_free_user(di_user_t *u) {
+    for (size_t i = 0; i < u->n; ++i) free(u->files[i]);
+    free(u->files);
+    free(u->user);
+    free(u);
+}
+
+/* Find the user's index, loading it if load is set; returns with the bucket locked */
+static di_user_t *di_lookup(dir_index_t *x, const char *user, int load, di_bucket_t **out_b) {
+    di_bucket_t *b = &x->buckets[di_hash(user) % DI_BUCKETS];
+    pthread_mutex_lock(&b->lock);
+    *out_b = b;
+    for (di_user_t *u = b->head; u; u = u->next) {
+        if (strcmp(u->user, user) == 0) return u;
+    }
+    if (!load) return NULL;
+    di_user_t *u = calloc(1, sizeof(di_user_t));
+    if (!u) return NULL;
+    u->user = strdup(user);
+    if (!u->user || di_scan(x, u) != 0) {
+        di_free_user(u);
+        return NULL;
+    }
+    u->next = b->head;
+    b->head = u;
+    return u;
+}
+
+/* Forget a user's index; the next listing scans the directory again */
+static void di_drop(di_bucket_t *b, di_user_t *u) {
+    for (di_user_t **pp = &b->head; *pp; pp = &(*pp)->next) {
+        if (*pp == u) {
+            *pp = u->next;
+            break;
+        }
+    }
+    di_free_user(u);
+}
+
+int di_init(dir_index_t *x, const char *root) {
+    x->root = strdup(root);
+    if (!x->root) return -1;
+    for (int i = 0; i < DI_BUCKETS; ++i) {
+        if (pthread_mutex_init(&x->buckets[i].lock, NULL) != 0) return -1;
+        x->buckets[i].head = NULL;
+    }
+    return 0;
+}
+
+void di_destroy(dir_index_t *x) {
+    if (!x) return;
+    for (int i = 0; i < DI_BUCKETS; ++i) {
+        di_user_t *u = x->buckets[i].head;
+        while (u) {
+            di_user_t *nx = u->next;
+            di_free_user(u);
+            u = nx;
+        }
+        pthread_mutex_destroy(&x->buckets[i].lock);
+    }
+    free(x->root);
+}
+
+void di_refresh(dir_index_t *x, const char *user, const char *name) {
+    di_bucket_t *b;
+    di_user_t *u = di_lookup(x, user, 0, &b);
+    if (u) {
+        /* read under the lock: of two racing refreshes the later one sees the final state */
+        di_file_t *f = NULL;
+        int got = di_read(x, user, name, &f);
+        size_t i = di_search(u, name, 0);
+        int found = i < u->n && strcmp(u->files[i]->name, name) == 0;
+        if (got < 0 || (got > 0 && !found && di_reserve(u, u->n + 1) != 0)) {
+            free(f);
+            di_drop(b, u);
+        } else if (got > 0 && found) {
+            free(u->files[i]);
+            u->files[i] = f;
+        } else if (got > 0) {
+            memmove(&u->files[i + 1], &u->files[i], (u->n - i) * sizeof(*u->files));
+            u->files[i] = f;
+            u->n++;
+        } else if (found) {
+            free(u->files[i]);
+            memmove(&u->files[i], &u->files[i + 1], (u->n - i - 1) * sizeof(*u->files));
+            u->n--;
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+int di_list(dir_index_t *x, const char *user, const char *prefix, const char *cursor,
+            size_t limit, int (*fn)(const di_file_t *f, void *arg), void *arg, int *more) {
+    di_bucket_t *b;
+    di_user_t *u = di_lookup(x, user, 1, &b);
+    int r = u ? 0 : -1;
+    *more = 0;
+    if (u) {
+        size_t i = di_search(u, prefix, 0), after = di_search(u, cursor, 1);
+        size_t plen = strlen(prefix);
+        if (after > i) i = after;
+        for (size_t k = 0; i < u->n && strncmp(u->files[i]->name, prefix, plen) == 0; ++i, ++k) {
+            if (k == limit) {
+                *more = 1;
+                break;
+            }
+            if (fn(u->files[i], arg) != 0) {
+                r = -1;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+    return r;
+}
@@ -0,0 +1,58 @@
+#ifndef DIRINDEX_H
+#define DIRINDEX_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include "sha256.h"
+
+#define DI_BUCKETS 256
+
+typedef struct {
+    size_t size;      // logical size (chunked files: content, not manifest)
+    time_t mtime;     // when the current version was published
+    int has_digest;   // plain files and older manifests carry none
+    unsigned char digest[SHA256_LEN];
+    char name[];
+} di_file_t;
+
+typedef struct di_user {
+    char *user;
+    di_file_t **files;  // sorted by name
+    size_t n, cap;
+    struct di_user *next;
+} di_user_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    di_user_t *head;
+} di_bucket_t;
+
+/*
+ * Per-user directory index: name, size, mtime and checksum of every file,
+ * sorted by name. A user's directory is scanned the first time it is
+ * listed; after that uploads and deletes keep the entries current, so
+ * LIST is a binary search plus a copy under one bucket lock.
+ */
+typedef struct {
+    char *root;       // storage root, users live in <root>/<user>
+    di_bucket_t buckets[DI_BUCKETS];
+} dir_index_t;
+
+int di_init(dir_index_t *x, const char *root);
+void di_destroy(dir_index_t *x);
+
+/* Re-read one file from disk after it was published or deleted. Users
+ * whose index is not loaded yet are left alone. */
+void di_refresh(dir_index_t *x, const char *user, const char *name);
+
+/*
+ * Call fn for up to limit files whose names start with prefix and sort
+ * after cursor ("" for the first page), in name order. *more is set if
+ * further matches follow. Stops early if fn fails; returns -1 then or if
+ * the index cannot be loaded.
+ */
+int di_list(dir_index_t *x, const char *user, const char *prefix, const char *cursor,
+            size_t limit, int (*fn)(const di_file_t *f, void *arg), void *arg, int *more);
+
+#endif // DIRINDEX_H
@@ -0,0 +1,176 @@
+#include "fcache.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* FNV-1a; low bits pick the shard, the rest the chain */
+static unsigned fc_hash(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static fc_shard_t *fc_shard(file_cache_t *c, unsigned h) {
+    return &c->shards[h % FC_SHARDS];
+}
+
+static fc_entry_t **fc_chain(fc_shard_t *s, unsigned h) {
+    return &s->table[(h / FC_SHARDS) % FC_BUCKETS];
+}
+
+static void fc_free(fc_entry_t *e) {
+    free(e->data);
+    free(e->key);
+    free(e);
+}
+
+static void fc_lru_unlink(fc_shard_t *s, fc_entry_t *e) {
+    if (e->prev) e->prev->next = e->next; else s->head = e->next;
+    if (e->next) e->next->prev = e->prev; else s->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void fc_lru_push(fc_shard_t *s, fc_entry_t *e) {
+    e->prev = NULL;
+    e->next = s->head;
+    if (s->head) s->head->prev = e; else s->tail = e;
+    s->head = e;
+}
+
+/* Take e out of the table; it lives on while downloads still hold it */
+static void fc_remove(fc_shard_t *s, unsigned h, fc_entry_t *e) {
+    for (fc_entry_t **pp = fc_chain(s, h); *pp; pp = &(*pp)->hnext) {
+        if (*pp == e) {
+            *pp = e->hnext;
+            break;
+        }
+    }
+    fc_lru_unlink(s, e);
+    e->cached = 0;
+    s->bytes -= e->len;
+    s->st.entries--;
+    if (e->refs == 0) fc_free(e);
+}
+
+static fc_entry_t *fc_find(fc_shard_t *s, unsigned h, const char *key) {
+    for (fc_entry_t *e = *fc_chain(s, h); e; e = e->hnext) {
+        if (strcmp(e->key, key) == 0) return e;
+    }
+    return NULL;
+}
+
+int fc_init(file_cache_t *c, size_t budget, size_t entry_max) {
+    c->shard_budget = budget / FC_SHARDS;
+    c->entry_max = entry_max < c->shard_budget ? entry_max : c->shard_budget;
+    for (int i = 0; i < FC_SHARDS; ++i) {
+        fc_shard_t *s = &c->shards[i];
+        memset(s, 0, sizeof(*s));
+        if (pthread_mutex_init(&s->lock, NULL) != 0) return -1;
+    }
+    return 0;
+}
+
+void fc_destroy(file_cache_t *c) {
+    if (!c) return;
+    for (int i = 0; i < FC_SHARDS; ++i) {
+        fc_shard_t *s = &c->shards[i];
+        fc_entry_t *e = s->head;
+        while (e) {
+            fc_entry_t *nx = e->next;
+            fc_free(e);
+            e = nx;
+        }
+        pthread_mutex_destroy(&s->lock);
+    }
+}
+
+fc_entry_t *fc_get(file_cache_t *c, const char *key, unsigned long *gen) {
+    unsigned h = fc_hash(key);
+    fc_shard_t *s = fc_shard(c, h);
+    pthread_mutex_lock(&s->lock);
+    fc_entry_t *e = fc_find(s, h, key);
+    if (e) {
+        e->refs++;
+        fc_lru_unlink(s, e);
+        fc_lru_push(s, e);
+        s->st.hits++;
+    } else {
+        s->st.misses++;
+    }
+    *gen = s->gen;
+    pthread_mutex_unlock(&s->lock);
+    return e;
+}
+
+fc_entry_t *fc_insert(file_cache_t *c, const char *key, unsigned long gen,
+                      unsigned char *data, size_t len) {
+    fc_entry_t *e = calloc(1, sizeof(fc_entry_t));
+    if (e) e->key = strdup(key);
+    if (!e || !e->key) {
+        free(e);
+        free(data);
+        return NULL;
+    }
+    e->data = data;
+    e->len = len;
+    e->refs = 1;
+    if (len > c->entry_max) return e; /* served once, never cached */
+
+    unsigned h = fc_hash(key);
+    fc_shard_t *s = fc_shard(c, h);
+    pthread_mutex_lock(&s->lock);
+    /* another miss may have filled it first; a newer version may have landed */
+    fc_entry_t *old = fc_find(s, h, key);
+    if (s->gen == gen && !old) {
+        while (s->tail && s->bytes + len > c->shard_budget) {
+            fc_remove(s, fc_hash(s->tail->key), s->tail);
+            s->st.evictions++;
+        }
+        e->cached = 1;
+        e->hnext = *fc_chain(s, h);
+        *fc_chain(s, h) = e;
+        fc_lru_push(s, e);
+        s->bytes += len;
+        s->st.inserts++;
+        s->st.entries++;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return e;
+}
+
+void fc_release(file_cache_t *c, fc_entry_t *e) {
+    if (!e) return;
+    fc_shard_t *s = fc_shard(c, fc_hash(e->key));
+    pthread_mutex_lock(&s->lock);
+    int last = --e->refs == 0 && !e->cached;
+    pthread_mutex_unlock(&s->lock);
+    if (last) fc_free(e);
+}
+
+void fc_invalidate(file_cache_t *c, const char *key) {
+    unsigned h = fc_hash(key);
+    fc_shard_t *s = fc_shard(c, h);
+    pthread_mutex_lock(&s->lock);
+    s->gen++;
+    fc_entry_t *e = fc_find(s, h, key);
+    if (e) {
+        fc_remove(s, h, e);
+        s->st.invalidations++;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+void fc_stats(file_cache_t *c, fc_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (int i = 0; i < FC_SHARDS; ++i) {
+        fc_shard_t *s = &c->shards[i];
+        pthread_mutex_lock(&s->lock);
+        out->hits += s->st.hits;
+        out->misses += s->st.misses;
+        out->inserts += s->st.inserts;
+        out->evictions += s->st.evictions;
+        out->invalidations += s->st.invalidations;
+        out->entries += s->st.entries;
+        out->bytes += s->bytes;
+        pthread_mutex_unlock(&s->lock);
+    }
+}
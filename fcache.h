@@ -0,0 +1,61 @@
+#ifndef FCACHE_H
+#define FCACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define FC_SHARDS 16
+#define FC_BUCKETS 256     // hash chains per shard
+
+typedef struct fc_entry {
+    char *key;              // "<user>/<name>"
+    unsigned char *data;
+    size_t len;
+    int refs;               // downloads sending from data
+    int cached;             // still in the table; freed once neither holds it
+    struct fc_entry *hnext; // hash chain
+    struct fc_entry *prev, *next; // LRU list, most recent first
+} fc_entry_t;
+
+typedef struct {
+    size_t hits, misses, inserts, evictions, invalidations;
+    size_t entries, bytes;
+} fc_stats_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    fc_entry_t *table[FC_BUCKETS];
+    fc_entry_t *head, *tail;
+    size_t bytes;
+    unsigned long gen;      // bumped by every invalidation
+    fc_stats_t st;
+} fc_shard_t;
+
+/*
+ * Server-wide cache of whole file contents for DOWNLOAD. Shards have their
+ * own lock, LRU list and share of the byte budget. Entries are reference
+ * counted, so concurrent downloads send from one copy and eviction or
+ * invalidation only frees it after the last of them is done.
+ */
+typedef struct {
+    size_t shard_budget;
+    size_t entry_max;       // larger files are not cached
+    fc_shard_t shards[FC_SHARDS];
+} file_cache_t;
+
+int fc_init(file_cache_t *c, size_t budget, size_t entry_max);
+void fc_destroy(file_cache_t *c);
+
+/* Referenced entry for key, or NULL on a miss; *gen is then passed to
+ * fc_insert so content read meanwhile is not cached over a newer version */
+fc_entry_t *fc_get(file_cache_t *c, const char *key, unsigned long *gen);
+/* Wrap data (malloc'd, now owned by the cache) in a referenced entry and
+ * cache it unless key was invalidated since fc_get. NULL if out of memory. */
+fc_entry_t *fc_insert(file_cache_t *c, const char *key, unsigned long gen,
+                      unsigned char *data, size_t len);
+void fc_release(file_cache_t *c, fc_entry_t *e);
+/* key was replaced or deleted: drop its entry */
+void fc_invalidate(file_cache_t *c, const char *key);
+void fc_stats(file_cache_t *c, fc_stats_t *out);
+
+#endif // FCACHE_H
@@ -0,0 +1,169 @@
+#include "lz.h"
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * LZ4 block format: sequences of
+ *   token (literal count << 4 | match length - 4), extra literal count
+ *   bytes, literals, u16 little-endian offset, extra match length bytes
+ * where a nibble of 15 continues in bytes of 255 until one is smaller.
+ * The last sequence has literals only.
+ */
+#define LZ_MIN_MATCH 4
+#define LZ_TAIL 5          /* last bytes always go out as literals */
+#define LZ_HASH_BITS 13
+#define LZ_SKIP_SHIFT 5    /* probe step grows by one every 32 misses */
+
+static uint32_t lz_read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static unsigned lz_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static unsigned char *lz_put_len(unsigned char *op, size_t len) {
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+/* Token, literals and (if mlen) the match; caller has checked the room */
+static unsigned char *lz_put_seq(unsigned char *op, const unsigned char *lit, size_t nlit,
+                                 size_t off, size_t mlen) {
+    unsigned char *token = op++;
+    *token = (unsigned char)((nlit < 15 ? nlit : 15) << 4);
+    if (nlit >= 15) op = lz_put_len(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if (!mlen) return op;
+    *op++ = (unsigned char)off;
+    *op++ = (unsigned char)(off >> 8);
+    mlen -= LZ_MIN_MATCH;
+    *token |= (unsigned char)(mlen < 15 ? mlen : 15);
+    if (mlen >= 15) op = lz_put_len(op, mlen - 15);
+    return op;
+}
+
+/* Worst-case size of a sequence */
+static size_t lz_seq_max(size_t nlit, size_t mlen) {
+    return 1 + nlit / 255 + 1 + nlit + 2 + mlen / 255 + 1;
+}
+
+size_t lz_compress(const void *src, size_t n, void *dst, size_t cap) {
+    const unsigned char *in = src, *ip = in, *anchor = in, *end = in + n;
+    unsigned char *op = dst, *oend = op + cap;
+    uint16_t table[1 << LZ_HASH_BITS]; /* offsets fit: blocks are at most 64 KB */
+    if (n > LZ_BLOCK_MAX) return 0;
+    memset(table, 0, sizeof(table));
+
+    if (n >= LZ_MIN_MATCH + LZ_TAIL) {
+        const unsigned char *limit = end - LZ_TAIL - LZ_MIN_MATCH;
+        unsigned misses = 0;
+        while (ip <= limit) {
+            uint32_t v = lz_read32(ip);
+            unsigned h = lz_hash(v);
+            const unsigned char *ref = in + table[h];
+            table[h] = (uint16_t)(ip - in);
+            if (ref >= ip || lz_read32(ref) != v) {
+                /* skip faster through data that does not match */
+                ip += 1 + (misses++ >> LZ_SKIP_SHIFT);
+                continue;
+            }
+            misses = 0;
+            const unsigned char *mp = ip + LZ_MIN_MATCH, *mr = ref + LZ_MIN_MATCH;
+            while (mp < end - LZ_TAIL && *mp == *mr) { mp++; mr++; }
+            while (ip > anchor && ref > in && ip[-1] == ref[-1]) { ip--; ref--; }
+            size_t nlit = (size_t)(ip - anchor), mlen = (size_t)(mp - ip);
+            if ((size_t)(oend - op) < lz_seq_max(nlit, mlen)) return 0;
+            op = lz_put_seq(op, anchor, nlit, (size_t)(ip - ref), mlen);
+            ip = anchor = mp;
+            if (ip <= limit) table[lz_hash(lz_read32(ip - 2))] = (uint16_t)(ip - 2 - in);
+        }
+    }
+    size_t nlit = (size_t)(end - anchor);
+    if ((size_t)(oend - op) < lz_seq_max(nlit, 0)) return 0;
+    op = lz_put_seq(op, anchor, nlit, 0, 0);
+    return (size_t)(op - (unsigned char *)dst);
+}
+
+static int lz_get_len(const unsigned char **ip, const unsigned char *iend, size_t *len) {
+    unsigned char b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+ssize_t lz_decompress(const void *src, size_t n, void *dst, size_t cap) {
+    const unsigned char *ip = src, *iend = ip + n;
+    unsigned char *op = dst, *ostart = op, *oend = op + cap;
+    while (ip < iend) {
+        unsigned token = *ip++;
+        size_t nlit = token >> 4;
+        if (nlit == 15 && lz_get_len(&ip, iend, &nlit) != 0) return -1;
+        if ((size_t)(iend - ip) < nlit || (size_t)(oend - op) < nlit) return -1;
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+        if (ip == iend) break; /* last sequence */
+        if (iend - ip < 2) return -1;
+        size_t off = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t mlen = token & 15;
+        if (mlen == 15 && lz_get_len(&ip, iend, &mlen) != 0) return -1;
+        mlen += LZ_MIN_MATCH;
+        if (off == 0 || off > (size_t)(op - ostart) || (size_t)(oend - op) < mlen) return -1;
+        const unsigned char *m = op - off;
+        if (off >= mlen) {
+            memcpy(op, m, mlen);
+        } else {
+            /* overlapping copy repeats the last off bytes */
+            for (size_t i = 0; i < mlen; ++i) op[i] = m[i];
+        }
+        op += mlen;
+    }
+    return (ssize_t)(op - ostart);
+}
+
+static void lz_put32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static uint32_t lz_get32(const unsigned char *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+size_t lz_frame(const void *src, size_t n, void *out) {
+    unsigned char *f = out;
+    /* must come out at least a byte shorter, or the block goes out stored */
+    size_t wire = lz_compress(src, n, f + LZ_FRAME_HDR, n - 1);
+    if (wire == 0) {
+        memcpy(f + LZ_FRAME_HDR, src, n);
+        wire = n;
+    }
+    lz_put32(f, (uint32_t)n);
+    lz_put32(f + 4, (uint32_t)wire);
+    return LZ_FRAME_HDR + wire;
+}
+
+int lz_frame_parse(const void *hdr, size_t *raw, size_t *wire) {
+    *raw = lz_get32(hdr);
+    *wire = lz_get32((const unsigned char *)hdr + 4);
+    return *raw == 0 || *raw > LZ_BLOCK_MAX || *wire == 0 || *wire > *raw ? -1 : 0;
+}
+
+int lz_unframe(const void *payload, size_t wire, void *dst, size_t raw) {
+    if (wire == raw) {
+        memcpy(dst, payload, raw);
+        return 0;
+    }
+    return lz_decompress(payload, wire, dst, raw) == (ssize_t)raw ? 0 : -1;
+}
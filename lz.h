@@ -0,0 +1,35 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Small LZ77 codec in the LZ4 block format, used for on-the-wire
+ * compression once a session has sent "COMPRESS lz".
+ *
+ * Bodies then travel as frames of at most LZ_BLOCK_MAX raw bytes:
+ *   u32 raw length, u32 payload length (big-endian), payload
+ * A payload as long as the raw data is stored as is; anything shorter is
+ * one compressed block. Blocks that do not shrink are always sent stored,
+ * so a frame is never larger than its data plus the header.
+ */
+#define LZ_BLOCK_MAX (64 * 1024)
+#define LZ_FRAME_HDR 8
+
+/* Compress n <= LZ_BLOCK_MAX bytes into dst; returns the compressed length,
+ * or 0 if it would not fit in cap bytes */
+size_t lz_compress(const void *src, size_t n, void *dst, size_t cap);
+/* Decode one block; returns the decoded length or -1 if the block is malformed
+ * or would not fit in cap bytes */
+ssize_t lz_decompress(const void *src, size_t n, void *dst, size_t cap);
+
+/* Build the frame for n bytes (1..LZ_BLOCK_MAX) in out, which has room for
+ * LZ_FRAME_HDR + n bytes. Returns the frame length. */
+size_t lz_frame(const void *src, size_t n, void *out);
+/* Parse a frame header; fails on lengths no valid frame has */
+int lz_frame_parse(const void *hdr, size_t *raw, size_t *wire);
+/* Decode a frame payload of wire bytes into exactly raw bytes at dst */
+int lz_unframe(const void *payload, size_t wire, void *dst, size_t raw);
+
+#endif // LZ_H
@@ -0,0 +1,130 @@
+#define _POSIX_C_SOURCE 200809L
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static _Atomic(mx_shard_t *) mx_head;
+static _Thread_local mx_shard_t *mx_self;
+
+/* Single writer: a relaxed load and store, no locked instruction */
+static inline void mx_add(_Atomic uint64_t *a, uint64_t n) {
+    atomic_store_explicit(a, atomic_load_explicit(a, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/* This thread's shard, registered on first use; NULL if out of memory */
+static mx_shard_t *mx_shard(void) {
+    if (mx_self) return mx_self;
+    mx_shard_t *s = calloc(1, sizeof(mx_shard_t));
+    if (!s) return NULL;
+    s->next = atomic_load(&mx_head);
+    while (!atomic_compare_exchange_weak(&mx_head, &s->next, s)) {
+    }
+    mx_self = s;
+    return s;
+}
+
+uint64_t mx_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void mx_count(mx_counter_t c, uint64_t n) {
+    mx_shard_t *s = mx_shard();
+    if (s) mx_add(&s->counters[c], n);
+}
+
+/* Values below MX_SUB get a bucket each; above, each power of two is cut in MX_SUB steps */
+static size_t mx_bucket(uint64_t v) {
+    if (v < MX_SUB) return (size_t)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e >= MX_EXP_MAX) return MX_BUCKETS - 1;
+    return (size_t)(e - MX_SUB_BITS + 1) * MX_SUB + ((v >> (e - MX_SUB_BITS)) & (MX_SUB - 1));
+}
+
+/* Highest value that falls in bucket i */
+static uint64_t mx_bucket_value(size_t i) {
+    if (i < MX_SUB) return i;
+    int e = (int)(i / MX_SUB) + MX_SUB_BITS - 1;
+    uint64_t lo = (uint64_t)(MX_SUB + i % MX_SUB) << (e - MX_SUB_BITS);
+    return lo + (1ull << (e - MX_SUB_BITS)) - 1;
+}
+
+static void mx_record(mx_hist_t *h, uint64_t v) {
+    mx_add(&h->count, 1);
+    mx_add(&h->sum, v);
+    if (v > atomic_load_explicit(&h->max, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max, v, memory_order_relaxed);
+    }
+    mx_add(&h->b[mx_bucket(v)], 1);
+}
+
+void mx_task(int op, int ok, uint64_t wait_ns, uint64_t service_ns) {
+    mx_shard_t *s = mx_shard();
+    if (!s || op < 0 || op >= MX_OPS) return;
+    mx_op_t *ops = atomic_load_explicit(&s->ops, memory_order_relaxed);
+    if (!ops) {
+        /* only worker threads record tasks, so reactors do not carry the histograms */
+        if (!(ops = calloc(MX_OPS, sizeof(mx_op_t)))) return;
+        atomic_store_explicit(&s->ops, ops, memory_order_release);
+    }
+    mx_op_t *o = &ops[op];
+    mx_add(ok ? &o->ok : &o->failed, 1);
+    mx_record(&o->wait, wait_ns);
+    mx_record(&o->service, service_ns);
+}
+
+static void mx_merge(mx_hist_snap_t *out, mx_hist_t *h) {
+    out->count += atomic_load_explicit(&h->count, memory_order_relaxed);
+    out->sum += atomic_load_explicit(&h->sum, memory_order_relaxed);
+    uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    if (max > out->max) out->max = max;
+    for (size_t i = 0; i < MX_BUCKETS; ++i) {
+        out->b[i] += atomic_load_explicit(&h->b[i], memory_order_relaxed);
+    }
+}
+
+void mx_snapshot(mx_snapshot_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (mx_shard_t *s = atomic_load_explicit(&mx_head, memory_order_acquire); s; s = s->next) {
+        for (int c = 0; c < MX_COUNTERS; ++c) {
+            out->counters[c] += atomic_load_explicit(&s->counters[c], memory_order_relaxed);
+        }
+        mx_op_t *ops = atomic_load_explicit(&s->ops, memory_order_acquire);
+        for (int i = 0; ops && i < MX_OPS; ++i) {
+            out->ops[i].ok += atomic_load_explicit(&ops[i].ok, memory_order_relaxed);
+            out->ops[i].failed += atomic_load_explicit(&ops[i].failed, memory_order_relaxed);
+            mx_merge(&out->ops[i].wait, &ops[i].wait);
+            mx_merge(&out->ops[i].service, &ops[i].service);
+        }
+    }
+}
+
+uint64_t mx_quantile(const mx_hist_snap_t *h, double q) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < MX_BUCKETS; ++i) total += h->b[i];
+    if (total == 0) return 0;
+    /* buckets are read one by one while writers go on, so count from what was seen */
+    uint64_t rank = (uint64_t)(q * (double)total + 0.5), seen = 0;
+    if (rank == 0) rank = 1;
+    for (size_t i = 0; i < MX_BUCKETS; ++i) {
+        seen += h->b[i];
+        if (seen >= rank) {
+            uint64_t v = mx_bucket_value(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void mx_destroy(void) {
+    mx_shard_t *s = atomic_exchange(&mx_head, NULL);
+    while (s) {
+        mx_shard_t *nx = s->next;
+        free(atomic_load(&s->ops));
+        free(s);
+        s = nx;
+    }
+    mx_self = NULL;
+}
@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MX_OPS 16          // operation kinds with latency histograms (task types)
+#define MX_SUB_BITS 5      // 32 linear steps per power of two: ~3% resolution
+#define MX_SUB (1 << MX_SUB_BITS)
+#define MX_EXP_MAX 40      // values up to 2^40 ns (~18 minutes)
+#define MX_BUCKETS ((MX_EXP_MAX - MX_SUB_BITS + 1) * MX_SUB)
+
+typedef enum {
+    MX_BYTES_IN,
+    MX_BYTES_OUT,
+    MX_SESSIONS_OPENED,
+    MX_SESSIONS_CLOSED,
+    MX_BUSY,            // requests turned away because the task queues were full
+    MX_THROTTLES,       // sessions paused by the bandwidth shaper
+    MX_THROTTLE_IN_NS,  // time those pauses held back receiving
+    MX_THROTTLE_OUT_NS, // and sending
+    MX_COUNTERS
+} mx_counter_t;
+
+/* Log-linear (HDR-style) histogram of nanosecond latencies */
+typedef struct {
+    _Atomic uint64_t count, sum, max;
+    _Atomic uint64_t b[MX_BUCKETS];
+} mx_hist_t;
+
+typedef struct {
+    _Atomic uint64_t ok, failed;
+    mx_hist_t wait;         // queued until a worker picked it up
+    mx_hist_t service;      // picked up until the reply was ready
+} mx_op_t;
+
+/* One thread's metrics; only that thread writes them */
+typedef struct mx_shard {
+    _Atomic uint64_t counters[MX_COUNTERS];
+    _Atomic(mx_op_t *) ops; // MX_OPS entries, allocated by the first mx_task
+    struct mx_shard *next;
+} mx_shard_t;
+
+/* Merged view of every thread, as plain numbers */
+typedef struct {
+    uint64_t count, sum, max;
+    uint64_t b[MX_BUCKETS];
+} mx_hist_snap_t;
+
+typedef struct {
+    uint64_t counters[MX_COUNTERS];
+    struct {
+        uint64_t ok, failed;
+        mx_hist_snap_t wait, service;
+    } ops[MX_OPS];
+} mx_snapshot_t;
+
+/*
+ * Server metrics. Every thread updates its own shard with relaxed atomic
+ * stores, so recording takes no lock and shares no cache line with other
+ * threads; readers sum the shards. Shards are registered once per thread
+ * and never freed before mx_destroy.
+ */
+uint64_t mx_now(void);     // monotonic clock, ns
+void mx_count(mx_counter_t c, uint64_t n);
+/* A task of kind op finished; ok is its outcome */
+void mx_task(int op, int ok, uint64_t wait_ns, uint64_t service_ns);
+
+/* Sum all shards into s */
+void mx_snapshot(mx_snapshot_t *s);
+/* Value at quantile q (0..1) of h, in ns; 0 if empty */
+uint64_t mx_quantile(const mx_hist_snap_t *h, double q);
+void mx_destroy(void);
+
+#endif // METRICS_H
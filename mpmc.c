@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+#include "mpmc.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define MPMC_SPIN 128 /* attempts before parking */
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+int mpmc_init(mpmc_t *q, size_t capacity) {
+    if (capacity == 0) return -1;
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    q->cells = malloc(cap * sizeof(mpmc_cell_t));
+    if (!q->cells) return -1;
+    for (size_t i = 0; i < cap; ++i) atomic_init(&q->cells[i].seq, i);
+    q->mask = cap - 1;
+    /* spinning only helps if the other side can run meanwhile */
+    q->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? MPMC_SPIN : 0;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->closed, 0);
+    atomic_init(&q->pop_waiters, 0);
+    atomic_init(&q->push_waiters, 0);
+    if (pthread_mutex_init(&q->park_lock, NULL) != 0) return -1;
+    if (pthread_cond_init(&q->not_empty, NULL) != 0) return -1;
+    if (pthread_cond_init(&q->not_full, NULL) != 0) return -1;
+    return 0;
+}
+
+void mpmc_destroy(mpmc_t *q) {
+    if (!q) return;
+    free(q->cells);
+    pthread_mutex_destroy(&q->park_lock);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+static int mpmc_enqueue(mpmc_t *q, void *v) {
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    mpmc_cell_t *cell;
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return -1; /* full */
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+    cell->val = v;
+    /* seq_cst so the waiter check in mpmc_wake cannot be hoisted above it */
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_seq_cst);
+    return 0;
+}
+
+static int mpmc_dequeue(mpmc_t *q, void **v) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    mpmc_cell_t *cell;
+    for (;;) {
+        cell = &q->cells[pos & q->mask];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        } else if (dif < 0) {
+            return -1; /* empty */
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+    *v = cell->val;
+    atomic_store_explicit(&cell->seq, pos + q->mask + 1, memory_order_seq_cst);
+    return 0;
+}
+
+/*
+ * Wake a parked thread, if any. The slot store before this is seq_cst and a
+ * parking thread fences after announcing itself, so either we see the
+ * waiter or it sees our slot.
+ */
+static void mpmc_wake(mpmc_t *q, _Atomic int *waiters, pthread_cond_t *cond) {
+    if (atomic_load_explicit(waiters, memory_order_seq_cst) == 0) return;
+    pthread_mutex_lock(&q->park_lock);
+    pthread_cond_signal(cond);
+    pthread_mutex_unlock(&q->park_lock);
+}
+
+int mpmc_try_push(mpmc_t *q, void *v) {
+    if (atomic_load_explicit(&q->closed, memory_order_acquire)) return -1;
+    if (mpmc_enqueue(q, v) != 0) return -1;
+    mpmc_wake(q, &q->pop_waiters, &q->not_empty);
+    return 0;
+}
+
+int mpmc_try_pop(mpmc_t *q, void **v) {
+    if (mpmc_dequeue(q, v) != 0) return -1;
+    mpmc_wake(q, &q->push_waiters, &q->not_full);
+    return 0;
+}
+
+int mpmc_push(mpmc_t *q, void *v) {
+    for (int i = 0; i < q->spin; ++i) {
+        if (atomic_load_explicit(&q->closed, memory_order_acquire)) return -1;
+        if (mpmc_try_push(q, v) == 0) return 0;
+        cpu_relax();
+    }
+    if (mpmc_try_push(q, v) == 0) return 0;
+    int ret = -1;
+    atomic_fetch_add(&q->push_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    pthread_mutex_lock(&q->park_lock);
+    while (!atomic_load(&q->closed)) {
+        if (mpmc_enqueue(q, v) == 0) { ret = 0; break; }
+        pthread_cond_wait(&q->not_full, &q->park_lock);
+    }
+    pthread_mutex_unlock(&q->park_lock);
+    atomic_fetch_sub(&q->push_waiters, 1);
+    if (ret == 0) mpmc_wake(q, &q->pop_waiters, &q->not_empty);
+    return ret;
+}
+
+int mpmc_pop(mpmc_t *q, void **v) {
+    for (int i = 0; i < q->spin; ++i) {
+        if (mpmc_try_pop(q, v) == 0) return 0;
+        if (atomic_load_explicit(&q->closed, memory_order_acquire)) break;
+        cpu_relax();
+    }
+    if (mpmc_try_pop(q, v) == 0) return 0;
+    int ret = -1;
+    atomic_fetch_add(&q->pop_waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    pthread_mutex_lock(&q->park_lock);
+    for (;;) {
+        if (mpmc_dequeue(q, v) == 0) { ret = 0; break; }
+        if (atomic_load(&q->closed)) break;
+        pthread_cond_wait(&q->not_empty, &q->park_lock);
+    }
+    pthread_mutex_unlock(&q->park_lock);
+    atomic_fetch_sub(&q->pop_waiters, 1);
+    if (ret == 0) mpmc_wake(q, &q->push_waiters, &q->not_full);
+    return ret;
+}
+
+void mpmc_close(mpmc_t *q) {
+    pthread_mutex_lock(&q->park_lock);
+    atomic_store(&q->closed, 1);
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->park_lock);
+}
+
+size_t mpmc_size(mpmc_t *q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    return head > tail ? head - tail : 0;
+}
@@ -0,0 +1,47 @@
+#ifndef MPMC_H
+#define MPMC_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define MPMC_CACHELINE 64
+
+typedef struct {
+    _Atomic size_t seq;   // ticket of the operation allowed to use the slot next
+    void *val;
+} mpmc_cell_t;
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer ring (sequence-numbered
+ * slots, after Vyukov). Blocking push/pop spin briefly and then park on a
+ * condvar; the lock is only touched when a thread actually has to sleep.
+ */
+typedef struct {
+    mpmc_cell_t *cells;
+    size_t mask;          // capacity - 1, capacity is a power of two
+    int spin;             // attempts before parking (0 on uniprocessors)
+    _Alignas(MPMC_CACHELINE) _Atomic size_t head;   // next enqueue ticket
+    _Alignas(MPMC_CACHELINE) _Atomic size_t tail;   // next dequeue ticket
+    _Alignas(MPMC_CACHELINE) _Atomic int closed;
+    _Atomic int pop_waiters;
+    _Atomic int push_waiters;
+    pthread_mutex_t park_lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} mpmc_t;
+
+/* capacity is rounded up to a power of two */
+int mpmc_init(mpmc_t *q, size_t capacity);
+void mpmc_destroy(mpmc_t *q);
+/* 0 on success, -1 if full/empty (or closed for push) */
+int mpmc_try_push(mpmc_t *q, void *v);
+int mpmc_try_pop(mpmc_t *q, void **v);
+/* blocking variants: -1 once the queue is closed (pop: closed and drained) */
+int mpmc_push(mpmc_t *q, void *v);
+int mpmc_pop(mpmc_t *q, void **v);
+void mpmc_close(mpmc_t *q);
+/* approximate number of queued items */
+size_t mpmc_size(mpmc_t *q);
+
+#endif // MPMC_H
@@ -0,0 +1,75 @@
+#define _POSIX_C_SOURCE 200809L
+#include "netbuf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+
+int nb_init(netbuf_t *b, size_t initial, size_t max) {
+    if (initial == 0 || initial > max) return -1;
+    b->buf = malloc(initial);
+    if (!b->buf) return -1;
+    b->cap = initial;
+    b->start = b->end = b->scanned = 0;
+    b->max = max;
+    return 0;
+}
+
+void nb_destroy(netbuf_t *b) {
+    if (!b) return;
+    free(b->buf);
+    b->buf = NULL;
+    b->cap = b->start = b->end = b->scanned = 0;
+}
+
+/* Make room at the tail: slide data to the front, then grow up to max */
+static int nb_reserve(netbuf_t *b) {
+    if (b->end < b->cap) return 0;
+    if (b->start > 0) {
+        memmove(b->buf, b->buf + b->start, b->end - b->start);
+        b->end -= b->start;
+        b->start = 0;
+        if (b->end < b->cap) return 0;
+    }
+    if (b->cap >= b->max) return -1;
+    size_t cap = b->cap * 2 > b->max ? b->max : b->cap * 2;
+    char *nb = realloc(b->buf, cap);
+    if (!nb) return -1;
+    b->buf = nb;
+    b->cap = cap;
+    return 0;
+}
+
+ssize_t nb_fill(netbuf_t *b, int fd) {
+    if (b->start == b->end) b->start = b->end = 0;
+    if (nb_reserve(b) != 0) { errno = EMSGSIZE; return -1; }
+    ssize_t n;
+    do {
+        n = recv(fd, b->buf + b->end, b->cap - b->end, 0);
+    } while (n < 0 && errno == EINTR);
+    if (n > 0) b->end += (size_t)n;
+    return n;
+}
+
+char *nb_getline(netbuf_t *b, size_t *len) {
+    char *p = b->buf + b->start;
+    char *nl = memchr(p + b->scanned, '\n', nb_len(b) - b->scanned);
+    if (!nl) {
+        b->scanned = nb_len(b);
+        return NULL;
+    }
+    *nl = '\0';
+    if (len) *len = (size_t)(nl - p);
+    b->start += (size_t)(nl - p) + 1;
+    b->scanned = 0;
+    return p;
+}
+
+size_t nb_take(netbuf_t *b, void *dst, size_t n) {
+    size_t avail = nb_len(b);
+    if (n > avail) n = avail;
+    memcpy(dst, b->buf + b->start, n);
+    b->start += n;
+    b->scanned = b->scanned > n ? b->scanned - n : 0;
+    return n;
+}
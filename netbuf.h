@@ -0,0 +1,44 @@
+#ifndef NETBUF_H
+#define NETBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Per-connection input buffer. Bytes are read from the socket in large
+ * chunks and handed out as complete lines or raw payload, so pipelined
+ * commands already received cost no further syscalls.
+ */
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t start;     // first unconsumed byte
+    size_t end;       // one past the last buffered byte
+    size_t scanned;   // bytes after start already searched for '\n'
+    size_t max;       // capacity limit, i.e. the longest line accepted
+} netbuf_t;
+
+int nb_init(netbuf_t *b, size_t initial, size_t max);
+void nb_destroy(netbuf_t *b);
+
+/* One recv() into the free space. Returns bytes read, 0 on EOF, -1 on error
+ * (errno set; EMSGSIZE when the buffer is full at its limit). */
+ssize_t nb_fill(netbuf_t *b, int fd);
+
+/* Next complete line with '\n' replaced by NUL, or NULL if none is buffered.
+ * The pointer stays valid until the next nb_fill. */
+char *nb_getline(netbuf_t *b, size_t *len);
+
+/* Move up to n buffered bytes into dst; returns the number moved */
+size_t nb_take(netbuf_t *b, void *dst, size_t n);
+
+static inline size_t nb_len(const netbuf_t *b) { return b->end - b->start; }
+
+/* Buffered bytes in place (nb_len of them) and dropping them once parsed */
+static inline const char *nb_peek(const netbuf_t *b) { return b->buf + b->start; }
+static inline void nb_skip(netbuf_t *b, size_t n) {
+    b->start += n;
+    b->scanned = b->scanned > n ? b->scanned - n : 0;
+}
+
+#endif // NETBUF_H
@@ -0,0 +1,76 @@
+#ifndef PROTO_V2_H
+#define PROTO_V2_H
+
+#include <stdint.h>
+
+/*
+ * Binary protocol v2, selected with "HELLO <username> v2" (server answers
+ * "AUTH OK v2"). After that every request and reply is one frame:
+ *
+ *   off size field
+ *   0   1    opcode
+ *   1   1    flags        V2_F_RESPONSE on replies
+ *   2   2    status       replies: V2_ST_OK or V2_ST_ERROR
+ *   4   4    request id   echoed in the reply; replies may come out of order
+ *   8   4    header len   requests: file name; error replies: message text
+ *   12  4    reserved
+ *   16  8    payload len  UPLOAD body, DOWNLOAD data, LIST names
+ *
+ * followed by the header bytes and then the payload. Integers are big-endian.
+ */
+#define V2_HDR_LEN 24
+#define V2_MAX_HDR 511          /* longest file name / message */
+
+enum {
+    V2_OP_LIST = 1,
+    V2_OP_UPLOAD = 2,
+    V2_OP_DOWNLOAD = 3,
+    V2_OP_DELETE = 4,
+    V2_OP_BYE = 5
+};
+
+#define V2_F_RESPONSE 0x01
+
+#define V2_ST_OK 0
+#define V2_ST_ERROR 1
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t status;
+    uint32_t id;
+    uint32_t hdr_len;
+    uint64_t payload_len;
+} v2_frame_t;
+
+static inline void v2_put32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)(v >> 24); p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8); p[3] = (unsigned char)v;
+}
+
+static inline uint32_t v2_get32(const unsigned char *p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void v2_encode(unsigned char out[V2_HDR_LEN], const v2_frame_t *f) {
+    out[0] = f->opcode;
+    out[1] = f->flags;
+    out[2] = (unsigned char)(f->status >> 8);
+    out[3] = (unsigned char)f->status;
+    v2_put32(out + 4, f->id);
+    v2_put32(out + 8, f->hdr_len);
+    v2_put32(out + 12, 0);
+    v2_put32(out + 16, (uint32_t)(f->payload_len >> 32));
+    v2_put32(out + 20, (uint32_t)f->payload_len);
+}
+
+static inline void v2_decode(const unsigned char in[V2_HDR_LEN], v2_frame_t *f) {
+    f->opcode = in[0];
+    f->flags = in[1];
+    f->status = (uint16_t)((in[2] << 8) | in[3]);
+    f->id = v2_get32(in + 4);
+    f->hdr_len = v2_get32(in + 8);
+    f->payload_len = ((uint64_t)v2_get32(in + 16) << 32) | v2_get32(in + 20);
+}
+
+#endif // PROTO_V2_H
@@ -0,0 +1,148 @@
+#define _POSIX_C_SOURCE 200809L
+#include "quota.h"
+#include "chunkstore.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+/* FNV-1a */
+static unsigned quota_hash(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+/* One-time scan of <root>/<user>; subdirectories (upload staging) are skipped */
+static size_t quota_scan(const quota_table_t *q, const char *user) {
+    size_t total = 0;
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", q->root, user);
+    DIR *d = opendir(path);
+    if (!d) return 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        char fpath[768];
+        snprintf(fpath, sizeof(fpath), "%s/%s", path, entry->d_name);
+        size_t size;
+        if (cs_file_size(fpath, &size) == 0) total += size;
+    }
+    closedir(d);
+    return total;
+}
+
+/* Find (or load) the user's entry; returns with the bucket locked */
+static quota_entry_t *quota_lookup(quota_table_t *q, const char *user, quota_bucket_t **out_b) {
+    quota_bucket_t *b = &q->buckets[quota_hash(user) % QUOTA_BUCKETS];
+    pthread_mutex_lock(&b->lock);
+    *out_b = b;
+    for (quota_entry_t *e = b->head; e; e = e->next) {
+        if (strcmp(e->user, user) == 0) return e;
+    }
+    quota_entry_t *e = calloc(1, sizeof(quota_entry_t));
+    if (!e) return NULL;
+    e->user = strdup(user);
+    if (!e->user) { free(e); return NULL; }
+    e->used = quota_scan(q, user);
+    e->next = b->head;
+    b->head = e;
+    return e;
+}
+
+int quota_init(quota_table_t *q, const char *root, size_t limit) {
+    q->root = strdup(root);
+    if (!q->root) return -1;
+    q->limit = limit;
+    for (int i = 0; i < QUOTA_BUCKETS; ++i) {
+        if (pthread_mutex_init(&q->buckets[i].lock, NULL) != 0) return -1;
+        q->buckets[i].head = NULL;
+    }
+    return 0;
+}
+
+void quota_destroy(quota_table_t *q) {
+    if (!q) return;
+    for (int i = 0; i < QUOTA_BUCKETS; ++i) {
+        quota_entry_t *e = q->buckets[i].head;
+        while (e) {
+            quota_entry_t *nx = e->next;
+            free(e->user);
+            free(e);
+            e = nx;
+        }
+        pthread_mutex_destroy(&q->buckets[i].lock);
+    }
+    free(q->root);
+}
+
+int quota_reserve(quota_table_t *q, const char *user, size_t bytes, size_t replaced) {
+    quota_bucket_t *b;
+    quota_entry_t *e = quota_lookup(q, user, &b);
+    int ret = -1;
+    if (e) {
+        /* the replaced file only frees space once the upload is published */
+        size_t base = e->used + e->reserved;
+        base = base > replaced ? base - replaced : 0;
+        if (bytes <= q->limit && base <= q->limit - bytes) {
+            e->reserved += bytes;
+            ret = 0;
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+    return ret;
+}
+
+void quota_release(quota_table_t *q, const char *user, size_t bytes) {
+    quota_bucket_t *b;
+    quota_entry_t *e = quota_lookup(q, user, &b);
+    if (e) e->reserved = e->reserved > bytes ? e->reserved - bytes : 0;
+    pthread_mutex_unlock(&b->lock);
+}
+
+int quota_publish(quota_table_t *q, const char *user, size_t bytes,
+                  const char *src, const char *dst, const char *retired) {
+    quota_bucket_t *b;
+    quota_entry_t *e = quota_lookup(q, user, &b);
+    int ret = -1;
+    if (e) {
+        e->reserved = e->reserved > bytes ? e->reserved - bytes : 0;
+        /* stat + rename under the lock so racing overwrites see each other */
+        size_t old;
+        int had = cs_file_size(dst, &old) == 0;
+        if (!had) old = 0;
+        /* keep the replaced file reachable so the caller can release what it holds */
+        int kept = had && retired;
+        if ((!kept || link(dst, retired) == 0) && rename(src, dst) == 0) {
+            e->used = e->used > old ? e->used - old : 0;
+            e->used += bytes;
+            ret = 0;
+        } else if (kept) {
+            unlink(retired);
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+    return ret;
+}
+
+int quota_unlink(quota_table_t *q, const char *user, const char *path, const char *retired) {
+    quota_bucket_t *b;
+    quota_entry_t *e = quota_lookup(q, user, &b);
+    size_t size;
+    int ret = -1;
+    if (cs_file_size(path, &size) == 0 && (retired ? rename(path, retired) : unlink(path)) == 0) {
+        if (e) e->used = e->used > size ? e->used - size : 0;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&b->lock);
+    return ret;
+}
+
+size_t quota_usage(quota_table_t *q, const char *user) {
+    quota_bucket_t *b;
+    quota_entry_t *e = quota_lookup(q, user, &b);
+    size_t used = e ? e->used : 0;
+    pthread_mutex_unlock(&b->lock);
+    return used;
+}
@@ -0,0 +1,49 @@
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define QUOTA_BUCKETS 256
+
+typedef struct quota_entry {
+    char *user;
+    size_t used;      // logical bytes of published files
+    size_t reserved;  // bytes promised to uploads still in flight
+    struct quota_entry *next;
+} quota_entry_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    quota_entry_t *head;
+} quota_bucket_t;
+
+/*
+ * Per-user storage accounting. A user's usage is loaded from disk the first
+ * time they are seen and maintained incrementally afterwards; every check or
+ * update is a hash lookup under one bucket lock.
+ */
+typedef struct {
+    char *root;       // storage root, users live in <root>/<user>
+    size_t limit;     // per-user quota in bytes
+    quota_bucket_t buckets[QUOTA_BUCKETS];
+} quota_table_t;
+
+int quota_init(quota_table_t *q, const char *root, size_t limit);
+void quota_destroy(quota_table_t *q);
+
+/* Reserve room for an upload of `bytes` that replaces a file of `replaced`
+ * bytes. Returns -1 if that would exceed the quota. */
+int quota_reserve(quota_table_t *q, const char *user, size_t bytes, size_t replaced);
+/* Drop a reservation whose upload was abandoned */
+void quota_release(quota_table_t *q, const char *user, size_t bytes);
+/* Rename a staged upload of `bytes` (reserved earlier) over dst and charge
+ * the difference to the file it replaces. If retired is set, the replaced
+ * file is hard-linked there first so the caller can release what it holds. */
+int quota_publish(quota_table_t *q, const char *user, size_t bytes,
+                  const char *src, const char *dst, const char *retired);
+/* Unlink path (or move it to retired) and credit its size back to user */
+int quota_unlink(quota_table_t *q, const char *user, const char *path, const char *retired);
+size_t quota_usage(quota_table_t *q, const char *user);
+
+#endif // QUOTA_H
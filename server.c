@@ -5,40 +5,168 @@
 #include <unistd.h>
 #include <string.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
+#include <time.h>
+#include <stdarg.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
 #include <dirent.h>
 
 #include "client_queue.h"
 #include "task_queue.h"
+#include "worker_pool.h"
+#include "quota.h"
+#include "chunkstore.h"
+#include "dirindex.h"
+#include "fcache.h"
+#include "versions.h"
+#include "sio.h"
+#include "metrics.h"
+#include "shaper.h"
+#include "delta.h"
+#include "lz.h"
+#include "netbuf.h"
+#include "proto_v2.h"
 
 #define DEFAULT_PORT 9000
-#define BACKLOG 16
+#define BACKLOG 1024
 #define CLIENT_QUEUE_CAP 128
-#define CLIENT_POOL_SIZE 4
-#define TASK_QUEUE_CAP 128
+#define MAX_REACTORS 64
+#define REACTOR_MAX_EVENTS 256
+#define CONN_INBUF 4096            /* initial input buffer */
+#define CONN_LINE_MAX (64 * 1024)  /* longest command line accepted */
+#define CONN_INBUF_MAX (CONN_LINE_MAX + LZ_FRAME_HDR) /* also holds a whole LZ frame */
+#define CONN_MAX_INFLIGHT 64       /* tagged requests outstanding per session */
+#define UPLOAD_CHUNK (64 * 1024) /* per-upload staging buffer */
+#define SENDFILE_CHUNK (1024 * 1024) /* cap per sendfile() call for fairness */
+#define COPY_CHUNK (64 * 1024)       /* read/send fallback buffer */
+#define TASK_QUEUE_CAP 128 /* per worker and lane; one user may fill half */
+#define BUSY_REPLY "SERVER BUSY 100\n" /* queues full: retry in 100 ms */
 #define WORKER_POOL_SIZE 4
 #define USER_QUOTA_BYTES (10 * 1024 * 1024) /* 10 MB */
+#define PARTIAL_TTL (24 * 60 * 60) /* seconds an idle resumable upload is kept */
+#define MULTIPART_MAX_PARTS 10000  /* parts one multipart upload may be cut into */
+#define MULTIPART_PART_MIN (64 * 1024) /* smallest part size, unless one part holds the file */
+#define LIST_PAGE 1000             /* LIST entries per reply unless a limit is given */
+#define LIST_PAGE_MAX 10000
+#define FILE_CACHE_BYTES (64 * 1024 * 1024) /* hot download contents, all users */
+#define FILE_CACHE_ENTRY_MAX (4 * 1024 * 1024) /* larger files are streamed from disk */
+#define STATS_POLL_MS 100          /* stats dump thread checks for shutdown this often */
+#define VERSION_TTL 60             /* seconds a replaced version is kept, unless --retain */
+#define VERSION_SWEEP_MAX 60       /* every user's versions are swept at least this often (s) */
+
+/* Session state machine driven by the owning reactor */
+typedef enum {
+    CONN_HELLO,        /* waiting for HELLO <username> */
+    CONN_CMD,          /* waiting for a command line */
+    CONN_UPLOAD_BODY,  /* receiving UPLOAD payload */
+    CONN_WAIT_TASK     /* untagged task handed to the worker pool */
+} conn_state_t;
+
+struct reactor;
+
+typedef struct conn {
+    int fd;                   /* -1 once closed (freed at end of loop pass) */
+    conn_state_t state;
+    int closing;              /* peer gone or I/O error: close now */
+    int hangup;               /* close once every reply has been sent */
+    struct reactor *r;
+    struct conn *prev, *next; /* reactor's live (or dead) list */
+    char username[256];
+    int v2;                   /* binary framing negotiated at HELLO */
+    int lz;                   /* COMPRESS lz: file bodies travel in LZ frames */
+    netbuf_t in;              /* unparsed input, may hold pipelined commands */
+    task_t *up;               /* UPLOAD or DELTA being received */
+    size_t up_len;            /* body bytes expected (the delta itself for DELTA) */
+    size_t up_got;            /* body bytes received so far */
+    int up_fd;                /* staged temp file (up->src_path), -1 if none */
+    size_t up_pos;            /* offset in up_fd of the next staged write */
+    char *up_buf;             /* UPLOAD_CHUNK bytes waiting to be written */
+    size_t up_buf_len;
+    const char *up_err;       /* upload failed: drain the body, then reply this */
+    int up_reserved;          /* quota reserved for up->data_len */
+    int up_keep;              /* resumable part: the staged file is shared, never unlink it here */
+    int up_lz;                /* body arrives in LZ frames */
+    char *out;                /* reply header being sent */
+    size_t out_len, out_off, out_cap;
+    task_t *tx;               /* task whose resp->data, fd or chunks are being sent */
+    size_t tx_off;
+    int tx_copy;              /* sendfile unsupported for tx: use read/send */
+    size_t tx_chunk;          /* chunked download: index of the chunk being sent */
+    size_t tx_chunk_off;      /* bytes of that chunk already sent */
+    int tx_blob;              /* its open blob, -1 between chunks */
+    unsigned char *tx_frame;  /* compressed download: frame being sent */
+    size_t tx_frame_len, tx_frame_off;
+    int wblocked;             /* socket buffer full: wait for EPOLLOUT */
+    task_t *txq_head;         /* finished tasks whose replies are queued */
+    task_t *txq_tail;
+    int txq_len;
+    int inflight;             /* tasks outstanding on the worker pool */
+    sh_user_t *shape;         /* the user's bandwidth buckets, NULL if users are not limited */
+    uint64_t throttle_until;  /* paused by the shaper until then (mx_now), 0 if not */
+    int throttle_in;          /* the pause is on receiving: leave input unread */
+    struct conn *throttle_next; /* reactor's paused list */
+} conn_t;
+
+typedef struct reactor {
+    int epfd;
+    int evfd;                 /* wakeups: new sockets, completed tasks */
+    pthread_t thread;
+    client_queue_t inbox;     /* accepted sockets handed over by main */
+    _Atomic(task_t *) done_head; /* tasks completed by workers (LIFO, lock-free push) */
+    conn_t *conns;
+    conn_t *dead;
+    conn_t *throttled;        /* sessions paused by the shaper, resumed by the epoll timeout */
+} reactor_t;
 
 static int listen_fd = -1;
-static client_queue_t client_q;
-static pthread_t client_threads[CLIENT_POOL_SIZE];
+static reactor_t reactors[MAX_REACTORS];
+static int num_reactors = 0;
 static volatile int running = 1;
 
-static task_queue_t task_q;
+static worker_pool_t pool;
 static pthread_t worker_threads[WORKER_POOL_SIZE];
+static pthread_t stats_thread;
+static pthread_t sweep_thread;
+static int sweeping;           /* sweep_thread was started */
+static int stats_interval;     /* seconds between dumps to stderr, 0 = none */
+static const char *admin_user; /* --admin: the one user STATS answers, NULL = none */
+static time_t started;
+static quota_table_t quota;
+static chunk_store_t store;
+static dir_index_t dindex;
+static file_cache_t fcache;
+static version_store_t versions;
+static shaper_t shaper;
+
+static void reactor_wake(reactor_t *r) {
+    uint64_t one = 1;
+    ssize_t n = write(r->evfd, &one, sizeof(one));
+    (void)n;
+}
 
 static void handle_sigint(int signo) {
     (void)signo;
     running = 0;
-    cq_close(&client_q);
-    tq_close(&task_q);
+    for (int i = 0; i < num_reactors; ++i) {
+        cq_close(&reactors[i].inbox);
+        reactor_wake(&reactors[i]);
+    }
+    wp_close(&pool);
     if (listen_fd != -1) close(listen_fd);
 }
 
-/* Ensure storage/<username> exists */
+/* Ensure storage/<username> and its upload staging dir exist */
 static int ensure_user_dir(const char *username) {
     char path[512];
     snprintf(path, sizeof(path), "storage/%s", username);
@@ -49,392 +177,1943 @@ static int ensure_user_dir(const char *username) {
     if (stat(path, &st) == -1) {
         if (mkdir(path, 0755) != 0) return -1;
     }
+    snprintf(path, sizeof(path), "storage/%s/.incoming", username);
+    if (stat(path, &st) == -1) {
+        if (mkdir(path, 0755) != 0) return -1;
+    }
+    snprintf(path, sizeof(path), "storage/%s/.partial", username);
+    if (stat(path, &st) == -1) {
+        if (mkdir(path, 0755) != 0) return -1;
+    }
+    snprintf(path, sizeof(path), "storage/%s/" CS_VERSIONS_DIR, username);
+    if (stat(path, &st) == -1) {
+        if (mkdir(path, 0755) != 0) return -1;
+    }
     return 0;
 }
 
-/* Compute total bytes used by a user (safe: uses stat on entries) */
-static size_t compute_user_usage(const char *username) {
-    size_t total = 0;
-    char path[512];
-    snprintf(path, sizeof(path), "storage/%s", username);
-    DIR *d = opendir(path);
-    if (!d) return 0;
-    struct dirent *entry;
-    while ((entry = readdir(d)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
-        char fpath[768];
-        snprintf(fpath, sizeof(fpath), "%s/%s", path, entry->d_name);
-        struct stat st_entry;
-        if (stat(fpath, &st_entry) != 0) continue;
-        if (!S_ISREG(st_entry.st_mode)) continue;
-        total += (size_t)st_entry.st_size;
-    }
-    closedir(d);
-    return total;
+/*
+ * Create a temp file for an upload in storage/<user>/.incoming. Being a
+ * subdirectory it is skipped by LIST and usage scans until it is renamed
+ * into place. Returns the fd; the path is written to out_path.
+ */
+static int upload_stage_open(const char *username, char out_path[TASK_PATH_MAX]) {
+    snprintf(out_path, TASK_PATH_MAX, "storage/%s/.incoming/XXXXXX", username);
+    int fd = mkstemp(out_path);
+    if (fd < 0) out_path[0] = '\0';
+    return fd;
 }
 
 /* Worker helpers */
 
-static int worker_handle_upload(task_t *t) {
-    if (ensure_user_dir(t->username) != 0) return -1;
-    size_t used = compute_user_usage(t->username);
-    if (used + t->data_len > USER_QUOTA_BYTES) return -2;
-    char path[1024];
+/* A user file was replaced or removed: refresh its index entry, drop cached contents */
+static void file_changed(const task_t *t) {
+    char key[TASK_NAME_MAX + TASK_PATH_MAX];
+    snprintf(key, sizeof(key), "%s/%s", t->username, t->filename);
+    fc_invalidate(&fcache, key);
+    di_refresh(&dindex, t->username, t->filename);
+}
+
+/*
+ * Move a fully received file into the chunk store and publish its
+ * manifest as the file's next version; its quota was reserved when the
+ * upload started. Chunking runs unlocked; only writing the manifest and
+ * the rename hold the file's version lock, and readers never take it. The
+ * version replaced is kept in .versions for downloads that still use it.
+ */
+static int worker_publish(task_t *t, const char *staged) {
+    char path[1024], manifest[TASK_PATH_MAX], retired[1024];
+    cs_file_t f;
+    int r = -1;
+    int src = open(staged, O_RDONLY);
+    if (src >= 0) {
+        r = cs_chunk_file(&store, src, &f);
+        close(src);
+        if (r == 0 && f.size != t->data_len) {
+            cs_file_free(&store, &f, 1);
+            r = -1;
+        }
+    }
+    unlink(staged);
+    int mfd = r == 0 ? upload_stage_open(t->username, manifest) : -1;
+    if (mfd < 0) {
+        if (r == 0) cs_file_free(&store, &f, 1);
+        quota_release(&quota, t->username, t->data_len);
+        return -1;
+    }
     snprintf(path, sizeof(path), "storage/%s/%s", t->username, t->filename);
-    FILE *f = fopen(path, "wb");
-    if (!f) return -1;
-    size_t written = fwrite(t->data, 1, t->data_len, f);
-    fclose(f);
-    if (written != t->data_len) return -1;
+
+    vs_lock(&versions, t->username, t->filename);
+    unsigned long current;
+    unsigned long version = vs_next(&versions, t->username, t->filename, &current);
+    r = cs_write_manifest(mfd, &f, version);
+    close(mfd);
+    cs_file_free(&store, &f, r != 0);
+    if (r == 0) {
+        vs_path(&versions, t->username, t->filename, current, retired, sizeof(retired));
+        if (!retired[0]) snprintf(retired, sizeof(retired), "%s.old", manifest);
+        r = quota_publish(&quota, t->username, t->data_len, manifest, path, retired);
+        if (r != 0) cs_drop_file(&store, manifest);
+    } else {
+        unlink(manifest);
+        quota_release(&quota, t->username, t->data_len);
+    }
+    vs_unlock(&versions, t->username, t->filename);
+    if (r != 0) return -1;
+
+    if (versions.ttl == 0) cs_drop_file(&store, retired);
+    vs_sweep(&versions, &store, t->username);
+    file_changed(t);
     return 0;
 }
 
-static int worker_handle_download(task_t *t, void **out_buf, size_t *out_len) {
-    char path[1024];
+static int worker_handle_upload(task_t *t) {
+    return worker_publish(t, t->src_path);
+}
+
+/* Drop the chunk references a download held while it was being sent */
+static void download_unpin(task_t *t) {
+    cs_unpin(&store, t->resp.data, t->resp.nchunks);
+    t->resp.nchunks = 0;
+}
+
+static void download_uncache(task_t *t) {
+    fc_release(&fcache, t->resp.cached);
+    t->resp.cached = NULL;
+}
+
+/* Bytes [off, off + len) of a file of size bytes, or fail with BAD RANGE */
+static int download_range(task_t *t, size_t size, size_t *off, size_t *len) {
+    *off = 0;
+    *len = size;
+    if (!t->ranged) return 0;
+    if (t->range_off > size) {
+        t->resp.msg = "DOWNLOAD FAILED: BAD RANGE\n";
+        return -1;
+    }
+    *off = t->range_off;
+    *len = size - *off;
+    if (t->range_len && t->range_len < *len) *len = t->range_len;
+    return 0;
+}
+
+/*
+ * Read a whole file small enough for the cache and add it. NULL if it is
+ * too big or unreadable; the caller then streams it from disk.
+ */
+static fc_entry_t *download_fill(const char *path, const char *key, unsigned long gen) {
+    size_t size;
+    if (cs_file_size(path, &size) != 0 || size > fcache.entry_max) return NULL;
+    unsigned char *buf = malloc(size ? size : 1);
+    cs_reader_t r;
+    if (!buf || cs_reader_open(&store, &r, path) != 0) {
+        free(buf);
+        return NULL;
+    }
+    /* the file may have been replaced since the size was read */
+    ssize_t got = r.size == size ? cs_reader_pread(&r, buf, size, 0) : -1;
+    cs_reader_close(&r);
+    if (got != (ssize_t)size) {
+        free(buf);
+        return NULL;
+    }
+    return fc_insert(&fcache, key, gen, buf, size);
+}
+
+/* Serve from a cache entry; the reactor sends straight out of it */
+static int download_cached(task_t *t, fc_entry_t *e) {
+    size_t off, len;
+    if (download_range(t, e->len, &off, &len) != 0) {
+        fc_release(&fcache, e);
+        return -1;
+    }
+    t->resp.cached = e;
+    t->resp.offset = off;
+    t->resp.data_len = len;
+    t->resp.total = e->len;
+    t->on_release = download_uncache;
+    return 0;
+}
+
+/*
+ * Load the file's chunk list, pinning the chunks so a concurrent DELETE or
+ * overwrite cannot remove them mid-transfer; the reactor streams them with
+ * sendfile(). Files stored before the chunk store are sent as they are.
+ */
+static int worker_handle_download(task_t *t) {
+    char path[1024], key[TASK_NAME_MAX + TASK_PATH_MAX];
     snprintf(path, sizeof(path), "storage/%s/%s", t->username, t->filename);
-    FILE *f = fopen(path, "rb");
-    if (!f) return -1;
-    if (fseek(f, 0, SEEK_END) != 0) { fclose(f); return -1; }
-    long len = ftell(f);
-    if (len < 0) { fclose(f); return -1; }
-    rewind(f);
-    *out_len = (size_t)len;
-    *out_buf = malloc(*out_len ? *out_len : 1);
-    if (!*out_buf) { fclose(f); return -1; }
-    size_t r = fread(*out_buf, 1, *out_len, f);
-    fclose(f);
-    if (r != *out_len) { free(*out_buf); *out_buf = NULL; *out_len = 0; return -1; }
+    snprintf(key, sizeof(key), "%s/%s", t->username, t->filename);
+    unsigned long gen;
+    fc_entry_t *e = fc_get(&fcache, key, &gen);
+    if (!e) e = download_fill(path, key, gen);
+    if (e) return download_cached(t, e);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) { close(fd); return -1; }
+    task_response_t *resp = &t->resp;
+    size_t n = 0, size = 0;
+    int r = cs_load(fd, &resp->data, &resp->data_cap, &n, &size);
+    if (r == 1) size = (size_t)st.st_size;
+    else close(fd);
+    if (r < 0) return -1;
+
+    size_t off, len;
+    if (download_range(t, size, &off, &len) != 0) {
+        if (r == 1) close(fd);
+        return -1;
+    }
+    resp->total = size;
+    resp->data_len = len;
+    if (r == 1) {
+        resp->fd = fd;
+        resp->offset = off;
+        return 0;
+    }
+    /* keep only the chunks the range touches */
+    cs_ref_t *refs = resp->data;
+    size_t first = 0, end, covered = 0;
+    while (first < n && off >= refs[first].len) off -= refs[first++].len;
+    for (end = first; end < n && covered < off + len; ++end) covered += refs[end].len;
+    memmove(refs, refs + first, (end - first) * sizeof(cs_ref_t));
+    n = end - first;
+    if (cs_pin(&store, refs, n) != 0) return -1;
+    resp->nchunks = n;
+    resp->offset = off;
+    t->on_release = download_unpin;
     return 0;
 }
 
+/* The deleted file is kept as a version, like a replaced one */
 static int worker_handle_delete(task_t *t) {
+    char path[1024], retired[1024];
+    snprintf(path, sizeof(path), "storage/%s/%s", t->username, t->filename);
+    vs_lock(&versions, t->username, t->filename);
+    unsigned long current;
+    vs_next(&versions, t->username, t->filename, &current);
+    vs_path(&versions, t->username, t->filename, current, retired, sizeof(retired));
+    int r = current ? 0 : -1;
+    if (r == 0 && !retired[0]) {
+        /* reserve a name to move the file to, then drop its chunks from there */
+        int fd = upload_stage_open(t->username, retired);
+        if (fd < 0) r = -1;
+        else close(fd);
+    }
+    if (r == 0 && quota_unlink(&quota, t->username, path, retired) != 0) {
+        if (versions.ttl == 0) unlink(retired);
+        r = -1;
+    }
+    vs_unlock(&versions, t->username, t->filename);
+    if (r != 0) return -1;
+
+    if (versions.ttl == 0) cs_drop_file(&store, retired);
+    vs_sweep(&versions, &store, t->username);
+    file_changed(t);
+    return 0;
+}
+
+static int resp_append(task_t *t, const char *src, size_t len) {
+    if (task_resp_reserve(t, t->resp.data_len + len) != 0) return -1;
+    memcpy((char *)t->resp.data + t->resp.data_len, src, len);
+    t->resp.data_len += len;
+    return 0;
+}
+
+typedef struct {
+    task_t *t;
+    char last[TASK_PATH_MAX];  /* cursor for the next page */
+} list_page_t;
+
+/* One LIST line: "<name> <size> <mtime> <sha256 or ->" */
+static int list_line(const di_file_t *f, void *arg) {
+    list_page_t *pg = arg;
+    char line[TASK_PATH_MAX + 2 * SHA256_LEN + 64], sum[2 * SHA256_LEN + 1] = "-";
+    if (f->has_digest) {
+        for (int i = 0; i < SHA256_LEN; ++i) snprintf(sum + 2 * i, 3, "%02x", f->digest[i]);
+    }
+    int n = snprintf(line, sizeof(line), "%s %zu %lld %s\n", f->name, f->size, (long long)f->mtime, sum);
+    snprintf(pg->last, sizeof(pg->last), "%s", f->name);
+    return resp_append(pg->t, line, (size_t)n);
+}
+
+/*
+ * Served from the directory index. A full page ends with "/NEXT <cursor>":
+ * no file name holds a '/', so the line cannot be taken for an entry.
+ */
+static int worker_handle_list(task_t *t) {
+    list_page_t pg = { .t = t };
+    int more;
+    if (di_list(&dindex, t->username, t->filename, t->src_path, t->list_limit, list_line, &pg, &more) != 0) {
+        return -1;
+    }
+    if (!more) return 0;
+    char line[TASK_PATH_MAX + 8];
+    int n = snprintf(line, sizeof(line), "/NEXT %s\n", pg.last);
+    return resp_append(t, line, (size_t)n);
+}
+
+/* Per-block weak and strong checksums of the stored file, for DELTA */
+static int worker_handle_signatures(task_t *t) {
     char path[1024];
     snprintf(path, sizeof(path), "storage/%s/%s", t->username, t->filename);
-    if (unlink(path) != 0) return -1;
+    cs_reader_t rd;
+    if (cs_reader_open(&store, &rd, path) != 0) return -1;
+    size_t block = delta_block_size(rd.size);
+    size_t nblocks = (rd.size + block - 1) / block;
+    unsigned char *buf = malloc(block);
+    int r = buf && task_resp_reserve(t, 4 + nblocks * DELTA_SIG_LEN) == 0 ? 0 : -1;
+    if (r == 0) {
+        unsigned char *out = t->resp.data;
+        delta_put32(out, (uint32_t)block);
+        out += 4;
+        for (size_t off = 0; off < rd.size; off += block, out += DELTA_SIG_LEN) {
+            size_t len = rd.size - off < block ? rd.size - off : block;
+            unsigned char strong[SHA256_LEN];
+            if (cs_reader_pread(&rd, buf, len, off) != (ssize_t)len) { r = -1; break; }
+            delta_put32(out, delta_weak(buf, len));
+            sha256(buf, len, strong);
+            memcpy(out + 4, strong, DELTA_STRONG_LEN);
+        }
+        t->resp.data_len = r == 0 ? 4 + nblocks * DELTA_SIG_LEN : 0;
+    }
+    free(buf);
+    cs_reader_close(&rd);
+    return r;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
     return 0;
 }
 
-static int worker_handle_list(task_t *t, char **out_text, size_t *out_len) {
-    char path[512];
-    snprintf(path, sizeof(path), "storage/%s", t->username);
-    DIR *d = opendir(path);
-    if (!d) {
-        *out_text = strdup("(no files)\n");
-        *out_len = strlen(*out_text);
-        return 0;
+/* Apply the ops of a staged delta to the current file, writing the result to out */
+static int delta_apply(FILE *in, cs_reader_t *base, int out, size_t limit) {
+    unsigned char hdr[DELTA_HDR_LEN], buf[COPY_CHUNK];
+    if (fread(hdr, 1, sizeof(hdr), in) != sizeof(hdr)) return -1;
+    size_t block = delta_get32(hdr);
+    if (block < DELTA_BLOCK_MIN || block > DELTA_BLOCK_MAX) return -1;
+    sha256_t h;
+    sha256_init(&h);
+    size_t total = 0;
+    int op;
+    while ((op = fgetc(in)) != EOF) {
+        unsigned char arg[8];
+        size_t off, len;
+        if (op == DELTA_OP_LITERAL) {
+            if (fread(arg, 1, 4, in) != 4) return -1;
+            off = 0;
+            len = delta_get32(arg);
+        } else if (op == DELTA_OP_COPY) {
+            if (fread(arg, 1, 8, in) != 8) return -1;
+            off = (size_t)delta_get32(arg) * block;
+            len = (size_t)delta_get32(arg + 4) * block;
+            if (off >= base->size) return -1;
+            if (len > base->size - off) len = base->size - off;
+        } else {
+            return -1;
+        }
+        if (len > limit - total) return -1;
+        while (len > 0) {
+            size_t n = len < sizeof(buf) ? len : sizeof(buf);
+            if (op == DELTA_OP_LITERAL ? fread(buf, 1, n, in) != n
+                                       : cs_reader_pread(base, buf, n, off) != (ssize_t)n) return -1;
+            if (write_full(out, buf, n) != 0) return -1;
+            sha256_update(&h, buf, n);
+            off += n;
+            len -= n;
+            total += n;
+        }
+    }
+    unsigned char digest[SHA256_LEN];
+    sha256_final(&h, digest);
+    return total == limit && memcmp(digest, hdr + 4, SHA256_LEN) == 0 ? 0 : -1;
+}
+
+/* Rebuild the new version from the staged delta and publish it like an upload */
+static int worker_handle_delta(task_t *t) {
+    char path[1024], staged[TASK_PATH_MAX];
+    snprintf(path, sizeof(path), "storage/%s/%s", t->username, t->filename);
+    int r = -1;
+    int out = upload_stage_open(t->username, staged);
+    FILE *in = fopen(t->src_path, "rb");
+    cs_reader_t base;
+    if (out >= 0 && in && cs_reader_open(&store, &base, path) == 0) {
+        r = delta_apply(in, &base, out, t->data_len);
+        cs_reader_close(&base);
+    }
+    if (in) fclose(in);
+    unlink(t->src_path);
+    if (out >= 0) close(out);
+    if (r != 0) {
+        if (out >= 0) unlink(staged);
+        quota_release(&quota, t->username, t->data_len);
+        return -1;
+    }
+    return worker_publish(t, staged);
+}
+
+/* Reply with a line built at run time; conn_emit sends resp.data when msg is unset */
+static int resp_printf(task_t *t, const char *fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    if ((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+    t->resp.data_len = 0;
+    t->resp.msg = NULL;
+    return resp_append(t, line, (size_t)n);
+}
+
+_Static_assert(TASK_TYPES <= MX_OPS, "every task type needs a histogram slot");
+
+static const char *const task_names[TASK_TYPES] = {
+    [TASK_LIST] = "LIST",
+    [TASK_UPLOAD] = "UPLOAD",
+    [TASK_DOWNLOAD] = "DOWNLOAD",
+    [TASK_DELETE] = "DELETE",
+    [TASK_SIGNATURES] = "SIGNATURES",
+    [TASK_DELTA] = "DELTA",
+    [TASK_UPLOAD_INIT] = "UPLOAD-INIT",
+    [TASK_UPLOAD_PART] = "UPLOAD-PART",
+    [TASK_UPLOAD_STATUS] = "UPLOAD-STATUS",
+    [TASK_STATS] = "STATS"
+};
+
+typedef int (*stats_emit_fn)(void *arg, const char *line, size_t len);
+
+static int stats_line(stats_emit_fn emit, void *arg, const char *fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    return emit(arg, line, n < (int)sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+static int stats_latency(stats_emit_fn emit, void *arg, const char *what, int op, const mx_hist_snap_t *h) {
+    return stats_line(emit, arg, "%s %s mean=%.1f p50=%.1f p90=%.1f p99=%.1f p999=%.1f max=%.1f\n",
+                      what, task_names[op], h->count ? h->sum / 1e3 / h->count : 0.0,
+                      mx_quantile(h, 0.5) / 1e3, mx_quantile(h, 0.9) / 1e3, mx_quantile(h, 0.99) / 1e3,
+                      mx_quantile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+/*
+ * Text of STATS and of the periodic dump: one "<name> <value>" line per
+ * counter and gauge, then for every task type that ran its outcomes and
+ * its queue wait and service time in microseconds.
+ */
+static int stats_render(stats_emit_fn emit, void *arg) {
+    mx_snapshot_t *s = malloc(sizeof(mx_snapshot_t));
+    if (!s) return -1;
+    mx_snapshot(s);
+    fc_stats_t fc;
+    fc_stats(&fcache, &fc);
+    size_t client_q = 0;
+    for (int i = 0; i < num_reactors; ++i) client_q += cq_size(&reactors[i].inbox);
+    uint64_t opened = s->counters[MX_SESSIONS_OPENED], closed = s->counters[MX_SESSIONS_CLOSED];
+
+    int r = stats_line(emit, arg, "uptime_s %lld\n", (long long)(time(NULL) - started));
+    r |= stats_line(emit, arg, "sessions_active %llu\n", (unsigned long long)(opened > closed ? opened - closed : 0));
+    r |= stats_line(emit, arg, "sessions_total %llu\n", (unsigned long long)opened);
+    r |= stats_line(emit, arg, "bytes_in %llu\n", (unsigned long long)s->counters[MX_BYTES_IN]);
+    r |= stats_line(emit, arg, "bytes_out %llu\n", (unsigned long long)s->counters[MX_BYTES_OUT]);
+    r |= stats_line(emit, arg, "client_q %zu\n", client_q);
+    r |= stats_line(emit, arg, "task_q %zu\n", wp_size(&pool));
+    r |= stats_line(emit, arg, "busy %llu\n", (unsigned long long)s->counters[MX_BUSY]);
+    r |= stats_line(emit, arg, "throttles %llu\nthrottle_in_ms %llu\nthrottle_out_ms %llu\n",
+                    (unsigned long long)s->counters[MX_THROTTLES],
+                    (unsigned long long)(s->counters[MX_THROTTLE_IN_NS] / 1000000),
+                    (unsigned long long)(s->counters[MX_THROTTLE_OUT_NS] / 1000000));
+    r |= stats_line(emit, arg, "cache_hits %zu\ncache_misses %zu\ncache_entries %zu\ncache_bytes %zu\n",
+                    fc.hits, fc.misses, fc.entries, fc.bytes);
+    for (int op = 0; op < TASK_TYPES; ++op) {
+        if (s->ops[op].ok + s->ops[op].failed == 0) continue;
+        r |= stats_line(emit, arg, "op %s ok=%llu failed=%llu\n", task_names[op],
+                        (unsigned long long)s->ops[op].ok, (unsigned long long)s->ops[op].failed);
+        r |= stats_latency(emit, arg, "wait_us", op, &s->ops[op].wait);
+        r |= stats_latency(emit, arg, "service_us", op, &s->ops[op].service);
     }
-    size_t cap = 1024;
-    char *buf = malloc(cap);
-    if (!buf) { closedir(d); return -1; }
-    buf[0] = '\0';
-    size_t len = 0;
+    free(s);
+    return r ? -1 : 0;
+}
+
+static int stats_to_task(void *arg, const char *line, size_t len) {
+    return resp_append(arg, line, len);
+}
+
+static int stats_to_file(void *arg, const char *line, size_t len) {
+    return fwrite(line, 1, len, arg) == len ? 0 : -1;
+}
+
+/* --stats-interval: dump the STATS text to stderr every few seconds */
+static void *stats_fn(void *arg) {
+    (void)arg;
+    struct timespec poll = { 0, STATS_POLL_MS * 1000000L };
+    long waited = 0;
+    while (running) {
+        nanosleep(&poll, NULL);
+        waited += STATS_POLL_MS;
+        if (waited < stats_interval * 1000L) continue;
+        waited = 0;
+        fprintf(stderr, "--- stats ---\n");
+        stats_render(stats_to_file, stderr);
+        fflush(stderr);
+    }
+    return NULL;
+}
+
+/*
+ * Publishes and deletes sweep their own user's versions; this catches the
+ * users who have gone quiet, so nothing is kept much past --retain.
+ */
+static void *sweep_fn(void *arg) {
+    (void)arg;
+    struct timespec poll = { 0, STATS_POLL_MS * 1000000L };
+    long every = (versions.ttl < VERSION_SWEEP_MAX ? (long)versions.ttl : VERSION_SWEEP_MAX) * 1000L;
+    long waited = 0;
+    while (running) {
+        nanosleep(&poll, NULL);
+        waited += STATS_POLL_MS;
+        if (waited < every) continue;
+        waited = 0;
+        vs_sweep_all(&versions, &store);
+    }
+    return NULL;
+}
+
+/*
+ * storage/<user>/.partial/<token> holds the bytes, <token>.meta "<size> <name>"
+ * or, for a multipart upload, "<size> <name> <part size>". A multipart upload
+ * also has <token>.parts, one '0' or '1' per part for whether it has arrived.
+ */
+static void partial_path(char *out, size_t len, const char *user, const char *token, const char *suffix) {
+    snprintf(out, len, "storage/%s/.partial/%s%s", user, token, suffix);
+}
+
+/* Read a resumable upload's meta: total size, file name and part size (0 for sequential parts) */
+static int partial_meta(const char *user, const char *token, size_t *total, char name[TASK_PATH_MAX],
+                        size_t *part_size) {
+    char meta[TASK_PATH_MAX + 32];
+    if (token[strspn(token, "0123456789abcdef")] != '\0') return -1;
+    partial_path(meta, sizeof(meta), user, token, ".meta");
+    FILE *m = fopen(meta, "r");
+    if (!m) return -1;
+    *part_size = 0;
+    int n = fscanf(m, "%zu %511s %zu", total, name, part_size);
+    fclose(m);
+    return n >= 2 ? 0 : -1;
+}
+
+/* Forget resumable uploads that have not received a part for PARTIAL_TTL */
+static void partial_sweep(const char *user) {
+    char dir[512];
+    snprintf(dir, sizeof(dir), "storage/%s/.partial", user);
+    DIR *d = opendir(dir);
+    if (!d) return;
+    time_t now = time(NULL);
     struct dirent *entry;
     while ((entry = readdir(d)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
-        char fpath[768];
-        snprintf(fpath, sizeof(fpath), "%s/%s", path, entry->d_name);
-        struct stat st_entry;
-        if (stat(fpath, &st_entry) != 0) continue;
-        if (!S_ISREG(st_entry.st_mode)) continue;
-        char line[512];
-        snprintf(line, sizeof(line), "%s\n", entry->d_name);
-        size_t l = strlen(line);
-        if (len + l + 1 > cap) {
-            cap *= 2;
-            char *nb = realloc(buf, cap);
-            if (!nb) { free(buf); closedir(d); return -1; }
-            buf = nb;
-        }
-        memcpy(buf + len, line, l);
-        len += l;
-        buf[len] = '\0';
+        if (entry->d_name[0] == '.' || strchr(entry->d_name, '.')) continue; /* metas go with their data */
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (stat(path, &st) != 0 || now - st.st_mtime < PARTIAL_TTL) continue;
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%s.meta", dir, entry->d_name);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%s.parts", dir, entry->d_name);
+        unlink(path);
     }
     closedir(d);
-    *out_text = buf;
-    *out_len = len;
+}
+
+static size_t partial_part_count(size_t total, size_t part) {
+    return total ? (total + part - 1) / part : 1;
+}
+
+/* A multipart upload starts with every part missing */
+static int partial_parts_create(task_t *t, const char *token) {
+    char path[1024];
+    size_t count = partial_part_count(t->data_len, t->part_size);
+    char *zeros = malloc(count);
+    if (!zeros) return -1;
+    memset(zeros, '0', count);
+    partial_path(path, sizeof(path), t->username, token, ".parts");
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    int r = fd >= 0 && write_full(fd, zeros, count) == 0 ? 0 : -1;
+    if (fd >= 0) close(fd);
+    if (r != 0) unlink(path);
+    free(zeros);
+    return r;
+}
+
+/*
+ * Record part i of a multipart upload under the .parts file lock and count
+ * the bytes held. Returns 1 if this part completed the upload (the .parts
+ * file is then truncated, so exactly one caller publishes), 0 if parts are
+ * still missing or another part already completed it, -1 if unknown.
+ */
+static int partial_parts_mark(const char *parts, size_t i, size_t total, size_t part, size_t *held) {
+    int fd = open(parts, O_RDWR);
+    if (fd < 0) return -1;
+    int r = -1;
+    struct stat st;
+    size_t count = partial_part_count(total, part);
+    char *map = malloc(count);
+    if (map && flock(fd, LOCK_EX) == 0 && fstat(fd, &st) == 0) {
+        if (st.st_size == 0) {
+            *held = total;
+            r = 0;
+        } else if ((size_t)st.st_size == count && i < count && pwrite(fd, "1", 1, (off_t)i) == 1 &&
+                   pread(fd, map, count, 0) == (ssize_t)count) {
+            size_t done = 0;
+            *held = 0;
+            for (size_t k = 0; k < count; ++k) {
+                if (map[k] != '1') continue;
+                done++;
+                *held += total - k * part < part ? total - k * part : part;
+            }
+            r = done == count ? 1 : 0;
+            if (r == 1 && ftruncate(fd, 0) != 0) r = -1;
+        }
+    }
+    free(map);
+    close(fd); /* drops the lock */
+    return r;
+}
+
+static int worker_handle_upload_init(task_t *t) {
+    char path[1024], token[33];
+    partial_sweep(t->username);
+    /* check the quota now; it is charged (and checked again) once the last part arrives */
+    size_t replaced;
+    snprintf(path, sizeof(path), "storage/%s/%s", t->username, t->filename);
+    if (cs_file_size(path, &replaced) != 0) replaced = 0;
+    if (quota_reserve(&quota, t->username, t->data_len, replaced) != 0) {
+        t->resp.msg = "UPLOAD FAILED: QUOTA EXCEEDED\n";
+        return -1;
+    }
+    quota_release(&quota, t->username, t->data_len);
+
+    unsigned char rnd[16];
+    int fd = open("/dev/urandom", O_RDONLY);
+    ssize_t got = fd >= 0 ? read(fd, rnd, sizeof(rnd)) : -1;
+    if (fd >= 0) close(fd);
+    t->resp.msg = "UPLOAD FAILED\n";
+    if (got != (ssize_t)sizeof(rnd)) return -1;
+    for (int i = 0; i < 16; ++i) snprintf(token + 2 * i, 3, "%02x", rnd[i]);
+
+    partial_path(path, sizeof(path), t->username, token, "");
+    fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) return -1;
+    close(fd);
+    if (t->part_size && partial_parts_create(t, token) != 0) {
+        unlink(path);
+        return -1;
+    }
+    char meta[TASK_PATH_MAX + 64];
+    int n = t->part_size ? snprintf(meta, sizeof(meta), "%zu %s %zu\n", t->data_len, t->filename, t->part_size)
+                         : snprintf(meta, sizeof(meta), "%zu %s\n", t->data_len, t->filename);
+    partial_path(path, sizeof(path), t->username, token, ".meta");
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write_full(fd, meta, (size_t)n) != 0) {
+        if (fd >= 0) close(fd);
+        unlink(path);
+        partial_path(path, sizeof(path), t->username, token, ".parts");
+        unlink(path);
+        partial_path(path, sizeof(path), t->username, token, "");
+        unlink(path);
+        return -1;
+    }
+    close(fd);
+    if (t->part_size) return resp_printf(t, "UPLOAD-TOKEN %s %zu\n", token, t->part_size);
+    return resp_printf(t, "UPLOAD-TOKEN %s\n", token);
+}
+
+static int worker_handle_upload_status(task_t *t) {
+    char path[1024], name[TASK_PATH_MAX];
+    struct stat st;
+    size_t total, part;
+    partial_sweep(t->username);
+    partial_path(path, sizeof(path), t->username, t->filename, "");
+    if (stat(path, &st) != 0 || partial_meta(t->username, t->filename, &total, name, &part) != 0) {
+        t->resp.msg = "UPLOAD FAILED: UNKNOWN TOKEN\n";
+        return -1;
+    }
+    if (!part) return resp_printf(t, "UPLOAD-OFFSET %zu\n", (size_t)st.st_size);
+
+    /* multipart: which parts have arrived, as the .parts string */
+    partial_path(path, sizeof(path), t->username, t->filename, ".parts");
+    int fd = open(path, O_RDONLY);
+    size_t count = partial_part_count(total, part);
+    if (fd < 0 || resp_printf(t, "UPLOAD-PARTS %zu ", count) != 0 || task_resp_reserve(t, t->resp.data_len + count + 1) != 0) {
+        if (fd >= 0) close(fd);
+        t->resp.msg = "UPLOAD FAILED\n";
+        return -1;
+    }
+    char *map = (char *)t->resp.data + t->resp.data_len;
+    ssize_t n = pread(fd, map, count, 0);
+    close(fd);
+    if (n == 0) memset(map, '1', count); /* complete, being published */
+    else if (n != (ssize_t)count) {
+        t->resp.msg = "UPLOAD FAILED\n";
+        return -1;
+    }
+    map[count] = '\n';
+    t->resp.data_len += count + 1;
+    return 0;
+}
+
+/* A part was written by the reactor; once every byte is there, publish the file */
+static int worker_handle_upload_part(task_t *t) {
+    char path[1024], meta[TASK_PATH_MAX + 8], parts[TASK_PATH_MAX + 8];
+    struct stat st;
+    t->resp.msg = "UPLOAD FAILED\n";
+    snprintf(parts, sizeof(parts), "%s.parts", t->src_path);
+    if (t->part_size) {
+        size_t held = 0;
+        int r = partial_parts_mark(parts, t->range_off / t->part_size, t->data_len, t->part_size, &held);
+        if (r < 0) {
+            t->resp.msg = "UPLOAD FAILED: UNKNOWN TOKEN\n";
+            return -1;
+        }
+        if (r == 0) return resp_printf(t, "PART OK %zu\n", held);
+    } else {
+        if (stat(t->src_path, &st) != 0) return -1;
+        if ((size_t)st.st_size < t->data_len) return resp_printf(t, "PART OK %zu\n", (size_t)st.st_size);
+    }
+
+    snprintf(meta, sizeof(meta), "%s.meta", t->src_path);
+    snprintf(path, sizeof(path), "storage/%s/%s", t->username, t->filename);
+    size_t replaced;
+    if (cs_file_size(path, &replaced) != 0) replaced = 0;
+    if (quota_reserve(&quota, t->username, t->data_len, replaced) != 0) {
+        unlink(t->src_path);
+        unlink(meta);
+        unlink(parts);
+        t->resp.msg = "UPLOAD FAILED: QUOTA EXCEEDED\n";
+        return -1;
+    }
+    unlink(meta);
+    unlink(parts);
+    if (worker_publish(t, t->src_path) != 0) return -1;
+    t->resp.msg = "UPLOAD OK\n";
     return 0;
 }
 
 /* Worker thread function */
 void *worker_fn(void *arg) {
-    (void)arg;
+    int self = (int)(intptr_t)arg;
     while (running) {
         task_t *t = NULL;
-        if (tq_pop(&task_q, &t) != 0) break; /* queue closed */
+        if (wp_next(&pool, self, &t) != 0) break; /* pool closed */
         if (!t) continue;
 
+        uint64_t start = mx_now();
+        task_response_t *resp = &t->resp;
         if (t->type == TASK_UPLOAD) {
             int r = worker_handle_upload(t);
-            pthread_mutex_lock(&t->resp->lock);
-            t->resp->success = (r == 0);
-            if (r == 0) t->resp->msg = strdup("UPLOAD OK\n");
-            else if (r == -2) t->resp->msg = strdup("UPLOAD FAILED: QUOTA EXCEEDED\n");
-            else t->resp->msg = strdup("UPLOAD FAILED\n");
-            t->resp->done = 1;
-            pthread_cond_signal(&t->resp->cond);
-            pthread_mutex_unlock(&t->resp->lock);
+            resp->success = (r == 0);
+            resp->msg = r == 0 ? "UPLOAD OK\n" : "UPLOAD FAILED\n";
         } else if (t->type == TASK_DOWNLOAD) {
-            void *buf = NULL; size_t len = 0;
-            int r = worker_handle_download(t, &buf, &len);
-            pthread_mutex_lock(&t->resp->lock);
-            t->resp->success = (r == 0);
-            if (r == 0) {
-                t->resp->data = buf;
-                t->resp->data_len = len;
-                t->resp->msg = strdup("DOWNLOAD OK\n");
-            } else {
-                t->resp->msg = strdup("DOWNLOAD FAILED\n");
-            }
-            t->resp->done = 1;
-            pthread_cond_signal(&t->resp->cond);
-            pthread_mutex_unlock(&t->resp->lock);
+            int r = worker_handle_download(t);
+            resp->success = (r == 0);
+            if (!resp->msg) resp->msg = r == 0 ? "DOWNLOAD OK\n" : "DOWNLOAD FAILED\n";
         } else if (t->type == TASK_DELETE) {
             int r = worker_handle_delete(t);
-            pthread_mutex_lock(&t->resp->lock);
-            t->resp->success = (r == 0);
-            if (r == 0) t->resp->msg = strdup("DELETE OK\n");
-            else t->resp->msg = strdup("DELETE FAILED\n");
-            t->resp->done = 1;
-            pthread_cond_signal(&t->resp->cond);
-            pthread_mutex_unlock(&t->resp->lock);
+            resp->success = (r == 0);
+            resp->msg = r == 0 ? "DELETE OK\n" : "DELETE FAILED\n";
         } else if (t->type == TASK_LIST) {
-            char *out = NULL; size_t outlen = 0;
-            int r = worker_handle_list(t, &out, &outlen);
-            pthread_mutex_lock(&t->resp->lock);
-            t->resp->success = (r == 0);
-            if (r == 0) {
-                t->resp->data = out;
-                t->resp->data_len = outlen;
-                t->resp->msg = strdup("LIST OK\n");
-            } else {
-                t->resp->msg = strdup("LIST FAILED\n");
-            }
-            t->resp->done = 1;
-            pthread_cond_signal(&t->resp->cond);
-            pthread_mutex_unlock(&t->resp->lock);
+            int r = worker_handle_list(t);
+            resp->success = (r == 0);
+            resp->msg = r == 0 ? "LIST OK\n" : "LIST FAILED\n";
+        } else if (t->type == TASK_SIGNATURES) {
+            int r = worker_handle_signatures(t);
+            resp->success = (r == 0);
+            resp->msg = r == 0 ? "SIGNATURES OK\n" : "SIGNATURES FAILED\n";
+        } else if (t->type == TASK_DELTA) {
+            int r = worker_handle_delta(t);
+            resp->success = (r == 0);
+            resp->msg = r == 0 ? "UPLOAD OK\n" : "UPLOAD FAILED\n";
+        } else if (t->type == TASK_UPLOAD_INIT) {
+            resp->success = worker_handle_upload_init(t) == 0;
+        } else if (t->type == TASK_UPLOAD_PART) {
+            resp->success = worker_handle_upload_part(t) == 0;
+        } else if (t->type == TASK_UPLOAD_STATUS) {
+            resp->success = worker_handle_upload_status(t) == 0;
         }
 
-        /* cleanup task metadata (response remains for client to read) */
-        if (t->username) free(t->username);
-        if (t->filename) free(t->filename);
-        if (t->data) free(t->data);
-        free(t);
+        mx_task(t->type, resp->success, start - t->queued_ns, mx_now() - start);
+        /* hand the task back to its session; the owner recycles it */
+        if (t->on_done) t->on_done(t);
+        else task_release(t);
     }
+    task_pool_drain();
+    sio_thread_exit();
     return NULL;
 }
 
-/* Socket helpers */
-static ssize_t send_all(int fd, const void *buf, size_t len) {
-    const char *p = buf;
-    size_t sent = 0;
-    while (sent < len) {
-        ssize_t n = send(fd, p + sent, len - sent, 0);
-        if (n <= 0) {
-            if (errno == EINTR) continue;
-            return -1;
-        }
-        sent += (size_t)n;
+/* Session output: queue bytes, flushed by conn_drive */
+static int conn_send(conn_t *c, const void *buf, size_t len) {
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 256;
+        while (cap < c->out_len + len) cap *= 2;
+        char *nb = realloc(c->out, cap);
+        if (!nb) { c->closing = 1; return -1; }
+        c->out = nb;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, buf, len);
+    c->out_len += len;
+    return 0;
+}
+
+static int conn_send_str(conn_t *c, const char *s) {
+    return conn_send(c, s, strlen(s));
+}
+
+/* Pause a session for wait_ns; the reactor drives it again once that has passed */
+static void conn_throttle(conn_t *c, sh_dir_t d, uint64_t now, uint64_t wait_ns) {
+    uint64_t until = now + wait_ns, from = c->throttle_until > now ? c->throttle_until : now;
+    if (until > from) mx_count(d == SH_IN ? MX_THROTTLE_IN_NS : MX_THROTTLE_OUT_NS, until - from);
+    if (!c->throttle_until) {
+        c->throttle_next = c->r->throttled;
+        c->r->throttled = c;
+        mx_count(MX_THROTTLES, 1);
     }
-    return (ssize_t)sent;
+    if (until > c->throttle_until) c->throttle_until = until;
+    if (d == SH_IN) c->throttle_in = 1;
+}
+
+/* How much of want the shaper lets through now; 0 pauses the session */
+static size_t conn_shape(conn_t *c, sh_dir_t d, size_t want) {
+    if (!sh_limited(&shaper, c->shape, d)) return want;
+    uint64_t now = mx_now(), wait = 0;
+    size_t n = sh_allow(&shaper, c->shape, d, now, want, &wait);
+    if (!n) conn_throttle(c, d, now, wait);
+    return n;
+}
+
+/* n body bytes went through: charge them to the user and the server */
+static void conn_shaped(conn_t *c, sh_dir_t d, size_t n) {
+    if (n && sh_limited(&shaper, c->shape, d)) sh_charge(&shaper, c->shape, d, mx_now(), n);
 }
 
-static ssize_t recv_all(int fd, void *buf, size_t len) {
-    char *p = buf;
-    size_t recvd = 0;
-    while (recvd < len) {
-        ssize_t n = recv(fd, p + recvd, len - recvd, 0);
-        if (n <= 0) {
-            if (n == 0) return (ssize_t)recvd;
+/*
+ * Push bytes [*off, len) of fd straight from the page cache with sendfile().
+ * Filesystems that cannot do that fall back to a fixed buffer; bytes the
+ * socket did not take are simply re-read on the next call.
+ * Same return convention as conn_flush.
+ */
+static int conn_send_fd(conn_t *c, int fd, size_t *off, size_t len) {
+    while (*off < len) {
+        size_t want = conn_shape(c, SH_OUT, len - *off);
+        ssize_t n;
+        if (!want) return 1;
+        if (!c->tx_copy) {
+            off_t pos = (off_t)*off;
+            n = sendfile(c->fd, fd, &pos, want < SENDFILE_CHUNK ? want : SENDFILE_CHUNK);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                c->tx_copy = 1;
+                continue;
+            }
+        } else {
+            char buf[COPY_CHUNK];
+            n = pread(fd, buf, want < sizeof(buf) ? want : sizeof(buf), (off_t)*off);
+            if (n > 0) n = send(c->fd, buf, (size_t)n, MSG_NOSIGNAL);
+        }
+        if (n < 0) {
             if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
             return -1;
         }
-        recvd += (size_t)n;
+        if (n == 0) return -1; /* file shrank below the size we announced */
+        *off += (size_t)n;
+        mx_count(MX_BYTES_OUT, (uint64_t)n);
+        conn_shaped(c, SH_OUT, (size_t)n);
     }
-    return (ssize_t)recvd;
+    return 0;
 }
 
-/* simple line reader (returns malloc'd string without newline) */
-static char *read_line(int fd) {
-    char buf[1024];
-    size_t pos = 0;
-    while (1) {
-        ssize_t n = recv(fd, buf + pos, 1, 0);
-        if (n <= 0) return NULL;
-        if (buf[pos] == '\n') {
-            buf[pos] = '\0';
-            return strdup(buf);
+/* Reassemble a chunk-store download: send its blobs one after another */
+static int conn_send_chunks(conn_t *c) {
+    task_response_t *resp = &c->tx->resp;
+    const cs_ref_t *refs = resp->data;
+    while (c->tx_off < resp->data_len) {
+        const cs_ref_t *ref = &refs[c->tx_chunk];
+        if (c->tx_blob < 0) {
+            c->tx_blob = cs_open(&store, ref);
+            if (c->tx_blob < 0) return -1;
+            /* a ranged read may start inside the first chunk */
+            c->tx_chunk_off = c->tx_chunk == 0 ? resp->offset : 0;
         }
-        pos++;
-        if (pos >= sizeof(buf) - 1) return NULL;
+        size_t start = c->tx_chunk_off, end = ref->len;
+        if (end - start > resp->data_len - c->tx_off) end = start + (resp->data_len - c->tx_off);
+        int f = conn_send_fd(c, c->tx_blob, &c->tx_chunk_off, end);
+        c->tx_off += c->tx_chunk_off - start;
+        if (f != 0) return f;
+        close(c->tx_blob);
+        c->tx_blob = -1;
+        c->tx_chunk++;
     }
+    return 0;
 }
 
-/* Client thread: authenticate and process commands */
-void *client_worker(void *arg) {
-    (void)arg;
-    while (running) {
-        int sockfd;
-        if (cq_pop(&client_q, &sockfd) != 0) break;
-        if (!running) { close(sockfd); break; }
-
-        const char *welcome = "SIMPLE-DROPBOX-SERVER v1\nSend: HELLO <username>\n";
-        send_all(sockfd, welcome, strlen(welcome));
-
-        char *line = read_line(sockfd);
-        if (!line) { close(sockfd); continue; }
-        char username[256] = {0};
-        if (sscanf(line, "HELLO %255s", username) != 1) {
-            const char *err = "Expected: HELLO <username>\n";
-            send_all(sockfd, err, strlen(err));
-            free(line);
-            close(sockfd);
-            continue;
+/*
+ * Read the next len bytes of a download body into buf, from its file or
+ * across its chunks; the caller advances c->tx_off.
+ */
+static int conn_read_body(conn_t *c, unsigned char *buf, size_t len) {
+    task_response_t *resp = &c->tx->resp;
+    size_t got = 0;
+    if (resp->cached) {
+        memcpy(buf, ((fc_entry_t *)resp->cached)->data + resp->offset + c->tx_off, len);
+        return 0;
+    }
+    while (got < len) {
+        ssize_t n;
+        if (resp->fd >= 0) {
+            n = pread(resp->fd, buf + got, len - got, (off_t)(resp->offset + c->tx_off + got));
+        } else {
+            const cs_ref_t *ref = &((const cs_ref_t *)resp->data)[c->tx_chunk];
+            if (c->tx_blob < 0) {
+                c->tx_blob = cs_open(&store, ref);
+                if (c->tx_blob < 0) return -1;
+                c->tx_chunk_off = c->tx_chunk == 0 ? resp->offset : 0;
+            }
+            size_t want = ref->len - c->tx_chunk_off;
+            if (want > len - got) want = len - got;
+            n = pread(c->tx_blob, buf + got, want, (off_t)c->tx_chunk_off);
+            if (n > 0) {
+                c->tx_chunk_off += (size_t)n;
+                if (c->tx_chunk_off == ref->len) {
+                    close(c->tx_blob);
+                    c->tx_blob = -1;
+                    c->tx_chunk++;
+                }
+            }
         }
-        free(line);
-
-        send_all(sockfd, "AUTH OK\n", 8);
-        ensure_user_dir(username);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        got += (size_t)n;
+    }
+    return 0;
+}
 
-        /* session loop */
-        while (running) {
-            char *cmdline = read_line(sockfd);
-            if (!cmdline) break;
-            char *p = cmdline;
-            while (*p == ' ') p++;
+/*
+ * Compressed download: frame the body LZ_BLOCK_MAX bytes at a time and send
+ * each frame before reading the next. Same return convention as conn_flush.
+ */
+static int conn_send_frames(conn_t *c) {
+    task_response_t *resp = &c->tx->resp;
+    if (!c->tx_frame && !(c->tx_frame = malloc(LZ_FRAME_HDR + LZ_BLOCK_MAX))) return -1;
+    for (;;) {
+        while (c->tx_frame_off < c->tx_frame_len) {
+            size_t want = conn_shape(c, SH_OUT, c->tx_frame_len - c->tx_frame_off);
+            if (!want) return 1;
+            ssize_t n = send(c->fd, c->tx_frame + c->tx_frame_off, want, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 1;
+                return -1;
+            }
+            c->tx_frame_off += (size_t)n;
+            mx_count(MX_BYTES_OUT, (uint64_t)n);
+            conn_shaped(c, SH_OUT, (size_t)n);
+        }
+        if (c->tx_off == resp->data_len) {
+            /* a range may end inside a chunk */
+            if (c->tx_blob >= 0) close(c->tx_blob);
+            c->tx_blob = -1;
+            return 0;
+        }
+        unsigned char raw[LZ_BLOCK_MAX];
+        size_t len = resp->data_len - c->tx_off < LZ_BLOCK_MAX ? resp->data_len - c->tx_off : LZ_BLOCK_MAX;
+        if (conn_read_body(c, raw, len) != 0) return -1;
+        c->tx_frame_len = lz_frame(raw, len, c->tx_frame);
+        c->tx_frame_off = 0;
+        c->tx_off += len;
+    }
+}
 
-            if (strncmp(p, "UPLOAD ", 7) == 0) {
-                char fname[512]; long sz;
-                if (sscanf(p+7, "%511s %ld", fname, &sz) != 2 || sz < 0) {
-                    send_all(sockfd, "UPLOAD SYNTAX: UPLOAD <filename> <size>\n", 40);
-                    free(cmdline);
-                    continue;
-                }
-                void *buf = malloc((size_t)sz ? (size_t)sz : 1);
-                if (!buf) { send_all(sockfd, "UPLOAD FAILED: NO MEMORY\n", 25); free(cmdline); continue; }
-                ssize_t got = recv_all(sockfd, buf, (size_t)sz);
-                if (got != sz) { free(buf); send_all(sockfd, "UPLOAD FAILED\n", 14); free(cmdline); continue; }
-
-                task_t *t = calloc(1, sizeof(task_t));
-                t->type = TASK_UPLOAD;
-                t->username = strdup(username);
-                t->filename = strdup(fname);
-                t->data = buf;
-                t->data_len = (size_t)sz;
-                t->resp = task_response_create();
-                if (tq_push(&task_q, t) != 0) {
-                    send_all(sockfd, "SERVER BUSY\n", 11);
-                    task_response_destroy(t->resp);
-                    free(t->username); free(t->filename); free(t->data); free(t);
-                    free(cmdline);
-                    continue;
-                }
+static void conn_emit(conn_t *c, task_t *t);
 
-                pthread_mutex_lock(&t->resp->lock);
-                while (!t->resp->done) pthread_cond_wait(&t->resp->cond, &t->resp->lock);
-                if (t->resp->msg) send_all(sockfd, t->resp->msg, strlen(t->resp->msg));
-                pthread_mutex_unlock(&t->resp->lock);
-                task_response_destroy(t->resp);
-                free(cmdline);
-                continue;
+/*
+ * Send queued replies in order: header bytes, then the body of c->tx, then
+ * the next queued reply. Returns 0 when everything is sent, 1 if the socket
+ * is full, -1 on error.
+ */
+static int conn_flush(conn_t *c) {
+    for (;;) {
+        while (c->out_off < c->out_len) {
+            ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) { c->wblocked = 1; return 1; }
+                return -1;
             }
-
-            else if (strncmp(p, "DOWNLOAD ", 9) == 0) {
-                char fname[512];
-                if (sscanf(p+9, "%511s", fname) != 1) { send_all(sockfd, "DOWNLOAD SYNTAX\n", 16); free(cmdline); continue; }
-                task_t *t = calloc(1, sizeof(task_t));
-                t->type = TASK_DOWNLOAD;
-                t->username = strdup(username);
-                t->filename = strdup(fname);
-                t->resp = task_response_create();
-                if (tq_push(&task_q, t) != 0) {
-                    send_all(sockfd, "SERVER BUSY\n", 11);
-                    task_response_destroy(t->resp);
-                    free(t->username); free(t->filename); free(t);
-                    free(cmdline);
-                    continue;
-                }
-                pthread_mutex_lock(&t->resp->lock);
-                while (!t->resp->done) pthread_cond_wait(&t->resp->cond, &t->resp->lock);
-                if (t->resp->success && t->resp->data) {
-                    char hdr[64];
-                    int h = snprintf(hdr, sizeof(hdr), "DOWNLOAD %zu\n", t->resp->data_len);
-                    send_all(sockfd, hdr, h);
-                    send_all(sockfd, t->resp->data, t->resp->data_len);
+            c->out_off += (size_t)n;
+            mx_count(MX_BYTES_OUT, (uint64_t)n);
+        }
+        c->out_off = c->out_len = 0;
+        if (c->tx) {
+            task_response_t *resp = &c->tx->resp;
+            if (resp->fd >= 0 || resp->nchunks || (resp->cached && c->tx->lz)) {
+                int f;
+                if (c->tx->lz) {
+                    f = conn_send_frames(c);
+                } else if (resp->fd >= 0) {
+                    size_t pos = resp->offset + c->tx_off;
+                    f = conn_send_fd(c, resp->fd, &pos, resp->offset + resp->data_len);
+                    c->tx_off = pos - resp->offset;
                 } else {
-                    if (t->resp->msg) send_all(sockfd, t->resp->msg, strlen(t->resp->msg));
+                    f = conn_send_chunks(c);
                 }
-                pthread_mutex_unlock(&t->resp->lock);
-                task_response_destroy(t->resp);
-                free(cmdline);
-                continue;
-            }
-
-            else if (strncmp(p, "DELETE ", 7) == 0) {
-                char fname[512];
-                if (sscanf(p+7, "%511s", fname) != 1) { send_all(sockfd, "DELETE SYNTAX\n", 14); free(cmdline); continue; }
-                task_t *t = calloc(1, sizeof(task_t));
-                t->type = TASK_DELETE;
-                t->username = strdup(username);
-                t->filename = strdup(fname);
-                t->resp = task_response_create();
-                if (tq_push(&task_q, t) != 0) {
-                    send_all(sockfd, "SERVER BUSY\n", 11);
-                    task_response_destroy(t->resp);
-                    free(t->username); free(t->filename); free(t);
-                    free(cmdline);
-                    continue;
+                if (f > 0) c->wblocked = 1;
+                if (f != 0) return f;
+            } else {
+                /* list text, or a download straight from the file cache */
+                const char *body = resp->cached ? (const char *)((fc_entry_t *)resp->cached)->data + resp->offset
+                                                : resp->data;
+                /* file bodies are shaped; listings are not */
+                int shaped = c->tx->type == TASK_DOWNLOAD;
+                while (c->tx_off < resp->data_len) {
+                    size_t want = resp->data_len - c->tx_off;
+                    if (shaped && !(want = conn_shape(c, SH_OUT, want))) { c->wblocked = 1; return 1; }
+                    ssize_t n = send(c->fd, body + c->tx_off, want, MSG_NOSIGNAL);
+                    if (n < 0) {
+                        if (errno == EINTR) continue;
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) { c->wblocked = 1; return 1; }
+                        return -1;
+                    }
+                    c->tx_off += (size_t)n;
+                    mx_count(MX_BYTES_OUT, (uint64_t)n);
+                    if (shaped) conn_shaped(c, SH_OUT, (size_t)n);
                 }
-                pthread_mutex_lock(&t->resp->lock);
-                while (!t->resp->done) pthread_cond_wait(&t->resp->cond, &t->resp->lock);
-                if (t->resp->msg) send_all(sockfd, t->resp->msg, strlen(t->resp->msg));
-                pthread_mutex_unlock(&t->resp->lock);
-                task_response_destroy(t->resp);
-                free(cmdline);
-                continue;
             }
+            task_release(c->tx);
+            c->tx = NULL;
+        }
+        task_t *t = c->txq_head;
+        if (!t) return 0;
+        c->txq_head = t->next;
+        if (!c->txq_head) c->txq_tail = NULL;
+        c->txq_len--;
+        conn_emit(c, t);
+    }
+}
 
-            else if (strncmp(p, "LIST", 4) == 0) {
-                task_t *t = calloc(1, sizeof(task_t));
-                t->type = TASK_LIST;
-                t->username = strdup(username);
-                t->resp = task_response_create();
-                if (tq_push(&task_q, t) != 0) {
-                    send_all(sockfd, "SERVER BUSY\n", 11);
-                    task_response_destroy(t->resp);
-                    free(t->username); free(t);
-                    free(cmdline);
-                    continue;
-                }
-                pthread_mutex_lock(&t->resp->lock);
-                while (!t->resp->done) pthread_cond_wait(&t->resp->cond, &t->resp->lock);
-                if (t->resp->success) {
-                    send_all(sockfd, t->resp->msg, strlen(t->resp->msg));
-                    if (t->resp->data_len > 0 && t->resp->data) send_all(sockfd, t->resp->data, t->resp->data_len);
-                } else {
-                    if (t->resp->msg) send_all(sockfd, t->resp->msg, strlen(t->resp->msg));
-                }
-                pthread_mutex_unlock(&t->resp->lock);
-                task_response_destroy(t->resp);
-                free(cmdline);
-                continue;
-            }
+/* Runs on a worker thread: queue the task on its reactor and wake it */
+static void conn_task_done(task_t *t) {
+    conn_t *c = t->ctx;
+    reactor_t *r = c->r;
+    task_t *head = atomic_load_explicit(&r->done_head, memory_order_relaxed);
+    do {
+        t->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&r->done_head, &head, t,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+    /* only the push onto an empty list needs to wake the reactor */
+    if (!head) reactor_wake(r);
+}
 
-            else if (strncmp(p, "BYE", 3) == 0) {
-                free(cmdline);
-                break;
-            }
+/* FNV-1a; routes a user's tasks to the same worker */
+static unsigned user_hash(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
 
-            else {
-                send_all(sockfd, "Unknown command. Use UPLOAD/DOWNLOAD/DELETE/LIST/BYE\n", 51);
-                free(cmdline);
+/* Queue a finished task; its reply is written once earlier replies are out */
+static void conn_queue_reply(conn_t *c, task_t *t) {
+    t->next = NULL;
+    if (c->txq_tail) c->txq_tail->next = t; else c->txq_head = t;
+    c->txq_tail = t;
+    c->txq_len++;
+}
+
+/* Answer a request without running it (syntax errors, rejections) */
+static void conn_reply(conn_t *c, task_t *t, const char *msg) {
+    t->resp.success = 0;
+    t->resp.msg = msg;
+    conn_queue_reply(c, t);
+}
+
+/* Cheap metadata ops skip the per-user bulk queues */
+static wp_lane_t task_lane(const task_t *t) {
+    switch (t->type) {
+    case TASK_LIST:
+    case TASK_DELETE:
+    case TASK_UPLOAD_INIT:
+    case TASK_UPLOAD_STATUS:
+        return WP_PRIO;
+    default:
+        return WP_BULK;
+    }
+}
+
+static void conn_submit(conn_t *c, task_t *t) {
+    snprintf(t->username, sizeof(t->username), "%s", c->username);
+    t->on_done = conn_task_done;
+    t->ctx = c;
+    t->queued_ns = mx_now();
+    if (wp_submit(&pool, t, user_hash(c->username), task_lane(t)) != 0) {
+        /* turned away at once rather than stalling every session on this reactor */
+        if ((t->type == TASK_UPLOAD || t->type == TASK_DELTA) && t->src_path[0]) {
+            unlink(t->src_path);
+            quota_release(&quota, c->username, t->data_len);
+        }
+        mx_count(MX_BUSY, 1);
+        conn_reply(c, t, BUSY_REPLY);
+        return;
+    }
+    c->inflight++;
+    if (!t->tagged) c->state = CONN_WAIT_TASK;
+}
+
+/* Append to a reply header, truncating rather than running past it; returns the new length */
+static int hdr_printf(char *hdr, size_t cap, int h, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(hdr + h, cap - (size_t)h, fmt, ap);
+    va_end(ap);
+    if (n < 0) return h;
+    return h + n < (int)cap ? h + n : (int)cap - 1;
+}
+
+/*
+ * Format the reply of a task into c->out and start sending its body.
+ * Tagged replies are prefixed with "#<tag> " and, because they can
+ * interleave, LIST carries its byte count like DOWNLOAD does.
+ */
+static void conn_emit_v2(conn_t *c, task_t *t);
+
+static void conn_emit(conn_t *c, task_t *t) {
+    task_response_t *resp = &t->resp;
+    char hdr[128];
+    int h = 0;
+    if (c->v2) { conn_emit_v2(c, t); return; }
+    if (t->tagged) h = hdr_printf(hdr, sizeof(hdr), 0, "#%llu ", t->tag);
+
+    int body = 0;
+    if ((t->type == TASK_DOWNLOAD || t->type == TASK_SIGNATURES) && resp->success) {
+        h = hdr_printf(hdr, sizeof(hdr), h, "%s %zu",
+                       t->type == TASK_DOWNLOAD ? "DOWNLOAD" : "SIGNATURES", resp->data_len);
+        if (t->ranged) h = hdr_printf(hdr, sizeof(hdr), h, " %zu", resp->total);
+        h = hdr_printf(hdr, sizeof(hdr), h, "\n");
+        body = 1;
+    } else if (t->type == TASK_LIST && resp->success) {
+        if (t->tagged) {
+            int ml = (int)strcspn(resp->msg, "\n");
+            h = hdr_printf(hdr, sizeof(hdr), h, "%.*s %zu\n", ml, resp->msg, resp->data_len);
+        } else {
+            h = hdr_printf(hdr, sizeof(hdr), h, "%s", resp->msg);
+        }
+        body = resp->data_len > 0;
+    } else if (t->type == TASK_STATS && resp->success && resp->msg) {
+        /* STATS text, sized like a DOWNLOAD */
+        int ml = (int)strcspn(resp->msg, "\n");
+        h = hdr_printf(hdr, sizeof(hdr), h, "%.*s %zu\n", ml, resp->msg, resp->data_len);
+        body = resp->data_len > 0;
+    } else if (resp->msg) {
+        h = hdr_printf(hdr, sizeof(hdr), h, "%s", resp->msg);
+    } else {
+        /* reply formatted by the worker; an UPLOAD-PARTS map can be far longer than hdr */
+        conn_send(c, hdr, (size_t)h);
+        conn_send(c, resp->data, resp->data_len);
+        task_release(t);
+        return;
+    }
+    conn_send(c, hdr, (size_t)h);
+    if (!body) {
+        task_release(t);
+        return;
+    }
+    c->tx = t;
+    c->tx_off = 0;
+    c->tx_copy = 0;
+    c->tx_chunk = 0;
+    c->tx_frame_len = c->tx_frame_off = 0;
+}
+
+static const uint8_t v2_opcode_of[] = {
+    [TASK_LIST] = V2_OP_LIST,
+    [TASK_UPLOAD] = V2_OP_UPLOAD,
+    [TASK_DOWNLOAD] = V2_OP_DOWNLOAD,
+    [TASK_DELETE] = V2_OP_DELETE
+};
+
+/* v2 reply: frame header, error text (if any), then the payload as tx */
+static void conn_emit_v2(conn_t *c, task_t *t) {
+    task_response_t *resp = &t->resp;
+    int body = resp->success && (t->type == TASK_LIST || t->type == TASK_DOWNLOAD);
+    size_t mlen = (!resp->success && resp->msg) ? strcspn(resp->msg, "\n") : 0;
+    v2_frame_t f = {
+        .opcode = v2_opcode_of[t->type],
+        .flags = V2_F_RESPONSE,
+        .status = resp->success ? V2_ST_OK : V2_ST_ERROR,
+        .id = (uint32_t)t->tag,
+        .hdr_len = (uint32_t)mlen,
+        .payload_len = body ? resp->data_len : 0
+    };
+    unsigned char hdr[V2_HDR_LEN];
+    v2_encode(hdr, &f);
+    conn_send(c, hdr, sizeof(hdr));
+    if (mlen) conn_send(c, resp->msg, mlen);
+    if (!body || resp->data_len == 0) {
+        task_release(t);
+        return;
+    }
+    c->tx = t;
+    c->tx_off = 0;
+    c->tx_copy = 0;
+    c->tx_chunk = 0;
+}
+
+/* A worker handed a task back */
+static void conn_task_finished(conn_t *c, task_t *t) {
+    c->inflight--;
+    if (!t->tagged && c->state == CONN_WAIT_TASK) c->state = CONN_CMD;
+    if (c->closing) { task_release(t); return; }
+    conn_queue_reply(c, t);
+}
+
+/* Write the staged chunk to the temp file at up_pos; on failure switch to discarding */
+static void conn_upload_write(conn_t *c) {
+    size_t off = 0;
+    while (!c->up_err && off < c->up_buf_len) {
+        ssize_t n = pwrite(c->up_fd, c->up_buf + off, c->up_buf_len - off, (off_t)c->up_pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            c->up_err = "UPLOAD FAILED\n";
+            break;
+        }
+        off += (size_t)n;
+        c->up_pos += (size_t)n;
+    }
+    c->up_buf_len = 0;
+}
+
+/* Drop the temp file of an upload that will not be published */
+static void conn_upload_abort(conn_t *c) {
+    /* a resumable part keeps whatever arrived; the client continues from there */
+    if (c->up_keep && c->up_fd >= 0) conn_upload_write(c);
+    if (c->up_fd >= 0) close(c->up_fd);
+    c->up_fd = -1;
+    if (c->up && c->up->src_path[0] && !c->up_keep) unlink(c->up->src_path);
+    if (c->up_reserved) quota_release(&quota, c->username, c->up->data_len);
+    c->up_reserved = 0;
+    c->up_keep = 0;
+}
+
+/* Whole body received: hand the temp file to a worker to publish */
+static void conn_upload_finish(conn_t *c) {
+    task_t *t = c->up;
+    conn_upload_write(c);
+    free(c->up_buf);
+    c->up_buf = NULL;
+    c->state = CONN_CMD;
+    if (c->up_err) {
+        conn_upload_abort(c);
+        c->up = NULL;
+        conn_reply(c, t, c->up_err);
+        return;
+    }
+    close(c->up_fd);
+    c->up_fd = -1;
+    c->up_reserved = 0; /* now owned by the publishing worker */
+    c->up_keep = 0;
+    c->up = NULL;
+    conn_submit(c, t);
+}
+
+/* UPLOAD/DELTA header parsed (t->filename, t->data_len): start receiving a body of len bytes */
+/* Prepare to receive a request body of len bytes; the caller then opens c->up_fd */
+static int conn_body_init(conn_t *c, task_t *t, size_t len) {
+    char *buf = malloc(UPLOAD_CHUNK);
+    if (!buf) {
+        /* the body is still coming; we cannot resync, so drop the session */
+        conn_reply(c, t, "UPLOAD FAILED: NO MEMORY\n");
+        c->hangup = 1;
+        return -1;
+    }
+    c->up = t;
+    c->up_len = len;
+    c->up_got = 0;
+    c->up_buf = buf;
+    c->up_buf_len = 0;
+    c->up_err = NULL;
+    c->up_fd = -1;
+    c->up_pos = 0;
+    c->up_reserved = 0;
+    c->up_keep = 0;
+    c->up_lz = c->lz;
+    return 0;
+}
+
+static void conn_body_start(conn_t *c) {
+    c->state = CONN_UPLOAD_BODY;
+    if (c->up_len == 0) conn_upload_finish(c);
+}
+
+/*
+ * A name a client may store a file under: a single path component that is
+ * not hidden. Dot names belong to the server (.chunks, .incoming,
+ * .partial, .versions), and ".." would reach other users.
+ */
+static int name_ok(const char *name) {
+    return name[0] != '\0' && name[0] != '.' && !strchr(name, '/');
+}
+
+static void conn_upload_begin(conn_t *c, task_t *t, size_t len) {
+    if (conn_body_init(c, t, len) != 0) return;
+    if (!name_ok(t->filename)) {
+        /* the body is drained unwritten */
+        c->up_err = "UPLOAD FAILED: BAD NAME\n";
+        conn_body_start(c);
+        return;
+    }
+    /* reject early on the declared size; the body is then drained unwritten */
+    char path[1024];
+    snprintf(path, sizeof(path), "storage/%s/%s", c->username, t->filename);
+    size_t replaced;
+    if (cs_file_size(path, &replaced) != 0) replaced = 0;
+    if (ensure_user_dir(c->username) != 0) {
+        c->up_err = "UPLOAD FAILED\n";
+    } else if (quota_reserve(&quota, c->username, t->data_len, replaced) != 0) {
+        c->up_err = "UPLOAD FAILED: QUOTA EXCEEDED\n";
+    } else {
+        c->up_reserved = 1;
+        c->up_fd = upload_stage_open(c->username, t->src_path);
+        if (c->up_fd < 0) c->up_err = "UPLOAD FAILED\n";
+    }
+    conn_body_start(c);
+}
+
+/*
+ * UPLOAD-PART <token> <offset> <len>: write the body into a resumable upload.
+ * Sequential parts must continue exactly where the stored bytes end; a lock
+ * on the partial file keeps two sessions from writing the same upload at
+ * once. Multipart parts start on a part boundary and may arrive in any order
+ * over any number of sessions, each written in place.
+ */
+static void conn_part_begin(conn_t *c, task_t *t, const char *token, size_t off, size_t len) {
+    if (conn_body_init(c, t, len) != 0) return;
+    size_t total = 0, part = 0;
+    int fd = -1;
+    if (partial_meta(c->username, token, &total, t->filename, &part) == 0) {
+        partial_path(t->src_path, sizeof(t->src_path), c->username, token, "");
+        fd = open(t->src_path, O_WRONLY);
+    }
+    struct stat st;
+    if (fd < 0) {
+        c->up_err = "UPLOAD FAILED: UNKNOWN TOKEN\n";
+    } else if (part) {
+        if (off % part != 0 || (off >= total && off > 0)) c->up_err = "UPLOAD FAILED: BAD OFFSET\n";
+        else if (len != (total - off < part ? total - off : part)) c->up_err = "UPLOAD FAILED: BAD LENGTH\n";
+    } else if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        c->up_err = "UPLOAD FAILED: PART IN PROGRESS\n";
+    } else if (fstat(fd, &st) != 0 || (size_t)st.st_size != off) {
+        c->up_err = "UPLOAD FAILED: BAD OFFSET\n";
+    } else if (len > total - off) {
+        c->up_err = "UPLOAD FAILED: BAD LENGTH\n";
+    }
+    if (!c->up_err) {
+        c->up_fd = fd;
+        c->up_pos = off;
+        c->up_keep = 1;
+        t->data_len = total;
+        t->part_size = part;
+        t->range_off = off;
+        t->range_len = len;
+    }
+    if (c->up_err && fd >= 0) close(fd);
+    if (c->up_err) t->src_path[0] = '\0';
+    conn_body_start(c);
+}
+
+/* LIST arguments "[<prefix>|-] [<cursor>|-] [<limit>]" into filename, src_path, list_limit */
+static int conn_list_args(task_t *t, const char *args) {
+    char prefix[TASK_PATH_MAX] = "-", cursor[TASK_PATH_MAX] = "-";
+    long limit = LIST_PAGE;
+    if (sscanf(args, "%511s %511s %ld", prefix, cursor, &limit) == 3 && limit <= 0) return -1;
+    snprintf(t->filename, sizeof(t->filename), "%s", strcmp(prefix, "-") ? prefix : "");
+    snprintf(t->src_path, sizeof(t->src_path), "%s", strcmp(cursor, "-") ? cursor : "");
+    t->list_limit = limit < LIST_PAGE_MAX ? (size_t)limit : LIST_PAGE_MAX;
+    return 0;
+}
+
+static void conn_handle_hello(conn_t *c, const char *line) {
+    char ver[16] = "";
+    /* dot names are reserved for the chunk store and staging directories */
+    if (sscanf(line, "HELLO %255s %15s", c->username, ver) < 1 ||
+        c->username[0] == '.' || strchr(c->username, '/')) {
+        conn_send_str(c, "Expected: HELLO <username>\n");
+        c->hangup = 1;
+        return;
+    }
+    c->v2 = strcmp(ver, "v2") == 0;
+    c->shape = sh_user(&shaper, c->username);
+    conn_send_str(c, c->v2 ? "AUTH OK v2\n" : "AUTH OK\n");
+    ensure_user_dir(c->username);
+    c->state = CONN_CMD;
+}
+
+static void conn_handle_command(conn_t *c, char *line) {
+    char *p = line;
+    while (*p == ' ') p++;
+
+    task_t *t = task_alloc();
+    if (!t) { c->closing = 1; return; }
+    if (*p == '#') {
+        /* "#<id> <command>": pipelined, the reply is tagged and may come out of order */
+        char *end;
+        t->tag = strtoull(p + 1, &end, 10);
+        if (end == p + 1 || *end != ' ') {
+            conn_reply(c, t, "BAD TAG: use #<id> <command>\n");
+            return;
+        }
+        t->tagged = 1;
+        p = end;
+        while (*p == ' ') p++;
+    }
+
+    if (strncmp(p, "UPLOAD ", 7) == 0) {
+        long sz;
+        t->type = TASK_UPLOAD;
+        if (sscanf(p+7, "%511s %ld", t->filename, &sz) != 2 || sz < 0) {
+            conn_reply(c, t, "UPLOAD SYNTAX: UPLOAD <filename> <size>\n");
+            return;
+        }
+        t->data_len = (size_t)sz;
+        conn_upload_begin(c, t, t->data_len);
+    }
+    else if (strncmp(p, "DELTA ", 6) == 0) {
+        long sz, dl;
+        t->type = TASK_DELTA;
+        if (sscanf(p + 6, "%511s %ld %ld", t->filename, &sz, &dl) != 3 || sz < 0 || dl < DELTA_HDR_LEN) {
+            conn_reply(c, t, "DELTA SYNTAX: DELTA <filename> <size> <delta bytes>\n");
+            return;
+        }
+        t->data_len = (size_t)sz;
+        conn_upload_begin(c, t, (size_t)dl);
+    }
+    else if (strncmp(p, "SIGNATURES ", 11) == 0) {
+        t->type = TASK_SIGNATURES;
+        if (sscanf(p + 11, "%511s", t->filename) != 1) {
+            conn_reply(c, t, "SIGNATURES SYNTAX\n");
+            return;
+        }
+        if (!name_ok(t->filename)) {
+            conn_reply(c, t, "SIGNATURES FAILED: BAD NAME\n");
+            return;
+        }
+        conn_submit(c, t);
+    }
+    else if (strncmp(p, "DOWNLOAD ", 9) == 0 || strncmp(p, "DELETE ", 7) == 0) {
+        int dl = p[1] == 'O';
+        long off = 0, len = 0;
+        t->type = dl ? TASK_DOWNLOAD : TASK_DELETE;
+        int n = sscanf(p + (dl ? 9 : 7), "%511s %ld %ld", t->filename, &off, &len);
+        if (n < 1 || (!dl && n > 1) || off < 0 || len < 0) {
+            conn_reply(c, t, dl ? "DOWNLOAD SYNTAX\n" : "DELETE SYNTAX\n");
+            return;
+        }
+        if (!name_ok(t->filename)) {
+            conn_reply(c, t, dl ? "DOWNLOAD FAILED: BAD NAME\n" : "DELETE FAILED: BAD NAME\n");
+            return;
+        }
+        t->lz = dl && c->lz;
+        if (n > 1) {
+            /* DOWNLOAD <name> <offset> [<len>]: answered with "DOWNLOAD <len> <total>" */
+            t->ranged = 1;
+            t->range_off = (size_t)off;
+            t->range_len = (size_t)len;
+        }
+        conn_submit(c, t);
+    }
+    else if (strncmp(p, "UPLOAD-INIT ", 12) == 0) {
+        long sz, part = 0;
+        t->type = TASK_UPLOAD_INIT;
+        if (sscanf(p + 12, "%511s %ld %ld", t->filename, &sz, &part) < 2 || sz < 0 || part < 0 ||
+            (part > 0 && part < MULTIPART_PART_MIN && part < sz) ||
+            (part > 0 && (sz + part - 1) / part > MULTIPART_MAX_PARTS)) {
+            conn_reply(c, t, "UPLOAD-INIT SYNTAX: UPLOAD-INIT <filename> <size> [<part size>]\n");
+            return;
+        }
+        if (!name_ok(t->filename)) {
+            conn_reply(c, t, "UPLOAD FAILED: BAD NAME\n");
+            return;
+        }
+        t->data_len = (size_t)sz;
+        t->part_size = (size_t)part;
+        conn_submit(c, t);
+    }
+    else if (strncmp(p, "UPLOAD-PART ", 12) == 0) {
+        char token[64];
+        long off, len;
+        t->type = TASK_UPLOAD_PART;
+        if (sscanf(p + 12, "%63s %ld %ld", token, &off, &len) != 3 || off < 0 || len < 0) {
+            conn_reply(c, t, "UPLOAD-PART SYNTAX: UPLOAD-PART <token> <offset> <len>\n");
+            return;
+        }
+        conn_part_begin(c, t, token, (size_t)off, (size_t)len);
+    }
+    else if (strncmp(p, "UPLOAD-STATUS ", 14) == 0) {
+        t->type = TASK_UPLOAD_STATUS;
+        /* the token travels in filename */
+        if (sscanf(p + 14, "%63s", t->filename) != 1 ||
+            t->filename[strspn(t->filename, "0123456789abcdef")] != '\0') {
+            conn_reply(c, t, "UPLOAD FAILED: UNKNOWN TOKEN\n");
+            return;
+        }
+        conn_submit(c, t);
+    }
+    else if (strcmp(p, "CACHE-STATS") == 0) {
+        fc_stats_t st;
+        t->type = TASK_STATS;
+        fc_stats(&fcache, &st);
+        if (resp_printf(t, "CACHE hits=%zu misses=%zu inserts=%zu evictions=%zu invalidations=%zu "
+                        "entries=%zu bytes=%zu budget=%zu\n", st.hits, st.misses, st.inserts,
+                        st.evictions, st.invalidations, st.entries, st.bytes,
+                        (size_t)FILE_CACHE_BYTES) != 0) {
+            conn_reply(c, t, "CACHE-STATS FAILED\n");
+            return;
+        }
+        t->resp.success = 1;
+        conn_queue_reply(c, t);
+    }
+    else if (strcmp(p, "STATS") == 0) {
+        t->type = TASK_STATS;
+        if (!admin_user || strcmp(c->username, admin_user) != 0) {
+            conn_reply(c, t, "STATS FAILED: NOT ADMIN\n");
+            return;
+        }
+        if (stats_render(stats_to_task, t) != 0) {
+            conn_reply(c, t, "STATS FAILED\n");
+            return;
+        }
+        t->resp.msg = "STATS\n";
+        t->resp.success = 1;
+        conn_queue_reply(c, t);
+    }
+    else if (strncmp(p, "COMPRESS ", 9) == 0) {
+        /* applies to bodies of commands parsed from here on; reply lines stay text */
+        char codec[16] = "";
+        sscanf(p + 9, "%15s", codec);
+        if (strcmp(codec, "lz") == 0 || strcmp(codec, "off") == 0) {
+            c->lz = codec[0] == 'l';
+            conn_reply(c, t, c->lz ? "COMPRESS OK lz\n" : "COMPRESS OK off\n");
+        } else {
+            conn_reply(c, t, "COMPRESS FAILED: UNKNOWN CODEC\n");
+        }
+    }
+    else if (strncmp(p, "LIST", 4) == 0 && (p[4] == '\0' || p[4] == ' ')) {
+        t->type = TASK_LIST;
+        if (conn_list_args(t, p + 4) != 0) {
+            conn_reply(c, t, "LIST SYNTAX: LIST [<prefix>|-] [<cursor>|-] [<limit>]\n");
+            return;
+        }
+        conn_submit(c, t);
+    }
+    else if (strncmp(p, "BYE", 3) == 0) {
+        task_release(t);
+        c->hangup = 1;
+    }
+    else {
+        conn_reply(c, t, "Unknown command. Use UPLOAD/DOWNLOAD/DELETE/LIST/BYE\n");
+    }
+}
+
+/*
+ * Parse one v2 frame straight out of the input buffer. Returns 1 if a frame
+ * was consumed, 0 if it is not complete yet; malformed frames close the session.
+ */
+static int conn_process_v2(conn_t *c) {
+    if (nb_len(&c->in) < V2_HDR_LEN) return 0;
+    const unsigned char *p = (const unsigned char *)nb_peek(&c->in);
+    v2_frame_t f;
+    v2_decode(p, &f);
+    if (f.hdr_len > V2_MAX_HDR || (f.flags & V2_F_RESPONSE)) { c->closing = 1; return 0; }
+    if (nb_len(&c->in) < V2_HDR_LEN + f.hdr_len) return 0;
+
+    const char *name = (const char *)p + V2_HDR_LEN;
+    int named = f.opcode == V2_OP_UPLOAD || f.opcode == V2_OP_DOWNLOAD || f.opcode == V2_OP_DELETE;
+    if (f.opcode < V2_OP_LIST || f.opcode > V2_OP_BYE ||
+        (named && (f.hdr_len == 0 || memchr(name, '\0', f.hdr_len))) ||
+        (f.opcode != V2_OP_UPLOAD && f.payload_len != 0)) {
+        c->closing = 1;
+        return 0;
+    }
+    if (f.opcode == V2_OP_BYE) {
+        nb_skip(&c->in, V2_HDR_LEN + f.hdr_len);
+        c->hangup = 1;
+        return 1;
+    }
+    task_t *t = task_alloc();
+    if (!t) { c->closing = 1; return 0; }
+    t->tagged = 1;
+    t->tag = f.id;
+    memcpy(t->filename, name, f.hdr_len);
+    t->filename[f.hdr_len] = '\0';
+    nb_skip(&c->in, V2_HDR_LEN + f.hdr_len);
+
+    switch (f.opcode) {
+    case V2_OP_LIST:
+        /* the header carries the same arguments as the text command */
+        t->type = TASK_LIST;
+        if (conn_list_args(t, t->filename) != 0) conn_reply(c, t, "LIST SYNTAX\n");
+        else conn_submit(c, t);
+        break;
+    case V2_OP_DOWNLOAD:
+    case V2_OP_DELETE:
+        t->type = f.opcode == V2_OP_DOWNLOAD ? TASK_DOWNLOAD : TASK_DELETE;
+        if (!name_ok(t->filename)) conn_reply(c, t, "BAD NAME\n");
+        else conn_submit(c, t);
+        break;
+    case V2_OP_UPLOAD:
+        t->type = TASK_UPLOAD;
+        t->data_len = (size_t)f.payload_len;
+        conn_upload_begin(c, t, t->data_len);
+        break;
+    }
+    return 1;
+}
+
+/* Compressed body: decode one whole frame out of the input buffer */
+static int conn_body_frame(conn_t *c) {
+    size_t raw, wire;
+    if (nb_len(&c->in) < LZ_FRAME_HDR) return 0;
+    const unsigned char *p = (const unsigned char *)nb_peek(&c->in);
+    if (lz_frame_parse(p, &raw, &wire) != 0 || raw > c->up_len - c->up_got) {
+        /* out of step with the framing: the rest of the input cannot be parsed */
+        c->closing = 1;
+        return 0;
+    }
+    if (nb_len(&c->in) < LZ_FRAME_HDR + wire) return 0;
+    if (UPLOAD_CHUNK - c->up_buf_len < raw) conn_upload_write(c);
+    if (!c->up_err) {
+        if (lz_unframe(p + LZ_FRAME_HDR, wire, c->up_buf + c->up_buf_len, raw) == 0) {
+            c->up_buf_len += raw;
+        } else {
+            c->up_err = "UPLOAD FAILED: BAD COMPRESSED DATA\n";
+        }
+    }
+    nb_skip(&c->in, LZ_FRAME_HDR + wire);
+    c->up_got += raw;
+    if (c->up_got == c->up_len) conn_upload_finish(c);
+    return 1;
+}
+
+/* Consume buffered input; returns 1 if progress was made, 0 if more bytes are needed */
+static int conn_process_input(conn_t *c) {
+    if (c->state == CONN_UPLOAD_BODY && c->up_lz) return conn_body_frame(c);
+    if (c->state == CONN_UPLOAD_BODY) {
+        size_t want = c->up_len - c->up_got;
+        size_t room = UPLOAD_CHUNK - c->up_buf_len;
+        size_t take = nb_take(&c->in, c->up_buf + c->up_buf_len, want < room ? want : room);
+        c->up_buf_len += take;
+        c->up_got += take;
+        if (c->up_got == c->up_len) {
+            conn_upload_finish(c);
+            return 1;
+        }
+        if (c->up_buf_len == UPLOAD_CHUNK) {
+            conn_upload_write(c);
+            return 1;
+        }
+        return take > 0;
+    }
+
+    if (c->v2 && c->state == CONN_CMD) return conn_process_v2(c);
+
+    char *line = nb_getline(&c->in, NULL);
+    if (!line) return 0;
+    if (c->state == CONN_HELLO) conn_handle_hello(c, line);
+    else conn_handle_command(c, line);
+    return 1;
+}
+
+static void conn_close(conn_t *c) {
+    reactor_t *r = c->r;
+    if (c->fd < 0) return;
+    close(c->fd); /* also removes it from the epoll set */
+    c->fd = -1;
+    mx_count(MX_SESSIONS_CLOSED, 1);
+    if (c->throttle_until) {
+        conn_t **p = &r->throttled;
+        while (*p != c) p = &(*p)->throttle_next;
+        *p = c->throttle_next;
+        c->throttle_until = 0;
+    }
+    if (c->prev) c->prev->next = c->next; else r->conns = c->next;
+    if (c->next) c->next->prev = c->prev;
+    c->prev = NULL;
+    c->next = r->dead;
+    r->dead = c;
+}
+
+static void conn_free(conn_t *c) {
+    conn_upload_abort(c);
+    free(c->up_buf);
+    task_release(c->up);
+    if (c->tx_blob >= 0) close(c->tx_blob);
+    free(c->tx_frame);
+    task_release(c->tx);
+    while (c->txq_head) {
+        task_t *t = c->txq_head;
+        c->txq_head = t->next;
+        task_release(t);
+    }
+    free(c->out);
+    nb_destroy(&c->in);
+    free(c);
+}
+
+/*
+ * Advance a session as far as possible without blocking: flush replies,
+ * parse buffered commands and read until EAGAIN (sockets are edge-triggered).
+ * Input is left unread while an untagged task is outstanding or too many
+ * tagged ones are in flight.
+ */
+static void conn_drive(conn_t *c) {
+    if (c->fd < 0) return;
+    while (!c->closing) {
+        if (!c->wblocked && conn_flush(c) < 0) { c->closing = 1; break; }
+        if (c->hangup) {
+            /* BYE or fatal error: close once every reply is out */
+            if (c->inflight || c->txq_head || c->tx || c->out_len) return;
+            c->closing = 1;
+            break;
+        }
+        if (c->state == CONN_WAIT_TASK) return;
+        if (c->inflight + c->txq_len >= CONN_MAX_INFLIGHT) return;
+        if (conn_process_input(c)) continue;
+        if (c->closing) break;
+
+        ssize_t n;
+        if (c->throttle_in) return;
+        if (c->state == CONN_UPLOAD_BODY && !c->up_lz) {
+            /* body bytes go straight into the chunk buffer */
+            size_t want = c->up_len - c->up_got;
+            size_t room = UPLOAD_CHUNK - c->up_buf_len;
+            if (!(want = conn_shape(c, SH_IN, want < room ? want : room))) return;
+            n = recv(c->fd, c->up_buf + c->up_buf_len, want, 0);
+            if (n > 0) {
+                c->up_buf_len += (size_t)n;
+                c->up_got += (size_t)n;
+                conn_shaped(c, SH_IN, (size_t)n);
             }
+        } else {
+            /* a compressed body comes through the input buffer: shape it there */
+            int body = c->state == CONN_UPLOAD_BODY;
+            if (body && !conn_shape(c, SH_IN, CONN_INBUF)) return;
+            n = nb_fill(&c->in, c->fd); /* EMSGSIZE: line too long */
+            if (body && n > 0) conn_shaped(c, SH_IN, (size_t)n);
         }
+        if (n > 0) mx_count(MX_BYTES_IN, (uint64_t)n);
+        if (n == 0) { c->closing = 1; break; }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            c->closing = 1;
+            break;
+        }
+    }
+    /* keep the conn alive until the workers hand its tasks back */
+    if (!c->inflight) conn_close(c);
+}
+
+static void conn_open(reactor_t *r, int fd) {
+    conn_t *c = calloc(1, sizeof(conn_t));
+    int fl = fcntl(fd, F_GETFL, 0);
+    if (!c || fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0 ||
+        nb_init(&c->in, CONN_INBUF, CONN_INBUF_MAX) != 0) {
+        free(c);
+        close(fd);
+        return;
+    }
+    /* replies go out as header then body; do not let Nagle hold the body's tail */
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->fd = fd;
+    c->up_fd = -1;
+    c->tx_blob = -1;
+    c->r = r;
+    c->state = CONN_HELLO;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = c;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        perror("epoll_ctl");
+        nb_destroy(&c->in);
+        free(c);
+        close(fd);
+        return;
+    }
+    c->next = r->conns;
+    if (r->conns) r->conns->prev = c;
+    r->conns = c;
+    mx_count(MX_SESSIONS_OPENED, 1);
+
+    conn_send_str(c, "SIMPLE-DROPBOX-SERVER v1\nSend: HELLO <username>\n");
+    conn_drive(c);
+}
+
+/* eventfd fired: adopt new sockets and deliver completed tasks */
+static void reactor_drain(reactor_t *r) {
+    uint64_t cnt;
+    ssize_t n = read(r->evfd, &cnt, sizeof(cnt));
+    (void)n;
+
+    int fd;
+    while (cq_try_pop(&r->inbox, &fd) == 0) conn_open(r, fd);
+
+    task_t *list = atomic_exchange_explicit(&r->done_head, NULL, memory_order_acquire);
+
+    /* reverse into completion order */
+    task_t *fifo = NULL;
+    while (list) { task_t *nx = list->next; list->next = fifo; fifo = list; list = nx; }
+    while (fifo) {
+        task_t *t = fifo;
+        fifo = t->next;
+        conn_t *c = t->ctx;
+        conn_task_finished(c, t);
+        conn_drive(c);
+    }
+}
+
+/* Milliseconds until the first paused session may go on, -1 if none is paused */
+static int reactor_timeout(reactor_t *r) {
+    if (!r->throttled) return -1;
+    uint64_t first = UINT64_MAX, now = mx_now();
+    for (conn_t *c = r->throttled; c; c = c->throttle_next) {
+        if (c->throttle_until < first) first = c->throttle_until;
+    }
+    if (first <= now) return 0;
+    uint64_t ms = (first - now + 999999) / 1000000;
+    return ms > INT_MAX ? INT_MAX : (int)ms;
+}
+
+/* Resume the sessions whose shaper pause is over */
+static void reactor_unthrottle(reactor_t *r) {
+    uint64_t now = mx_now();
+    conn_t *due = NULL, **p = &r->throttled;
+    while (*p) {
+        conn_t *c = *p;
+        if (c->throttle_until > now) { p = &c->throttle_next; continue; }
+        *p = c->throttle_next;
+        c->throttle_next = due;
+        due = c;
+    }
+    /* driving them may pause them again, so take them off the list first */
+    while (due) {
+        conn_t *c = due;
+        due = c->throttle_next;
+        c->throttle_until = 0;
+        c->throttle_in = 0;
+        c->wblocked = 0;
+        conn_drive(c);
+    }
+}
 
-        close(sockfd);
+static void *reactor_fn(void *arg) {
+    reactor_t *r = arg;
+    struct epoll_event evs[REACTOR_MAX_EVENTS];
+    while (running) {
+        int n = epoll_wait(r->epfd, evs, REACTOR_MAX_EVENTS, reactor_timeout(r));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            conn_t *c = evs[i].data.ptr;
+            if (!c) { reactor_drain(r); continue; }
+            if (evs[i].events & (EPOLLERR | EPOLLHUP)) c->closing = 1;
+            if (evs[i].events & EPOLLOUT) c->wblocked = 0;
+            conn_drive(c);
+        }
+        reactor_unthrottle(r);
+        /* closed sessions may still appear in this batch, so free them here */
+        while (r->dead) {
+            conn_t *c = r->dead;
+            r->dead = c->next;
+            conn_free(c);
+        }
     }
+    task_pool_drain();
     return NULL;
 }
 
+static int reactor_init(reactor_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->epfd = epoll_create1(0);
+    if (r->epfd < 0) return -1;
+    r->evfd = eventfd(0, EFD_NONBLOCK);
+    if (r->evfd < 0) { close(r->epfd); return -1; }
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->evfd, &ev) != 0 ||
+        cq_init(&r->inbox, CLIENT_QUEUE_CAP) != 0) {
+        close(r->evfd);
+        close(r->epfd);
+        return -1;
+    }
+    atomic_init(&r->done_head, NULL);
+    return 0;
+}
+
+/* Only called once workers and the reactor thread have been joined */
+static void reactor_destroy(reactor_t *r) {
+    task_t *t = atomic_exchange(&r->done_head, NULL);
+    while (t) {
+        task_t *nx = t->next;
+        ((conn_t *)t->ctx)->inflight--;
+        task_release(t);
+        t = nx;
+    }
+    while (r->conns) {
+        conn_t *c = r->conns;
+        r->conns = c->next;
+        close(c->fd);
+        conn_free(c);
+    }
+    while (r->dead) {
+        conn_t *c = r->dead;
+        r->dead = c->next;
+        conn_free(c);
+    }
+    int fd;
+    while (cq_try_pop(&r->inbox, &fd) == 0) close(fd);
+    cq_destroy(&r->inbox);
+    close(r->evfd);
+    close(r->epfd);
+}
+
+/* Many idle sessions need many descriptors: lift the soft limit to the hard one */
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
 /* Setup listening socket */
 int setup_listener(int port) {
     int fd;
@@ -466,76 +2145,193 @@ int setup_listener(int port) {
     return fd;
 }
 
+static void shutdown_threads(void) {
+    for (int i = 0; i < num_reactors; ++i) {
+        cq_close(&reactors[i].inbox);
+        reactor_wake(&reactors[i]);
+    }
+    wp_close(&pool);
+    if (stats_interval > 0) pthread_join(stats_thread, NULL);
+    if (sweeping) pthread_join(sweep_thread, NULL);
+    for (int i = 0; i < WORKER_POOL_SIZE; ++i) pthread_join(worker_threads[i], NULL);
+    for (int i = 0; i < num_reactors; ++i) pthread_join(reactors[i].thread, NULL);
+    for (int i = 0; i < num_reactors; ++i) reactor_destroy(&reactors[i]);
+    wp_destroy(&pool);
+    quota_destroy(&quota);
+    di_destroy(&dindex);
+    task_pool_drain();
+    fc_destroy(&fcache);
+    vs_destroy(&versions);
+    cs_destroy(&store);
+    sh_destroy(&shaper);
+    mx_destroy();
+}
+
+/*
+ * --rate-in/--rate-out <rate> limit the whole server, --user-rate-in and
+ * --user-rate-out [<user>=]<rate> each user (or just <user>)
+ */
+static int shape_arg(const char *flag, const char *value) {
+    sh_dir_t d;
+    const char *user = NULL;
+    if (strcmp(flag, "--rate-in") == 0) d = SH_IN;
+    else if (strcmp(flag, "--rate-out") == 0) d = SH_OUT;
+    else if (strcmp(flag, "--user-rate-in") == 0) d = SH_IN, user = "*";
+    else if (strcmp(flag, "--user-rate-out") == 0) d = SH_OUT, user = "*";
+    else return -1;
+    char name[256];
+    const char *eq = strchr(value, '=');
+    if (user && eq) {
+        if (eq == value || (size_t)(eq - value) >= sizeof(name)) return -1;
+        snprintf(name, sizeof(name), "%.*s", (int)(eq - value), value);
+        user = name;
+        value = eq + 1;
+    }
+    uint64_t rate;
+    if (sh_parse_rate(value, &rate) != 0) return -1;
+    return sh_set_rate(&shaper, user, d, rate);
+}
+
 int main(int argc, char *argv[]) {
     int port = DEFAULT_PORT;
-    if (argc >= 2) port = atoi(argv[1]);
+    long retain = VERSION_TTL;
+    sio_kind_t io = SIO_BLOCKING;
+    if (sh_init(&shaper) != 0) {
+        fprintf(stderr, "Failed to init shaper\n");
+        return 1;
+    }
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--retain") == 0 && i + 1 < argc) retain = atol(argv[++i]);
+        else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) stats_interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--admin") == 0 && i + 1 < argc) admin_user = argv[++i];
+        else if (strcmp(argv[i], "--io") == 0 && i + 1 < argc) {
+            ++i;
+            if (strcmp(argv[i], "blocking") == 0) io = SIO_BLOCKING;
+            else if (strcmp(argv[i], "uring") == 0) io = SIO_URING;
+            else {
+                fprintf(stderr, "Bad I/O backend: %s\n", argv[i]);
+                return 1;
+            }
+        } else if ((strncmp(argv[i], "--rate-", 7) == 0 || strncmp(argv[i], "--user-rate-", 12) == 0) &&
+                   i + 1 < argc) {
+            if (shape_arg(argv[i], argv[i + 1]) != 0) {
+                fprintf(stderr, "Bad rate: %s %s\n", argv[i], argv[i + 1]);
+                return 1;
+            }
+            ++i;
+        } else port = atoi(argv[i]);
+    }
+    if (sio_setup(io) != 0) fprintf(stderr, "io_uring unavailable, using blocking storage I/O\n");
 
+    started = time(NULL);
     signal(SIGINT, handle_sigint);
+    signal(SIGPIPE, SIG_IGN);
+    raise_fd_limit();
 
-    if (cq_init(&client_q, CLIENT_QUEUE_CAP) != 0) {
-        fprintf(stderr, "Failed to init client queue\n");
+    if (vs_init(&versions, "storage", retain > 0 ? retain : 0) != 0) {
+        fprintf(stderr, "Failed to init version store\n");
+        return 1;
+    }
+    /* expired versions go before their chunks are counted */
+    vs_sweep_all(&versions, NULL);
+    if (cs_init(&store, "storage/.chunks", "storage") != 0) {
+        fprintf(stderr, "Failed to init chunk store\n");
         return 1;
     }
-    if (tq_init(&task_q, TASK_QUEUE_CAP) != 0) {
-        fprintf(stderr, "Failed to init task queue\n");
+    if (quota_init(&quota, "storage", USER_QUOTA_BYTES) != 0) {
+        fprintf(stderr, "Failed to init quota table\n");
+        return 1;
+    }
+    if (di_init(&dindex, "storage") != 0) {
+        fprintf(stderr, "Failed to init directory index\n");
+        return 1;
+    }
+    if (fc_init(&fcache, FILE_CACHE_BYTES, FILE_CACHE_ENTRY_MAX) != 0) {
+        fprintf(stderr, "Failed to init file cache\n");
+        return 1;
+    }
+    if (wp_init(&pool, WORKER_POOL_SIZE, TASK_QUEUE_CAP) != 0) {
+        fprintf(stderr, "Failed to init worker pool\n");
         return 1;
     }
 
-    /* start client threads */
-    for (int i = 0; i < CLIENT_POOL_SIZE; ++i) {
-        if (pthread_create(&client_threads[i], NULL, client_worker, NULL) != 0) {
-            perror("pthread_create client");
+    /* one reactor per core */
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = ncpu < 1 ? 1 : (ncpu > MAX_REACTORS ? MAX_REACTORS : (int)ncpu);
+    for (int i = 0; i < want; ++i) {
+        if (reactor_init(&reactors[i]) != 0) {
+            perror("reactor_init");
+            break;
         }
+        if (pthread_create(&reactors[i].thread, NULL, reactor_fn, &reactors[i]) != 0) {
+            perror("pthread_create reactor");
+            reactor_destroy(&reactors[i]);
+            break;
+        }
+        num_reactors++;
+    }
+    if (num_reactors == 0) {
+        fprintf(stderr, "Failed to start reactors\n");
+        return 1;
     }
     /* start worker threads */
     for (int i = 0; i < WORKER_POOL_SIZE; ++i) {
-        if (pthread_create(&worker_threads[i], NULL, worker_fn, NULL) != 0) {
+        if (pthread_create(&worker_threads[i], NULL, worker_fn, (void *)(intptr_t)i) != 0) {
             perror("pthread_create worker");
         }
     }
 
+    if (stats_interval > 0 && pthread_create(&stats_thread, NULL, stats_fn, NULL) != 0) {
+        perror("pthread_create stats");
+        stats_interval = 0;
+    }
+    if (versions.ttl > 0) {
+        if (pthread_create(&sweep_thread, NULL, sweep_fn, NULL) == 0) sweeping = 1;
+        else perror("pthread_create sweep");
+    }
+
     listen_fd = setup_listener(port);
     if (listen_fd < 0) {
         fprintf(stderr, "Failed to setup listener\n");
-        cq_close(&client_q);
-        tq_close(&task_q);
-        for (int i = 0; i < CLIENT_POOL_SIZE; ++i) pthread_join(client_threads[i], NULL);
-        for (int i = 0; i < WORKER_POOL_SIZE; ++i) pthread_join(worker_threads[i], NULL);
-        cq_destroy(&client_q);
-        tq_destroy(&task_q);
+        running = 0;
+        shutdown_threads();
         return 1;
     }
 
-    printf("Server listening on port %d\n", port);
+    printf("Server listening on port %d (%d reactors, %s storage I/O)\n", port, num_reactors,
+           sio_backend_name());
 
+    int next = 0;
     while (running) {
         struct sockaddr_in cli_addr;
         socklen_t addrlen = sizeof(cli_addr);
         int clientfd = accept(listen_fd, (struct sockaddr*)&cli_addr, &addrlen);
         if (clientfd < 0) {
-            if (errno == EINTR) continue;
-            perror("accept");
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                struct timespec ts = { 0, 10 * 1000 * 1000 };
+                nanosleep(&ts, NULL); /* out of descriptors: back off briefly */
+                continue;
+            }
+            if (running) perror("accept");
             break;
         }
         char ipstr[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &cli_addr.sin_addr, ipstr, sizeof(ipstr));
         printf("Accepted connection from %s:%d, fd=%d\n", ipstr, ntohs(cli_addr.sin_port), clientfd);
-        if (cq_push(&client_q, clientfd) != 0) {
+        reactor_t *r = &reactors[next];
+        next = (next + 1) % num_reactors;
+        if (cq_push(&r->inbox, clientfd) != 0) {
             close(clientfd);
+            continue;
         }
+        reactor_wake(r);
     }
 
     /* Shutdown */
     running = 0;
-    cq_close(&client_q);
-    tq_close(&task_q);
     if (listen_fd != -1) close(listen_fd);
-
-    for (int i = 0; i < CLIENT_POOL_SIZE; ++i) pthread_join(client_threads[i], NULL);
-    for (int i = 0; i < WORKER_POOL_SIZE; ++i) pthread_join(worker_threads[i], NULL);
-
-    cq_destroy(&client_q);
-    tq_destroy(&task_q);
+    shutdown_threads();
 
     printf("Server shutdown cleanly\n");
     return 0;
@@ -0,0 +1,22 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_LEN 32
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t bytes;          // total message length so far
+    unsigned char buf[64];   // partial block
+    size_t buf_len;
+} sha256_t;
+
+void sha256_init(sha256_t *h);
+void sha256_update(sha256_t *h, const void *data, size_t len);
+void sha256_final(sha256_t *h, unsigned char out[SHA256_LEN]);
+/* One-shot digest of a buffer */
+void sha256(const void *data, size_t len, unsigned char out[SHA256_LEN]);
+
+#endif // SHA256_H
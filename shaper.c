@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+#include "shaper.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NS_PER_SEC 1000000000ull
+
+/* FNV-1a */
+static unsigned sh_hash(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+/* Time the bucket needs to refill n bytes */
+static uint64_t sh_ns(const sh_bucket_t *b, size_t n) {
+    return ((uint64_t)n * NS_PER_SEC + b->rate - 1) / b->rate;
+}
+
+static void sh_bucket_init(sh_bucket_t *b, uint64_t rate) {
+    atomic_init(&b->tat, 0);
+    b->rate = rate;
+    b->burst_ns = 0;
+    if (!rate) return;
+    uint64_t burst = rate * SH_BURST_MS / 1000;
+    b->burst_ns = sh_ns(b, burst > SH_BURST_MIN ? burst : SH_BURST_MIN);
+}
+
+int sh_init(shaper_t *s) {
+    memset(s, 0, sizeof(*s));
+    for (int d = 0; d < SH_DIRS; ++d) sh_bucket_init(&s->global[d], 0);
+    return pthread_mutex_init(&s->lock, NULL) == 0 ? 0 : -1;
+}
+
+void sh_destroy(shaper_t *s) {
+    for (int i = 0; i < SH_USER_BUCKETS; ++i) {
+        while (s->users[i]) {
+            sh_user_t *u = s->users[i];
+            s->users[i] = u->next;
+            free(u->user);
+            free(u);
+        }
+    }
+    while (s->rules) {
+        sh_rule_t *r = s->rules;
+        s->rules = r->next;
+        free(r->user);
+        free(r);
+    }
+    pthread_mutex_destroy(&s->lock);
+}
+
+int sh_parse_rate(const char *text, uint64_t *rate) {
+    char *end;
+    unsigned long long n = strtoull(text, &end, 10);
+    if (end == text) return -1;
+    switch (*end) {
+    case 'g': case 'G': n *= 1024;  /* fall through */
+    case 'm': case 'M': n *= 1024;  /* fall through */
+    case 'k': case 'K': n *= 1024; ++end; break;
+    default: break;
+    }
+    if (*end != '\0') return -1;
+    *rate = n;
+    return 0;
+}
+
+static sh_rule_t *sh_rule_find(shaper_t *s, const char *user) {
+    for (sh_rule_t *r = s->rules; r; r = r->next) {
+        if (strcmp(r->user, user) == 0) return r;
+    }
+    return NULL;
+}
+
+int sh_set_rate(shaper_t *s, const char *user, sh_dir_t d, uint64_t rate) {
+    if (!user) {
+        sh_bucket_init(&s->global[d], rate);
+        return 0;
+    }
+    pthread_mutex_lock(&s->lock);
+    sh_rule_t *r = sh_rule_find(s, user);
+    if (!r && (r = calloc(1, sizeof(sh_rule_t)))) {
+        if ((r->user = strdup(user))) {
+            r->next = s->rules;
+            s->rules = r;
+        } else {
+            free(r);
+            r = NULL;
+        }
+    }
+    if (r) {
+        r->rate[d] = rate;
+        r->set[d] = 1;
+        if (rate) s->per_user = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return r ? 0 : -1;
+}
+
+sh_user_t *sh_user(shaper_t *s, const char *user) {
+    if (!s->per_user) return NULL;
+    unsigned h = sh_hash(user) % SH_USER_BUCKETS;
+    pthread_mutex_lock(&s->lock);
+    sh_user_t *u = s->users[h];
+    while (u && strcmp(u->user, user) != 0) u = u->next;
+    if (!u && (u = calloc(1, sizeof(sh_user_t)))) {
+        if (!(u->user = strdup(user))) {
+            free(u);
+            u = NULL;
+        } else {
+            sh_rule_t *own = sh_rule_find(s, user), *all = sh_rule_find(s, "*");
+            for (int d = 0; d < SH_DIRS; ++d) {
+                sh_rule_t *r = own && own->set[d] ? own : all;
+                sh_bucket_init(&u->b[d], r && r->set[d] ? r->rate[d] : 0);
+            }
+            u->next = s->users[h];
+            s->users[h] = u;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return u;
+}
+
+/* Room in one bucket, capped at want; 0 with *wait_ns set if there is too little */
+static size_t sh_room(sh_bucket_t *b, uint64_t now, size_t want, uint64_t *wait_ns) {
+    if (!b->rate) return want;
+    uint64_t tat = atomic_load_explicit(&b->tat, memory_order_relaxed);
+    uint64_t base = tat > now ? tat : now, limit = now + b->burst_ns;
+    size_t need = want < SH_GRANT_MIN ? want : SH_GRANT_MIN;
+    uint64_t room = base < limit ? (limit - base) * b->rate / NS_PER_SEC : 0;
+    if (room >= need) return room < want ? (size_t)room : want;
+    /* the bucket is full enough once base + need / rate is within the burst */
+    uint64_t ready = base + sh_ns(b, need);
+    *wait_ns = ready > limit ? ready - limit : 1;
+    return 0;
+}
+
+size_t sh_allow(shaper_t *s, sh_user_t *u, sh_dir_t d, uint64_t now, size_t want, uint64_t *wait_ns) {
+    if (u) want = sh_room(&u->b[d], now, want, wait_ns);
+    if (want) want = sh_room(&s->global[d], now, want, wait_ns);
+    return want;
+}
+
+static void sh_take(sh_bucket_t *b, uint64_t now, size_t n) {
+    if (!b->rate) return;
+    uint64_t cost = sh_ns(b, n);
+    uint64_t tat = atomic_load_explicit(&b->tat, memory_order_relaxed), next;
+    do {
+        next = (tat > now ? tat : now) + cost;
+    } while (!atomic_compare_exchange_weak_explicit(&b->tat, &tat, next, memory_order_relaxed,
+                                                    memory_order_relaxed));
+}
+
+void sh_charge(shaper_t *s, sh_user_t *u, sh_dir_t d, uint64_t now, size_t n) {
+    if (u) sh_take(&u->b[d], now, n);
+    sh_take(&s->global[d], now, n);
+}
@@ -0,0 +1,78 @@
+#ifndef SHAPER_H
+#define SHAPER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SH_USER_BUCKETS 256
+#define SH_BURST_MS 50             // a bucket holds this much of its rate...
+#define SH_BURST_MIN (64 * 1024)   // ...but never less than this many bytes
+#define SH_GRANT_MIN (16 * 1024)   // wait for this much room rather than send in dribbles
+
+typedef enum {
+    SH_IN,    // upload bodies received
+    SH_OUT,   // download bodies sent
+    SH_DIRS
+} sh_dir_t;
+
+/*
+ * Token bucket kept as a single "theoretical arrival time" (GCRA): the
+ * moment the bucket would be full again. Sending n bytes moves it forward
+ * by n / rate; the bucket is empty once it is more than the burst ahead of
+ * now. One compare-and-swap per send or receive call, no lock.
+ */
+typedef struct {
+    _Atomic uint64_t tat;  // ns (mx_now clock)
+    uint64_t rate;         // bytes per second, 0 = unlimited
+    uint64_t burst_ns;
+} sh_bucket_t;
+
+typedef struct sh_user {
+    char *user;
+    sh_bucket_t b[SH_DIRS];
+    struct sh_user *next;
+} sh_user_t;
+
+typedef struct sh_rule {
+    char *user;            // "*": every user, for directions their own rule leaves out
+    uint64_t rate[SH_DIRS];
+    int set[SH_DIRS];
+    struct sh_rule *next;
+} sh_rule_t;
+
+/*
+ * Bandwidth limits on file bodies: one bucket per direction for the whole
+ * server and one per user. A user's buckets are created on first use and
+ * shared by all of their sessions; after that the table lock is never
+ * taken again for them.
+ */
+typedef struct {
+    sh_bucket_t global[SH_DIRS];
+    sh_rule_t *rules;
+    int per_user;          // some rule limits users
+    pthread_mutex_t lock;  // users and rules
+    sh_user_t *users[SH_USER_BUCKETS];
+} shaper_t;
+
+int sh_init(shaper_t *s);
+void sh_destroy(shaper_t *s);
+/* "<n>[k|m|g]" bytes per second, 1024-based; -1 if malformed */
+int sh_parse_rate(const char *text, uint64_t *rate);
+/* Limit the whole server (user NULL), every user (user "*") or one user.
+ * Call before the first sh_user. */
+int sh_set_rate(shaper_t *s, const char *user, sh_dir_t d, uint64_t rate);
+/* The user's buckets, NULL if no user is limited or out of memory */
+sh_user_t *sh_user(shaper_t *s, const char *user);
+
+static inline int sh_limited(const shaper_t *s, const sh_user_t *u, sh_dir_t d) {
+    return s->global[d].rate || (u && u->b[d].rate);
+}
+/* Bytes (at most want) that may move now. 0 if the user's or the server's
+ * bucket is empty; *wait_ns is then how long until there is room. */
+size_t sh_allow(shaper_t *s, sh_user_t *u, sh_dir_t d, uint64_t now, size_t want, uint64_t *wait_ns);
+/* n bytes moved: take them from both buckets */
+void sh_charge(shaper_t *s, sh_user_t *u, sh_dir_t d, uint64_t now, size_t n);
+
+#endif // SHAPER_H
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE /* syscall(), MAP_POPULATE */
+#include "sio.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+
+static const sio_backend_t *sio_chosen = &sio_blocking;
+static _Thread_local sio_t *sio_self;
+/* the blocking backend keeps no state, so threads that cannot get their own share this */
+static sio_t sio_plain = { &sio_blocking, NULL };
+
+/* Blocking backend: each op is the plain system call, in order */
+
+static int blocking_init(sio_t *io, unsigned depth) {
+    (void)depth;
+    io->state = NULL;
+    return 0;
+}
+
+static void blocking_destroy(sio_t *io) {
+    (void)io;
+}
+
+static long blocking_rw(sio_op_t *op) {
+    size_t done = 0;
+    while (done < op->len) {
+        char *p = (char *)op->buf + done;
+        ssize_t n = op->op == SIO_READ ? pread(op->fd, p, op->len - done, op->off + (off_t)done)
+                                       : pwrite(op->fd, p, op->len - done, op->off + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -errno;
+        if (n == 0) break;
+        done += (size_t)n;
+    }
+    return (long)done;
+}
+
+static int blocking_run(sio_t *io, sio_op_t *ops, size_t n) {
+    (void)io;
+    for (size_t i = 0; i < n; ++i) {
+        sio_op_t *op = &ops[i];
+        long r;
+        switch (op->op) {
+        case SIO_OPEN:
+            r = open(op->path, op->flags, op->mode);
+            break;
+        case SIO_READ:
+        case SIO_WRITE:
+            op->res = blocking_rw(op);
+            continue;
+        case SIO_CLOSE:
+            r = close(op->fd);
+            break;
+        case SIO_UNLINK:
+            r = unlink(op->path);
+            break;
+        case SIO_STATX:
+            r = syscall(SYS_statx, AT_FDCWD, op->path, op->flags, STATX_BASIC_STATS, op->buf);
+            break;
+        default:
+            r = -1;
+            errno = EINVAL;
+        }
+        op->res = r < 0 ? -errno : r;
+    }
+    return 0;
+}
+
+const sio_backend_t sio_blocking = { "blocking", blocking_init, blocking_destroy, blocking_run };
+
+/* io_uring backend, on raw system calls */
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+} sio_ring_t;
+
+static const int uring_needed[] = {
+    IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_CLOSE,
+    IORING_OP_UNLINKAT, IORING_OP_STATX
+};
+
+/* Does the kernel know every opcode we submit? */
+static int uring_probe(int fd) {
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *p = calloc(1, len);
+    if (!p) return -1;
+    int r = (int)syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, p, 256);
+    for (size_t i = 0; r == 0 && i < sizeof(uring_needed) / sizeof(uring_needed[0]); ++i) {
+        int op = uring_needed[i];
+        if (op > p->last_op || !(p->ops[op].flags & IO_URING_OP_SUPPORTED)) r = -1;
+    }
+    free(p);
+    return r;
+}
+
+static void uring_unmap(sio_ring_t *q) {
+    if (q->sqes && q->sqes != MAP_FAILED) munmap(q->sqes, q->sqes_len);
+    if (q->cq_ptr && q->cq_ptr != MAP_FAILED && q->cq_ptr != q->sq_ptr) munmap(q->cq_ptr, q->cq_len);
+    if (q->sq_ptr && q->sq_ptr != MAP_FAILED) munmap(q->sq_ptr, q->sq_len);
+    if (q->fd >= 0) close(q->fd);
+}
+
+static int uring_init(sio_t *io, unsigned depth) {
+    sio_ring_t *q = calloc(1, sizeof(sio_ring_t));
+    if (!q) return -1;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    q->fd = (int)syscall(__NR_io_uring_setup, depth, &p);
+    if (q->fd < 0 || uring_probe(q->fd) != 0) goto fail;
+
+    q->entries = p.sq_entries;
+    q->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    q->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && q->cq_len > q->sq_len) q->sq_len = q->cq_len;
+    q->sq_ptr = mmap(NULL, q->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     q->fd, IORING_OFF_SQ_RING);
+    if (q->sq_ptr == MAP_FAILED) goto fail;
+    q->cq_ptr = single ? q->sq_ptr
+                       : mmap(NULL, q->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                              q->fd, IORING_OFF_CQ_RING);
+    if (q->cq_ptr == MAP_FAILED) goto fail;
+    q->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    q->sqes = mmap(NULL, q->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   q->fd, IORING_OFF_SQES);
+    if (q->sqes == MAP_FAILED) goto fail;
+
+    char *sq = q->sq_ptr, *cq = q->cq_ptr;
+    q->sq_head = (unsigned *)(sq + p.sq_off.head);
+    q->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    q->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    q->sq_array = (unsigned *)(sq + p.sq_off.array);
+    q->cq_head = (unsigned *)(cq + p.cq_off.head);
+    q->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    q->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    q->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    io->state = q;
+    return 0;
+fail:
+    uring_unmap(q);
+    free(q);
+    return -1;
+}
+
+static void uring_destroy(sio_t *io) {
+    sio_ring_t *q = io->state;
+    if (!q) return;
+    uring_unmap(q);
+    free(q);
+    io->state = NULL;
+}
+
+/* Fill the next submission slot for ops[i]; reads and writes resume at op->res */
+static void uring_prep(sio_ring_t *q, sio_op_t *ops, size_t i) {
+    unsigned tail = *q->sq_tail, idx = tail & *q->sq_mask;
+    struct io_uring_sqe *sqe = &q->sqes[idx];
+    sio_op_t *op = &ops[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = i;
+    switch (op->op) {
+    case SIO_OPEN:
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)op->path;
+        sqe->len = op->mode;
+        sqe->open_flags = (unsigned)op->flags;
+        break;
+    case SIO_READ:
+    case SIO_WRITE:
+        sqe->opcode = op->op == SIO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = op->fd;
+        sqe->addr = (unsigned long)((char *)op->buf + op->res);
+        sqe->len = (unsigned)(op->len - (size_t)op->res);
+        sqe->off = (unsigned long long)(op->off + op->res);
+        break;
+    case SIO_CLOSE:
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = op->fd;
+        break;
+    case SIO_UNLINK:
+        sqe->opcode = IORING_OP_UNLINKAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)op->path;
+        break;
+    case SIO_STATX:
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (unsigned long)op->path;
+        sqe->len = STATX_BASIC_STATS;
+        sqe->off = (unsigned long)op->buf;
+        sqe->statx_flags = (unsigned)op->flags;
+        break;
+    default:
+        sqe->opcode = IORING_OP_NOP;
+        break;
+    }
+    q->sq_array[idx] = idx;
+    __atomic_store_n(q->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static int uring_run(sio_t *io, sio_op_t *ops, size_t n) {
+    sio_ring_t *q = io->state;
+    size_t next = 0, done = 0;
+    unsigned inflight = 0;
+    for (size_t i = 0; i < n; ++i) ops[i].res = 0;
+    while (done < n) {
+        while (next < n && inflight < q->entries) {
+            uring_prep(q, ops, next++);
+            inflight++;
+        }
+        unsigned pending = *q->sq_tail - __atomic_load_n(q->sq_head, __ATOMIC_ACQUIRE);
+        int r = (int)syscall(__NR_io_uring_enter, q->fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return -1;
+
+        unsigned head = *q->cq_head, tail = __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            struct io_uring_cqe *cqe = &q->cqes[head & *q->cq_mask];
+            sio_op_t *op = &ops[cqe->user_data];
+            inflight--;
+            int rw = op->op == SIO_READ || op->op == SIO_WRITE;
+            if (cqe->res < 0) {
+                op->res = cqe->res;
+            } else if (rw && cqe->res > 0 && (size_t)(op->res + cqe->res) < op->len) {
+                /* short transfer: carry on from where it stopped */
+                op->res += cqe->res;
+                uring_prep(q, ops, cqe->user_data);
+                inflight++;
+                continue;
+            } else {
+                op->res = rw ? op->res + cqe->res : cqe->res;
+            }
+            done++;
+        }
+        __atomic_store_n(q->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+const sio_backend_t sio_uring = { "io_uring", uring_init, uring_destroy, uring_run };
+
+int sio_open(sio_t *io, const sio_backend_t *be, unsigned depth) {
+    io->be = be;
+    io->state = NULL;
+    return be->init(io, depth);
+}
+
+void sio_close(sio_t *io) {
+    io->be->destroy(io);
+}
+
+int sio_run(sio_t *io, sio_op_t *ops, size_t n) {
+    return n ? io->be->run(io, ops, n) : 0;
+}
+
+int sio_setup(sio_kind_t kind) {
+    sio_chosen = &sio_blocking;
+    if (kind == SIO_BLOCKING) return 0;
+    sio_t probe;
+    if (sio_open(&probe, &sio_uring, SIO_DEPTH) != 0) return -1;
+    sio_close(&probe);
+    sio_chosen = &sio_uring;
+    return 0;
+}
+
+const char *sio_backend_name(void) {
+    return sio_chosen->name;
+}
+
+sio_t *sio_thread(void) {
+    if (sio_self) return sio_self;
+    sio_t *io = malloc(sizeof(sio_t));
+    if (io && sio_open(io, sio_chosen, SIO_DEPTH) != 0) {
+        free(io);
+        io = NULL;
+    }
+    sio_self = io ? io : &sio_plain;
+    return sio_self;
+}
+
+void sio_thread_exit(void) {
+    if (sio_self && sio_self != &sio_plain) {
+        sio_close(sio_self);
+        free(sio_self);
+    }
+    sio_self = NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef SIO_H
+#define SIO_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SIO_DEPTH 64       // ring entries per thread
+
+typedef enum {
+    SIO_BLOCKING,          // the default
+    SIO_URING              // opt-in: io_bench shows no consistent gain over blocking
+} sio_kind_t;
+
+typedef enum {
+    SIO_OPEN,              // path, flags, mode -> fd
+    SIO_READ,              // fd, buf, len, off -> bytes (short only at EOF)
+    SIO_WRITE,             // fd, buf, len, off -> bytes
+    SIO_CLOSE,             // fd
+    SIO_UNLINK,            // path
+    SIO_STATX              // path -> struct statx in buf
+} sio_opcode_t;
+
+/* One storage operation; ops passed to sio_run together are independent */
+typedef struct {
+    sio_opcode_t op;
+    int fd;
+    const char *path;
+    int flags;
+    mode_t mode;
+    void *buf;
+    size_t len;
+    off_t off;
+    long res;              // fd, byte count or 0; -errno on failure
+} sio_op_t;
+
+struct sio;
+
+/* A storage backend: runs a batch of operations and waits for all of them */
+typedef struct {
+    const char *name;
+    int (*init)(struct sio *io, unsigned depth);
+    void (*destroy)(struct sio *io);
+    int (*run)(struct sio *io, sio_op_t *ops, size_t n);
+} sio_backend_t;
+
+/*
+ * Per-thread storage I/O. Callers describe a batch of file operations (all
+ * the chunk blobs a download reads, all the new chunks an upload writes)
+ * and the backend runs them: the blocking one does them in order, the
+ * io_uring one submits up to SIO_DEPTH at once and reaps completions, so a
+ * worker keeps a deep queue on the device instead of one request.
+ */
+typedef struct sio {
+    const sio_backend_t *be;
+    void *state;           // backend's own, e.g. the mapped ring
+} sio_t;
+
+extern const sio_backend_t sio_blocking;
+extern const sio_backend_t sio_uring;
+
+/* Pick the backend for all threads; falls back to blocking (returning -1)
+ * if io_uring cannot be set up */
+int sio_setup(sio_kind_t kind);
+const char *sio_backend_name(void);
+
+/* This thread's instance, created on first use */
+sio_t *sio_thread(void);
+/* Release this thread's instance, if any */
+void sio_thread_exit(void);
+
+int sio_open(sio_t *io, const sio_backend_t *be, unsigned depth);
+void sio_close(sio_t *io);
+/* Run n independent ops; results land in ops[i].res. -1 only if the
+ * backend itself failed, individual errors are reported per op. */
+int sio_run(sio_t *io, sio_op_t *ops, size_t n);
+
+#endif // SIO_H
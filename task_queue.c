@@ -2,92 +2,128 @@
 #include "task_queue.h"
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 int tq_init(task_queue_t *q, int capacity) {
     if (capacity <= 0) return -1;
-    q->items = calloc(capacity, sizeof(task_t*));
-    if (!q->items) return -1;
-    q->capacity = capacity;
-    q->front = q->rear = q->size = 0;
-    q->closed = 0;
-    if (pthread_mutex_init(&q->lock, NULL) != 0) return -1;
-    if (pthread_cond_init(&q->not_empty, NULL) != 0) return -1;
-    if (pthread_cond_init(&q->not_full, NULL) != 0) return -1;
-    return 0;
+    return mpmc_init(&q->ring, (size_t)capacity);
 }
 
 void tq_destroy(task_queue_t *q) {
     if (!q) return;
-    free(q->items);
-    pthread_mutex_destroy(&q->lock);
-    pthread_cond_destroy(&q->not_empty);
-    pthread_cond_destroy(&q->not_full);
+    mpmc_destroy(&q->ring);
 }
 
 int tq_push(task_queue_t *q, task_t *t) {
-    int ret = 0;
-    pthread_mutex_lock(&q->lock);
-    while (q->size == q->capacity && !q->closed) {
-        pthread_cond_wait(&q->not_full, &q->lock);
-    }
-    if (q->closed) {
-        ret = -1;
-    } else {
-        q->items[q->rear] = t;
-        q->rear = (q->rear + 1) % q->capacity;
-        q->size++;
-        pthread_cond_signal(&q->not_empty);
-        ret = 0;
-    }
-    pthread_mutex_unlock(&q->lock);
-    return ret;
+    return mpmc_push(&q->ring, t);
 }
 
 int tq_pop(task_queue_t *q, task_t **t) {
-    int ret = 0;
-    pthread_mutex_lock(&q->lock);
-    while (q->size == 0 && !q->closed) {
-        pthread_cond_wait(&q->not_empty, &q->lock);
-    }
-    if (q->size == 0 && q->closed) {
-        ret = -1;
+    void *v;
+    if (mpmc_pop(&q->ring, &v) != 0) return -1;
+    *t = v;
+    return 0;
+}
+
+int tq_try_push(task_queue_t *q, task_t *t) {
+    return mpmc_try_push(&q->ring, t);
+}
+
+int tq_try_pop(task_queue_t *q, task_t **t) {
+    void *v;
+    if (mpmc_try_pop(&q->ring, &v) != 0) return -1;
+    *t = v;
+    return 0;
+}
+
+size_t tq_size(task_queue_t *q) {
+    return mpmc_size(&q->ring);
+}
+
+void tq_close(task_queue_t *q) {
+    mpmc_close(&q->ring);
+}
+
+/* Free list of recycled tasks; tasks are normally released by the thread that allocated them */
+#define TASK_POOL_MAX 256
+#define TASK_KEEP_DATA (64 * 1024) /* response buffers up to this size survive recycling */
+
+static _Thread_local task_t *task_pool;
+static _Thread_local int task_pool_len;
+
+task_t *task_alloc(void) {
+    task_t *t = task_pool;
+    if (t) {
+        task_pool = t->next;
+        task_pool_len--;
     } else {
-        *t = q->items[q->front];
-        q->front = (q->front + 1) % q->capacity;
-        q->size--;
-        pthread_cond_signal(&q->not_full);
-        ret = 0;
+        t = calloc(1, sizeof(task_t));
+        if (!t) return NULL;
     }
-    pthread_mutex_unlock(&q->lock);
-    return ret;
+    void *data = t->resp.data;
+    size_t cap = t->resp.data_cap;
+    t->type = TASK_LIST;
+    t->username[0] = t->filename[0] = t->src_path[0] = '\0';
+    t->data_len = 0;
+    t->tagged = 0;
+    t->tag = 0;
+    t->ranged = 0;
+    t->range_off = t->range_len = 0;
+    t->part_size = 0;
+    t->lz = 0;
+    t->list_limit = 0;
+    t->queued_ns = 0;
+    memset(&t->resp, 0, sizeof(t->resp));
+    t->resp.data = data;
+    t->resp.data_cap = cap;
+    t->resp.fd = -1;
+    t->on_done = NULL;
+    t->on_release = NULL;
+    t->ctx = NULL;
+    t->next = NULL;
+    return t;
 }
 
-void tq_close(task_queue_t *q) {
-    pthread_mutex_lock(&q->lock);
-    q->closed = 1;
-    pthread_cond_broadcast(&q->not_empty);
-    pthread_cond_broadcast(&q->not_full);
-    pthread_mutex_unlock(&q->lock);
+void task_release(task_t *t) {
+    if (!t) return;
+    if (t->on_release) t->on_release(t);
+    t->on_release = NULL;
+    if (t->resp.fd >= 0) close(t->resp.fd);
+    t->resp.fd = -1;
+    if (t->resp.data_cap > TASK_KEEP_DATA) {
+        free(t->resp.data);
+        t->resp.data = NULL;
+        t->resp.data_cap = 0;
+    }
+    if (task_pool_len >= TASK_POOL_MAX) {
+        free(t->resp.data);
+        free(t);
+        return;
+    }
+    t->next = task_pool;
+    task_pool = t;
+    task_pool_len++;
 }
 
-task_response_t *task_response_create() {
-    task_response_t *r = calloc(1, sizeof(task_response_t));
-    if (!r) return NULL;
-    pthread_mutex_init(&r->lock, NULL);
-    pthread_cond_init(&r->cond, NULL);
-    r->done = 0;
-    r->success = 0;
-    r->msg = NULL;
-    r->data = NULL;
-    r->data_len = 0;
-    return r;
+/* Free the calling thread's cached tasks (at thread exit) */
+void task_pool_drain(void) {
+    while (task_pool) {
+        task_t *t = task_pool;
+        task_pool = t->next;
+        free(t->resp.data);
+        free(t);
+    }
+    task_pool_len = 0;
 }
 
-void task_response_destroy(task_response_t *r) {
-    if (!r) return;
-    if (r->msg) free(r->msg);
-    if (r->data) free(r->data);
-    pthread_mutex_destroy(&r->lock);
-    pthread_cond_destroy(&r->cond);
-    free(r);
+/* Make room for len bytes of response data, keeping what is already there */
+int task_resp_reserve(task_t *t, size_t len) {
+    if (len <= t->resp.data_cap) return 0;
+    size_t cap = t->resp.data_cap ? t->resp.data_cap : 1024;
+    while (cap < len) cap *= 2;
+    void *nb = realloc(t->resp.data, cap);
+    if (!nb) return -1;
+    t->resp.data = nb;
+    t->resp.data_cap = cap;
+    return 0;
 }
@@ -3,52 +3,82 @@
 
 #include <pthread.h>
 #include <stdint.h>
+#include "mpmc.h"
 
 typedef enum {
     TASK_LIST,
     TASK_UPLOAD,
     TASK_DOWNLOAD,
-    TASK_DELETE
+    TASK_DELETE,
+    TASK_SIGNATURES,  // block signatures of a stored file, for delta uploads
+    TASK_DELTA,       // rebuild a file from a staged delta
+    TASK_UPLOAD_INIT, // resumable upload: hand out a token
+    TASK_UPLOAD_PART, // resumable upload: a part was written, publish once complete
+    TASK_UPLOAD_STATUS, // resumable upload: report the bytes held so far
+    TASK_STATS,       // server counters, answered by the reactor without a worker
+    TASK_TYPES
 } task_type_t;
 
+#define TASK_NAME_MAX 256   // username buffer
+#define TASK_PATH_MAX 512   // filename / staged path buffers
+
 typedef struct task_response {
-    pthread_mutex_t lock;
-    pthread_cond_t cond;
-    int done;         // 0 = pending, 1 = done
     int success;      // 0 = fail, 1 = success
-    char *msg;        // textual message (allocated by worker)
-    void *data;       // for download/list results (allocated by worker)
-    size_t data_len;
+    const char *msg;  // textual reply (static string)
+    void *data;       // for list results; buffer is kept when the task is recycled
+    size_t data_cap;
+    int fd;           // for download: open file to stream, -1 if none
+    size_t offset;    // for download: first byte to send, in fd or in the first chunk
+    size_t total;     // for ranged download: size of the whole file
+    size_t nchunks;   // for download from the chunk store: data holds this many cs_ref_t
+    void *cached;     // for download from the file cache: fc_entry_t, body starts at offset
+    size_t data_len;  // bytes in data, or size of the download
 } task_response_t;
 
+/*
+ * Tasks come from a per-thread free list (task_alloc/task_release) and carry
+ * their names and response inline, so a steady-state request allocates
+ * nothing. Completion is reported through on_done instead of a per-response
+ * mutex and condvar.
+ */
 typedef struct task {
     task_type_t type;
-    char *username;   // owner
-    char *filename;   // may be NULL for LIST
-    void *data;       // for upload: file bytes (allocated by client thread)
-    size_t data_len;  // data length for upload
-    task_response_t *resp; // response pointer (client waits on this)
+    char username[TASK_NAME_MAX];   // owner
+    char filename[TASK_PATH_MAX];   // LIST: name prefix
+    size_t data_len;  // for upload/delta: size of the new file
+    char src_path[TASK_PATH_MAX];   // for upload/delta: staged body to publish; LIST: cursor
+    int tagged;       // pipelined request: reply carries "#<tag> " and may be out of order
+    unsigned long long tag;
+    int ranged;       // DOWNLOAD <name> <offset> [<len>]
+    size_t range_off;
+    size_t range_len; // 0 = to the end of the file; UPLOAD-PART: the part's length
+    size_t part_size; // multipart UPLOAD-INIT/PART: size of every part but the last; the part's offset is range_off
+    int lz;           // DOWNLOAD body goes out in LZ frames
+    size_t list_limit; // LIST page size
+    uint64_t queued_ns; // when it was handed to the worker pool (mx_now)
+    task_response_t resp;
+    void (*on_done)(struct task *t); // invoked by the worker once resp is filled
+    void (*on_release)(struct task *t); // drops what the worker attached to resp
+    void *ctx;        // owner of the task (session), opaque to the pool
+    struct task *next; // intrusive link for completion lists and the free list
 } task_t;
 
 typedef struct {
-    task_t **items;
-    int capacity;
-    int front;
-    int rear;
-    int size;
-    pthread_mutex_t lock;
-    pthread_cond_t not_empty;
-    pthread_cond_t not_full;
-    int closed;
+    mpmc_t ring;      // lock-free bounded ring, see mpmc.h
 } task_queue_t;
 
 int tq_init(task_queue_t *q, int capacity);
 void tq_destroy(task_queue_t *q);
 int tq_push(task_queue_t *q, task_t *t);
 int tq_pop(task_queue_t *q, task_t **t);
+int tq_try_push(task_queue_t *q, task_t *t);
+int tq_try_pop(task_queue_t *q, task_t **t);
+size_t tq_size(task_queue_t *q);
 void tq_close(task_queue_t *q);
 
-task_response_t *task_response_create();
-void task_response_destroy(task_response_t *r);
+task_t *task_alloc(void);
+void task_release(task_t *t);
+int task_resp_reserve(task_t *t, size_t len);
+void task_pool_drain(void);
 
 #endif // TASK_QUEUE_H
@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+#include "versions.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* FNV-1a over "<user>/<name>" */
+static unsigned vs_hash(const char *user, const char *name) {
+    unsigned h = 2166136261u;
+    while (*user) { h ^= (unsigned char)*user++; h *= 16777619u; }
+    h ^= '/'; h *= 16777619u;
+    while (*name) { h ^= (unsigned char)*name++; h *= 16777619u; }
+    return h;
+}
+
+int vs_init(version_store_t *v, const char *root, time_t ttl) {
+    v->root = strdup(root);
+    if (!v->root) return -1;
+    v->ttl = ttl;
+    for (int i = 0; i < VS_STRIPES; ++i) {
+        if (pthread_mutex_init(&v->locks[i], NULL) != 0) return -1;
+    }
+    return 0;
+}
+
+void vs_destroy(version_store_t *v) {
+    if (!v) return;
+    for (int i = 0; i < VS_STRIPES; ++i) pthread_mutex_destroy(&v->locks[i]);
+    free(v->root);
+}
+
+void vs_lock(version_store_t *v, const char *user, const char *name) {
+    pthread_mutex_lock(&v->locks[vs_hash(user, name) % VS_STRIPES]);
+}
+
+void vs_unlock(version_store_t *v, const char *user, const char *name) {
+    pthread_mutex_unlock(&v->locks[vs_hash(user, name) % VS_STRIPES]);
+}
+
+/* Highest version of name still kept, 0 if none */
+static unsigned long vs_last_kept(const version_store_t *v, const char *user, const char *name) {
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s/%s/" CS_VERSIONS_DIR, v->root, user);
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+    size_t len = strlen(name);
+    unsigned long last = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        const char *p = entry->d_name;
+        if (strncmp(p, name, len) != 0 || p[len] != '@') continue;
+        char *end;
+        unsigned long n = strtoul(p + len + 1, &end, 10);
+        if (*end == '\0' && n > last) last = n;
+    }
+    closedir(d);
+    return last;
+}
+
+unsigned long vs_next(version_store_t *v, const char *user, const char *name,
+                      unsigned long *current) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s/%s", v->root, user, name);
+    if (cs_file_version(path, current) == 0) return *current + 1;
+    /* new or deleted file: carry on after any version still kept */
+    *current = 0;
+    return vs_last_kept(v, user, name) + 1;
+}
+
+void vs_path(const version_store_t *v, const char *user, const char *name,
+             unsigned long version, char *out, size_t len) {
+    if (v->ttl > 0) snprintf(out, len, "%s/%s/" CS_VERSIONS_DIR "/%s@%lu", v->root, user, name, version);
+    else if (len) out[0] = '\0';
+}
+
+/* A kept version, for dropping the oldest beyond VS_KEEP_MAX */
+typedef struct {
+    struct timespec ctime;
+    char name[256];
+} vs_kept_t;
+
+static int vs_kept_cmp(const void *a, const void *b) {
+    const struct timespec *x = &((const vs_kept_t *)a)->ctime, *y = &((const vs_kept_t *)b)->ctime;
+    if (x->tv_sec != y->tv_sec) return x->tv_sec < y->tv_sec ? -1 : 1;
+    return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/* Before the chunk store has counted references there are none to release */
+static void vs_drop(chunk_store_t *s, const char *path) {
+    if (s) cs_drop_file(s, path);
+    else unlink(path);
+}
+
+void vs_sweep(version_store_t *v, chunk_store_t *s, const char *user) {
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s/%s/" CS_VERSIONS_DIR, v->root, user);
+    DIR *d = opendir(dir);
+    if (!d) return;
+    time_t now = time(NULL);
+    vs_kept_t *kept = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        char path[1024];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        /* ctime: link() and rename() set it when the version is replaced */
+        if (lstat(path, &st) != 0) continue;
+        if (now - st.st_ctime >= v->ttl) {
+            vs_drop(s, path);
+            continue;
+        }
+        if (n == cap) {
+            size_t ncap = cap ? 2 * cap : 2 * VS_KEEP_MAX;
+            vs_kept_t *grown = realloc(kept, ncap * sizeof(vs_kept_t));
+            if (!grown) continue;
+            kept = grown;
+            cap = ncap;
+        }
+        kept[n].ctime = st.st_ctim;
+        snprintf(kept[n].name, sizeof(kept[n].name), "%s", entry->d_name);
+        n++;
+    }
+    closedir(d);
+    if (n > VS_KEEP_MAX) {
+        qsort(kept, n, sizeof(vs_kept_t), vs_kept_cmp);
+        for (size_t i = 0; i < n - VS_KEEP_MAX; ++i) {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s", dir, kept[i].name);
+            vs_drop(s, path);
+        }
+    }
+    free(kept);
+}
+
+void vs_sweep_all(version_store_t *v, chunk_store_t *s) {
+    DIR *d = opendir(v->root);
+    if (!d) return;
+    struct dirent *u;
+    while ((u = readdir(d)) != NULL) {
+        if (u->d_name[0] == '.') continue; /* ., .., the blob directory */
+        vs_sweep(v, s, u->d_name);
+    }
+    closedir(d);
+}
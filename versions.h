@@ -0,0 +1,45 @@
+#ifndef VERSIONS_H
+#define VERSIONS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include "chunkstore.h"
+
+#define VS_STRIPES 64
+#define VS_KEEP_MAX 16 // kept versions per user; the oldest go first beyond this
+
+/*
+ * Replaced versions of user files. A publish renames the new manifest over
+ * the current one after linking that to <root>/<user>/.versions/<name>@<v>,
+ * where it is kept for ttl seconds; a user keeps VS_KEEP_MAX at most. A
+ * download that opened the old manifest just before the rename can
+ * therefore still pin its chunks; readers never take a lock. Publishes and deletes of one file are serialised by a
+ * striped lock so every publish gets the next version number.
+ */
+typedef struct {
+    char *root;       // storage root, users live in <root>/<user>
+    time_t ttl;       // 0: replaced files are dropped at once
+    pthread_mutex_t locks[VS_STRIPES];   // by user and file name
+} version_store_t;
+
+int vs_init(version_store_t *v, const char *root, time_t ttl);
+void vs_destroy(version_store_t *v);
+
+void vs_lock(version_store_t *v, const char *user, const char *name);
+void vs_unlock(version_store_t *v, const char *user, const char *name);
+
+/* Version the next publish of user/name gets; call with its lock held.
+ * *current is set to the version being replaced, 0 if there is none. */
+unsigned long vs_next(version_store_t *v, const char *user, const char *name,
+                      unsigned long *current);
+/* Where version of user/name is kept once replaced; empty if ttl is 0 */
+void vs_path(const version_store_t *v, const char *user, const char *name,
+             unsigned long version, char *out, size_t len);
+/* Drop the user's kept versions older than ttl, then the oldest beyond
+ * VS_KEEP_MAX. s is NULL before cs_init has counted references. */
+void vs_sweep(version_store_t *v, chunk_store_t *s, const char *user);
+/* vs_sweep for every user under root */
+void vs_sweep_all(version_store_t *v, chunk_store_t *s);
+
+#endif // VERSIONS_H
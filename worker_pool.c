@@ -0,0 +1,217 @@
+#define _POSIX_C_SOURCE 200809L
+#include "worker_pool.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+int wp_init(worker_pool_t *p, int nworkers, int queue_cap) {
+    if (nworkers <= 0 || queue_cap < 2) return -1;
+    p->workers = calloc((size_t)nworkers, sizeof(wp_worker_t));
+    if (!p->workers) return -1;
+    p->n = nworkers;
+    p->cap = (size_t)queue_cap;
+    p->flow_cap = (size_t)queue_cap / 2;
+    atomic_init(&p->nparked, 0);
+    atomic_init(&p->closed, 0);
+    for (int i = 0; i < nworkers; ++i) {
+        wp_worker_t *w = &p->workers[i];
+        if (tq_init(&w->prio, queue_cap) != 0) return -1;
+        pthread_mutex_init(&w->qlock, NULL);
+        for (int f = 0; f < WP_FLOWS; ++f) w->flows[f].next_active = -1;
+        w->act_head = w->act_tail = -1;
+        atomic_init(&w->bulk_len, 0);
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        atomic_init(&w->parked, 0);
+    }
+    return 0;
+}
+
+void wp_destroy(worker_pool_t *p) {
+    if (!p || !p->workers) return;
+    for (int i = 0; i < p->n; ++i) {
+        tq_destroy(&p->workers[i].prio);
+        pthread_mutex_destroy(&p->workers[i].qlock);
+        pthread_mutex_destroy(&p->workers[i].lock);
+        pthread_cond_destroy(&p->workers[i].cond);
+    }
+    free(p->workers);
+    p->workers = NULL;
+}
+
+static void wp_wake(wp_worker_t *w) {
+    pthread_mutex_lock(&w->lock);
+    w->wakeup = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Top bits of a multiplicative hash: independent of the low bits that picked the worker */
+static int wp_flow_of(unsigned hint) {
+    return (int)(((uint32_t)hint * 2654435761u) >> (32 - WP_FLOW_BITS));
+}
+
+/* A part carries only its own bytes; its data_len is the size of the whole file */
+static long wp_cost(const task_t *t) {
+    size_t bytes = t->type == TASK_UPLOAD_PART ? t->range_len : t->data_len;
+    return 1 + (long)(bytes / WP_COST_UNIT);
+}
+
+static void wp_round_append(wp_worker_t *w, int i) {
+    w->flows[i].next_active = -1;
+    if (w->act_tail >= 0) w->flows[w->act_tail].next_active = i; else w->act_head = i;
+    w->act_tail = i;
+}
+
+/* End the head flow's turn (sending it to the back if requeue) and start the next one's */
+static void wp_round_next(wp_worker_t *w, int requeue) {
+    int i = w->act_head;
+    w->act_head = w->flows[i].next_active;
+    if (w->act_head < 0) w->act_tail = -1;
+    if (requeue) wp_round_append(w, i);
+    if (w->act_head >= 0) w->flows[w->act_head].deficit += WP_QUANTUM;
+}
+
+static int wp_bulk_push(worker_pool_t *p, wp_worker_t *w, task_t *t, unsigned hint) {
+    int i = wp_flow_of(hint);
+    wp_flow_t *f = &w->flows[i];
+    pthread_mutex_lock(&w->qlock);
+    if (atomic_load(&p->closed) || atomic_load_explicit(&w->bulk_len, memory_order_relaxed) >= p->cap ||
+        f->len >= p->flow_cap) {
+        pthread_mutex_unlock(&w->qlock);
+        return -1;
+    }
+    t->next = NULL;
+    if (f->tail) f->tail->next = t; else f->head = t;
+    f->tail = t;
+    f->len++;
+    if (!f->active) {
+        f->active = 1;
+        f->deficit = 0;
+        wp_round_append(w, i);
+        /* alone in the round: its turn starts now */
+        if (w->act_head == i) f->deficit = WP_QUANTUM;
+    }
+    atomic_fetch_add(&w->bulk_len, 1);
+    pthread_mutex_unlock(&w->qlock);
+    return 0;
+}
+
+/* Deficit round robin: the head flow runs tasks while its deficit covers them */
+static int wp_bulk_pop(wp_worker_t *w, task_t **out) {
+    if (atomic_load(&w->bulk_len) == 0) return -1;
+    int got = -1;
+    pthread_mutex_lock(&w->qlock);
+    while (w->act_head >= 0) {
+        wp_flow_t *f = &w->flows[w->act_head];
+        long c = wp_cost(f->head);
+        if (c > f->deficit) {
+            wp_round_next(w, 1);
+            continue;
+        }
+        task_t *t = f->head;
+        f->head = t->next;
+        if (!f->head) f->tail = NULL;
+        f->len--;
+        f->deficit -= c;
+        if (!f->head) {
+            /* an idle flow does not bank credit */
+            f->active = 0;
+            f->deficit = 0;
+            wp_round_next(w, 0);
+        }
+        atomic_fetch_sub(&w->bulk_len, 1);
+        t->next = NULL;
+        *out = t;
+        got = 0;
+        break;
+    }
+    pthread_mutex_unlock(&w->qlock);
+    return got;
+}
+
+int wp_submit(worker_pool_t *p, task_t *t, unsigned hint, wp_lane_t lane) {
+    if (atomic_load(&p->closed)) return -1;
+    int target = (int)(hint % (unsigned)p->n);
+    int placed = -1;
+    for (int i = 0; i < p->n; ++i) {
+        int idx = (target + i) % p->n;
+        wp_worker_t *w = &p->workers[idx];
+        int r = lane == WP_PRIO ? tq_try_push(&w->prio, t) : wp_bulk_push(p, w, t, hint);
+        if (r == 0) { placed = idx; break; }
+    }
+    if (placed < 0) return atomic_load(&p->closed) ? -1 : WP_BUSY;
+    /* pair the push with the fence a parking worker makes before rechecking */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&p->workers[placed].parked)) {
+        wp_wake(&p->workers[placed]);
+    } else if (atomic_load(&p->nparked) > 0) {
+        /* owner is busy: let an idle worker steal it */
+        for (int i = 1; i < p->n; ++i) {
+            wp_worker_t *w = &p->workers[(placed + i) % p->n];
+            if (atomic_load(&w->parked)) { wp_wake(w); break; }
+        }
+    }
+    return 0;
+}
+
+static int wp_try_get(worker_pool_t *p, int self, task_t **t) {
+    wp_worker_t *own = &p->workers[self];
+    /* a steady stream of priority tasks still lets bulk work through now and then */
+    if (own->prio_run >= WP_PRIO_BURST && wp_bulk_pop(own, t) == 0) {
+        own->prio_run = 0;
+        return 0;
+    }
+    if (tq_try_pop(&own->prio, t) == 0) {
+        own->prio_run++;
+        return 0;
+    }
+    own->prio_run = 0;
+    if (wp_bulk_pop(own, t) == 0) return 0;
+    for (int i = 1; i < p->n; ++i) {
+        if (tq_try_pop(&p->workers[(self + i) % p->n].prio, t) == 0) return 0;
+    }
+    for (int i = 1; i < p->n; ++i) {
+        if (wp_bulk_pop(&p->workers[(self + i) % p->n], t) == 0) return 0;
+    }
+    return -1;
+}
+
+int wp_next(worker_pool_t *p, int self, task_t **t) {
+    wp_worker_t *w = &p->workers[self];
+    for (;;) {
+        if (wp_try_get(p, self, t) == 0) return 0;
+
+        atomic_store(&w->parked, 1);
+        atomic_fetch_add(&p->nparked, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        int got = wp_try_get(p, self, t) == 0;
+        int closed = atomic_load(&p->closed);
+        if (!got && !closed) {
+            pthread_mutex_lock(&w->lock);
+            while (!w->wakeup && !atomic_load(&p->closed))
+                pthread_cond_wait(&w->cond, &w->lock);
+            w->wakeup = 0;
+            pthread_mutex_unlock(&w->lock);
+        }
+        atomic_fetch_sub(&p->nparked, 1);
+        atomic_store(&w->parked, 0);
+        if (got) return 0;
+        if (closed) return wp_try_get(p, self, t);
+    }
+}
+
+void wp_close(worker_pool_t *p) {
+    atomic_store(&p->closed, 1);
+    for (int i = 0; i < p->n; ++i) {
+        tq_close(&p->workers[i].prio);
+        wp_wake(&p->workers[i]);
+    }
+}
+
+size_t wp_size(worker_pool_t *p) {
+    size_t total = 0;
+    for (int i = 0; i < p->n; ++i) {
+        total += tq_size(&p->workers[i].prio) + atomic_load_explicit(&p->workers[i].bulk_len, memory_order_relaxed);
+    }
+    return total;
+}
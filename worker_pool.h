@@ -0,0 +1,79 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "task_queue.h"
+
+#define WP_FLOW_BITS 6
+#define WP_FLOWS (1 << WP_FLOW_BITS) // fair-queue flows per worker; users hash onto them
+#define WP_QUANTUM 16                // cost units a flow may spend per round
+#define WP_COST_UNIT (64 * 1024)     // a task costs 1 plus one unit per this many bytes it carries
+#define WP_PRIO_BURST 8              // priority tasks in a row before a waiting bulk task goes first
+
+#define WP_BUSY 1                    // wp_submit: every queue that could take the task is full
+
+typedef enum {
+    WP_BULK,  // transfers: fair-queued per user
+    WP_PRIO   // cheap metadata ops: served ahead of bulk work
+} wp_lane_t;
+
+/* One user's (or, on a hash collision, a few users') queued bulk tasks */
+typedef struct {
+    task_t *head, *tail;  // linked through task->next
+    size_t len;
+    long deficit;         // cost units left in this round
+    int next_active;      // next flow in the round, -1 at the end
+    int active;
+} wp_flow_t;
+
+typedef struct {
+    task_queue_t prio;        // priority lane, lock-free
+    pthread_mutex_t qlock;    // bulk flows and the round below
+    wp_flow_t flows[WP_FLOWS];
+    int act_head, act_tail;   // flows with tasks, in round-robin order
+    _Atomic size_t bulk_len;  // tasks in all flows; read without qlock to skip empty workers
+    int prio_run;             // priority tasks served in a row (owner thread only)
+    pthread_mutex_t lock;     // parking only
+    pthread_cond_t cond;
+    int wakeup;               // protected by lock
+    _Atomic int parked;
+} wp_worker_t;
+
+/*
+ * Work-stealing dispatch: each worker owns a queue, submitters route a task
+ * to a worker chosen by a caller-supplied hint (e.g. a user hash, so one
+ * user's files stay hot on one core) and idle workers steal from the others
+ * before parking.
+ *
+ * Within a worker, bulk tasks are kept per flow (the hint picks the flow)
+ * and served by deficit round robin, weighted by the bytes each task
+ * carries: a user with a hundred large uploads queued takes its turn
+ * alongside the others instead of ahead of them. Priority tasks bypass the
+ * flows. Queues never block the submitter; a full one is reported so the
+ * request can be turned away at once.
+ */
+typedef struct {
+    wp_worker_t *workers;
+    int n;
+    size_t cap;               // bulk tasks per worker
+    size_t flow_cap;          // bulk tasks per flow
+    _Atomic int nparked;
+    _Atomic int closed;
+} worker_pool_t;
+
+/* queue_cap bounds each worker's priority lane and bulk flows; one flow may hold half of it */
+int wp_init(worker_pool_t *p, int nworkers, int queue_cap);
+void wp_destroy(worker_pool_t *p);
+/* Queue t on worker (hint % n), spilling to other workers if its queue or
+ * flow there is full. 0 if queued, WP_BUSY if every worker is full, -1
+ * once the pool is closed. Never blocks. */
+int wp_submit(worker_pool_t *p, task_t *t, unsigned hint, wp_lane_t lane);
+/* Next task for worker `self`: own queue first, then steal, then park.
+ * Returns -1 when the pool is closed and drained. */
+int wp_next(worker_pool_t *p, int self, task_t **t);
+void wp_close(worker_pool_t *p);
+/* approximate number of queued tasks across all workers */
+size_t wp_size(worker_pool_t *p);
+
+#endif // WORKER_POOL_H